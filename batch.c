@@ -0,0 +1,373 @@
+/*
+Batch mode: Embraces many files in one run. All input files are read in one
+batch, embraced in parallel, and written in one batch (see fileio.c). Files
+that did not change since the last run are skipped (see manifest.c).
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#include "util.h"
+#include "embrace.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "includes.h"
+#include "manifest.h"
+#include "batch.h"
+
+/*
+Returns the path of the embraced file of file in out_dir as a newly allocated
+string, e.g., out/src/foo.c for src/foo.d.c. The path stays in out_dir, "/",
+".", and ".." of file are resolved as by path_in_dir, e.g., out/src/foo.c for
+../src/foo.d.c.
+*/
+char* embraced_path(char* out_dir, char* file) {
+    require_not_null(out_dir);
+    require_not_null(file);
+    char* path = path_in_dir(out_dir, file, 0);
+    int len = strlen(path);
+    if (len > 4 && strcmp(path + len - 4, ".d.c") == 0) {
+        strcpy(path + len - 4, ".c"); // foo.d.c -> foo.c
+    }
+    return path;
+}
+
+typedef struct EmbraceFiles EmbraceFiles;
+struct EmbraceFiles {
+    char** files;
+    Files input;
+    String* output;
+    bool* ok;
+    Includes* includes; // per file, NULL if the include graph is not updated
+    EmbraceOptions options; // format and line directives
+};
+
+static void embrace_file(int index, int worker, void* context) {
+    EmbraceFiles* e = context;
+    String input = e->input.contents[index];
+    if (input.s == NULL) {
+        fprintf(stderr, "%s: Cannot read file.\n", e->files[index]);
+        e->ok[index] = false;
+        return;
+    }
+    EmbraceOptions options = e->options;
+    if (e->includes != NULL) options.includes = &e->includes[index];
+    e->ok[index] = embrace_into(e->files[index], input, &e->output[index], &options);
+}
+
+typedef struct CopyFiles CopyFiles;
+struct CopyFiles {
+    char* out_dir;
+    char** files;
+    bool* ok;
+};
+
+static void copy_verbatim_file(int index, int worker, void* context) {
+    CopyFiles* c = context;
+    char* name = embraced_path(c->out_dir, c->files[index]);
+    make_dirs(name);
+    c->ok[index] = copy_file(c->files[index], name);
+    if (!c->ok[index]) fprintf(stderr, "%s: Cannot write file.\n", name);
+    free(name);
+}
+
+// Checks whether the file starts with the verbatim marker (see is_verbatim).
+static bool is_verbatim_file(char* file) {
+    char head[64];
+    ptrdiff_t n = read_head(file, head, sizeof(head));
+    return n >= 0 && is_verbatim(make_string2(head, n));
+}
+
+/*
+Embraces the given files into out_dir (see embraced_path). Files that did not
+change since an earlier run are skipped without opening them, and outputs whose
+content did not change are not written again (see manifest.c). Files marked as
+verbatim are copied instead, without reading them (see copy_file). If
+include_db is not NULL, the includes of the files are recorded in it (see
+includes.c). Options may be NULL, they must not have tags or includes. Returns
+the number of files that could not be embraced or written.
+*/
+int embrace_files(char* out_dir, int count, char** files, char* include_db,
+        EmbraceOptions* options) {
+    require_not_null(out_dir);
+    require("not negative", count >= 0);
+    require("no tags or includes",
+            options == NULL || (options->tags == NULL && options->includes == NULL));
+    int n = count > 0 ? count : 1;
+    Manifest manifest = read_manifest(out_dir, options);
+    char** outputs = xmalloc(n * sizeof(char*));
+    for (int i = 0; i < count; i++) outputs[i] = embraced_path(out_dir, files[i]);
+    ManifestEntry* current = xmalloc(n * sizeof(ManifestEntry));
+    stat_files(count, files, outputs, current);
+    // a new include database needs the includes of all files
+    char head[1];
+    bool skip = include_db == NULL || read_head(include_db, head, 1) >= 0;
+
+    char** names = xmalloc(n * sizeof(char*));
+    char** verbatim = xmalloc(n * sizeof(char*));
+    int* embrace_index = xmalloc(n * sizeof(int));
+    int* verbatim_index = xmalloc(n * sizeof(int));
+    int embrace_count = 0;
+    int verbatim_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (skip && is_unchanged(&manifest, &current[i])) continue;
+        if (is_verbatim_file(files[i])) {
+            verbatim_index[verbatim_count] = i;
+            verbatim[verbatim_count++] = files[i];
+        } else {
+            embrace_index[embrace_count] = i;
+            names[embrace_count++] = files[i];
+        }
+    }
+    CopyFiles c = {out_dir, verbatim, xcalloc(n, sizeof(bool))};
+    parallel_for(verbatim_count, copy_verbatim_file, &c);
+
+    EmbraceFiles e = {names, read_files(embrace_count, names), xcalloc(n, sizeof(String)), 
+        xcalloc(n, sizeof(bool)), NULL};
+    if (options != NULL) e.options = *options;
+    if (include_db != NULL) e.includes = xcalloc(n, sizeof(Includes));
+    parallel_for(embrace_count, embrace_file, &e);
+
+    // write the successfully embraced files, unless the output is unchanged
+    char** out_names = xmalloc(n * sizeof(char*));
+    String* out_contents = xmalloc(n * sizeof(String));
+    bool* written = xmalloc(n * sizeof(bool));
+    ManifestEntry* updates = xmalloc(n * sizeof(ManifestEntry));
+    char** update_outputs = xmalloc(n * sizeof(char*));
+    int out_count = 0;
+    int update_count = 0;
+    int errors = 0;
+    for (int i = 0; i < embrace_count; i++) {
+        int k = embrace_index[i];
+        ManifestEntry update = current[k];
+        if (!e.ok[i]) {
+            update.size = -1; // removes the record
+            updates[update_count] = update;
+            update_outputs[update_count++] = outputs[k];
+            errors++;
+            continue;
+        }
+        update.hash = hash_output(e.output[i]);
+        ManifestEntry* old = find_entry(&manifest, files[k]);
+        if (old == NULL || old->hash != update.hash || old->output_size != current[k].output_size
+                || old->output_mtime != current[k].output_mtime) {
+            make_dirs(outputs[k]);
+            out_names[out_count] = outputs[k];
+            out_contents[out_count] = e.output[i];
+            out_count++;
+        }
+        updates[update_count] = update;
+        update_outputs[update_count++] = outputs[k];
+    }
+    errors += write_files(out_count, out_names, out_contents, written);
+    for (int i = 0; i < out_count; i++) {
+        if (!written[i]) fprintf(stderr, "%s: Cannot write file.\n", out_names[i]);
+    }
+    for (int i = 0; i < verbatim_count; i++) {
+        ManifestEntry update = current[verbatim_index[i]];
+        if (!c.ok[i]) {
+            update.size = -1;
+            errors++;
+        }
+        updates[update_count] = update;
+        update_outputs[update_count++] = outputs[verbatim_index[i]];
+    }
+
+    // record the outputs as they are now, an output that could not be written
+    // does not exist or differs from the recorded one
+    if (update_count > 0) {
+        stat_files(update_count, NULL, update_outputs, updates);
+        if (!write_manifest(out_dir, &manifest, update_count, updates, options)) {
+            fprintf(stderr, "%s: Cannot write manifest.\n", out_dir);
+            errors++;
+        }
+    }
+
+    if (include_db != NULL) {
+        // only the files that were embraced or copied successfully, the
+        // includes of copied files have to be read
+        char** db_names = xmalloc(n * sizeof(char*));
+        Includes* includes = xmalloc(n * sizeof(Includes));
+        int k = 0;
+        for (int i = 0; i < embrace_count; i++) {
+            if (!e.ok[i]) continue;
+            db_names[k] = names[i];
+            includes[k] = e.includes[i];
+            k++;
+        }
+        String source = {NULL, 0, 0};
+        for (int i = 0; i < verbatim_count; i++) {
+            if (!c.ok[i] || !read_file_into(verbatim[i], &source)) continue;
+            db_names[k] = verbatim[i];
+            includes[k] = new_includes();
+            add_includes(&includes[k], source);
+            k++;
+        }
+        free(source.s);
+        if (k > 0 && !update_include_db(include_db, k, db_names, includes)) {
+            fprintf(stderr, "%s: Cannot update include database.\n", include_db);
+            errors++;
+        }
+        for (int i = 0; i < k; i++) free_includes(&includes[i]);
+        for (int i = 0; i < embrace_count; i++) {
+            if (!e.ok[i]) free_includes(&e.includes[i]);
+        }
+        free(e.includes);
+        free(includes);
+        free(db_names);
+    }
+
+    for (int i = 0; i < embrace_count; i++) free(e.output[i].s);
+    for (int i = 0; i < count; i++) free(outputs[i]);
+    free(outputs);
+    free(current);
+    free(updates);
+    free(update_outputs);
+    free(out_names);
+    free(out_contents);
+    free(written);
+    free(e.output);
+    free(e.ok);
+    free_files(&e.input);
+    free(c.ok);
+    free(embrace_index);
+    free(verbatim_index);
+    free(verbatim);
+    free(names);
+    free_manifest(&manifest);
+    return errors;
+}
+
+/*
+Puts consecutive files into units of at most max_size bytes (a file larger than
+that gets a unit of its own). Returns the number of units. Sets unit[i] to the
+unit of file i if unit is not NULL.
+*/
+static int fill_units(int count, ptrdiff_t* sizes, ptrdiff_t max_size, /*out*/int* unit) {
+    int units = 1;
+    ptrdiff_t size = 0;
+    for (int i = 0; i < count; i++) {
+        if (size > 0 && size + sizes[i] > max_size) {
+            units++;
+            size = 0;
+        }
+        size += sizes[i];
+        if (unit != NULL) unit[i] = units - 1;
+    }
+    return units;
+}
+
+/*
+Unity build: Embraces the files into out_dir/unity_<k>.c, k = 0, 1, ..., each
+a single translation unit of consecutive files. There are as many units as the
+size budget (bytes of debraced code per unit) requires, and the files are split
+such that the largest unit is as small as possible, so that the units take
+about the same time to compile. A #line directive at the start of
+each file maps diagnostics back to the debraced file, whose line numbers are
+kept by embracing. In format mode, which changes the line numbers, #line
+directives are always inserted (see EmbraceOptions). A unit is only written if its content changes, and units
+left over from an earlier run with more units are removed. If include_db is not
+NULL, the includes of the files are recorded in it. Options are as for
+embrace_files. Returns the number of files that could not be embraced (then no
+unit is written) plus the number of units that could not be written.
+*/
+int embrace_unity(char* out_dir, ptrdiff_t budget, int count, char** files, char* include_db,
+        EmbraceOptions* options) {
+    require_not_null(out_dir);
+    require("positive", budget > 0);
+    require("not negative", count >= 0);
+    require("no tags or includes",
+            options == NULL || (options->tags == NULL && options->includes == NULL));
+    int n = count > 0 ? count : 1;
+    EmbraceFiles e = {files, read_files(count, files), xcalloc(n, sizeof(String)), 
+        xcalloc(n, sizeof(bool)), NULL};
+    if (options != NULL) e.options = *options;
+    // only the first line of each file has a #line directive otherwise
+    if (e.options.format) e.options.line_directives = true;
+    ptrdiff_t* sizes = xmalloc(n * sizeof(ptrdiff_t));
+    ptrdiff_t total = 0;
+    for (int i = 0; i < count; i++) {
+        sizes[i] = e.input.contents[i].len; // before embrace_into modifies it
+        total += sizes[i];
+    }
+    if (include_db != NULL) e.includes = xcalloc(n, sizeof(Includes));
+    parallel_for(count, embrace_file, &e);
+    int errors = 0;
+    for (int i = 0; i < count; i++) {
+        if (!e.ok[i]) errors++;
+    }
+
+    // consecutive files, such that the largest unit is as small as possible
+    ptrdiff_t units = total / budget + (total % budget != 0);
+    if (units < 1) units = 1;
+    ptrdiff_t lo = 0, hi = total; // the size of the largest unit
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] > lo) lo = sizes[i];
+    }
+    while (lo < hi) {
+        ptrdiff_t mid = lo + (hi - lo) / 2;
+        if (fill_units(count, sizes, mid, NULL) <= units) hi = mid; else lo = mid + 1;
+    }
+    int* unit = xmalloc(n * sizeof(int));
+    units = fill_units(count, sizes, lo, unit);
+
+    String existing = {NULL, 0, 0};
+    for (int u = 0; errors == 0 && u < units; u++) {
+        ptrdiff_t size = 1;
+        for (int i = 0; i < count; i++) {
+            if (unit[i] == u) size += e.output[i].len + 2 * strlen(files[i]) + 32;
+        }
+        String content = new_string(size);
+        for (int i = 0; i < count; i++) {
+            if (unit[i] != u) continue;
+            append_line_directive(&content, 1, files[i]);
+            append_string(&content, e.output[i]);
+            if (e.output[i].len > 0 && e.output[i].s[e.output[i].len - 1] != '\n') {
+                append_char(&content, '\n');
+            }
+        }
+        char name[strlen(out_dir) + 32];
+        snprintf(name, sizeof(name), "%s/unity_%d.c", out_dir, u);
+        bool unchanged = read_file_into(name, &existing) && existing.len == content.len &&
+            memcmp(existing.s, content.s, content.len) == 0;
+        if (!unchanged && !(make_dirs(name) && write_file(name, content))) {
+            fprintf(stderr, "%s: Cannot write file.\n", name);
+            errors++;
+        }
+        free(content.s);
+    }
+    free(existing.s);
+    for (int u = units; errors == 0; u++) {
+        char name[strlen(out_dir) + 32];
+        snprintf(name, sizeof(name), "%s/unity_%d.c", out_dir, u);
+        if (remove(name) != 0) break;
+    }
+
+    if (include_db != NULL) {
+        char** names = xmalloc(n * sizeof(char*));
+        Includes* includes = xmalloc(n * sizeof(Includes));
+        int k = 0;
+        for (int i = 0; i < count; i++) {
+            if (!e.ok[i]) continue;
+            names[k] = files[i];
+            includes[k] = e.includes[i];
+            k++;
+        }
+        if (!update_include_db(include_db, k, names, includes)) {
+            fprintf(stderr, "%s: Cannot update include database.\n", include_db);
+            errors++;
+        }
+        for (int i = 0; i < count; i++) free_includes(&e.includes[i]);
+        free(e.includes);
+        free(includes);
+        free(names);
+    }
+
+    for (int i = 0; i < count; i++) free(e.output[i].s);
+    free(unit);
+    free(sizes);
+    free(e.output);
+    free(e.ok);
+    free_files(&e.input);
+    return errors;
+}
@@ -0,0 +1,18 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef batch_h_INCLUDED
+#define batch_h_INCLUDED
+
+#include "util.h"
+#include "embrace.h"
+
+char* embraced_path(char* out_dir, char* file);
+int embrace_files(char* out_dir, int count, char** files, char* include_db,
+        EmbraceOptions* options);
+int embrace_unity(char* out_dir, ptrdiff_t budget, int count, char** files, char* include_db,
+        EmbraceOptions* options);
+
+#endif // batch_h_INCLUDED
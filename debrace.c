@@ -0,0 +1,1115 @@
+/*
+Debrace mode (embrace --debrace) converts braced C into debraced C, e.g., to
+migrate existing code. It is the reverse of embracing. The braces of a block
+are removed if the layout already shows the extent of the block: The opening
+brace ends the line of the statement that it belongs to (or stands alone on the
+next line, at the same indentation), the closing brace starts a line at the
+indentation of that statement, and the statements of the block are indented
+consistently. The semicolons that embrace adds again are removed, and the
+condition of an if, for, while, or switch statement that opens such a block becomes
+"if ... do". Tabs in the indentation are expanded (8 columns). The lexer is the
+one of embrace (see next_state).
+
+The result is checked by embracing it again. Its tokens have to be those of the
+input, apart from empty statements (";") that embrace adds after blocks and
+comments. Each top-level definition is checked on its own. If it does not pass,
+the innermost block around the first difference keeps its braces and the
+definition is checked again. After MAX_RETRIES such attempts the definition
+keeps all of its braces, so that the time stays linear in the size of the file.
+If the file as a whole does not pass, it is emitted unchanged and marked as
+verbatim (see is_verbatim).
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#include "util.h"
+#include "embrace.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "debrace.h"
+
+#define TAB_WIDTH 8
+#define MAX_RETRIES 8 // checks of a top-level definition before it keeps all braces
+
+static const String token_else = {"else", 4};
+static const String token_enum = {"enum", 4};
+
+// Classes of characters (see classify).
+enum { CODE, COMMENT, LITERAL };
+
+/*
+A line of the source code. Positions are indices into the text of the file, -1
+if there is no such position.
+*/
+typedef struct Line Line;
+struct Line {
+    ptrdiff_t start, end; // end is the position of the line break
+    ptrdiff_t indent;
+    ptrdiff_t first, last; // first and last character of code or literals
+    ptrdiff_t line_comment; // start of the line comment
+    bool block_comment; // has a block comment
+    bool statement; // starts a statement
+    bool directive; // starts a preprocessor directive
+    bool preprocessor; // belongs to a preprocessor directive
+    bool open_end; // ends in a block comment or with a line continuation
+    int start_parens, parens; // open parentheses and brackets at start and end
+    int start_block, end_block; // innermost block at start and end, -1 if none
+    int opens; // last block opened in the line
+    int open_block, close_block, header_block; // candidate that the line opens, closes, starts
+};
+
+/*
+A block {...}. The statement that it belongs to starts in the header line.
+*/
+typedef struct Block Block;
+struct Block {
+    ptrdiff_t open, close; // positions of the braces, close is -1 if missing
+    int open_line, close_line, header;
+    int parent; // -1 at the top level
+    bool kind_ok; // statement or definition whose braces embrace reintroduces
+    bool struct_token, typedef_token, do_token;
+    ptrdiff_t keyword_end; // end of "if", "for", "while", or "switch", -1 if none
+    ptrdiff_t cond_open, cond_close; // parentheses of the condition
+    ptrdiff_t content_indent;
+    bool candidate; // the layout shows the extent of the block
+    bool removed; // the braces are removed
+};
+
+/*
+A source file, split into lines and blocks.
+*/
+typedef struct Source Source;
+struct Source {
+    String text; // tabs in the indentation expanded, '\0'-terminated
+    char* kinds; // class of each character of text
+    Line* lines;
+    int line_count;
+    Block* blocks;
+    int block_count;
+    bool valid; // balanced braces and terminated literals
+};
+
+/*
+The state of lexing a source file, apart from next_state.
+*/
+typedef struct Lexer Lexer;
+struct Lexer {
+    int top; // innermost open block, -1 at the top level
+    ptrdiff_t* parens; // positions of the open parentheses and brackets
+    int paren_count, paren_cap;
+    int block_cap;
+    int questions; // open '?' of conditional expressions
+    ptrdiff_t last; // last character of code or literals outside of directives
+    ptrdiff_t last_open; // parenthesis that matches the last closing one
+    ptrdiff_t statement; // first character of the current statement, -1 if none
+    int statement_line;
+    bool assignment, enum_token, struct_token, typedef_token;
+};
+
+typedef struct Token Token;
+struct Token {
+    ptrdiff_t start, len;
+    int line;
+    bool directive; // part of a preprocessor directive
+};
+
+typedef struct Tokens Tokens;
+struct Tokens {
+    Token* a;
+    int count, cap;
+};
+
+// Makes room for one more element of the given size in array a.
+static void* reserve(void* a, /*inout*/int* cap, int len, ptrdiff_t size) {
+    if (len < *cap) return a;
+    *cap = *cap > 0 ? 2 * *cap : 16;
+    a = realloc(a, *cap * size);
+    panic_if(a == NULL, "Cannot allocate memory.");
+    return a;
+}
+
+// Appends n characters to str, which grows if needed, and keeps it '\0'-terminated.
+static void append(/*inout*/String* str, char* s, ptrdiff_t n) {
+    if (str->len + n + 1 > str->cap) {
+        ptrdiff_t cap = 2 * str->cap;
+        if (cap < str->len + n + 1) cap = str->len + n + 1;
+        char* t = realloc(str->s, cap);
+        panic_if(t == NULL, "Cannot allocate memory.");
+        str->s = t;
+        str->cap = cap;
+    }
+    memcpy(str->s + str->len, s, n);
+    str->len += n;
+    str->s[str->len] = '\0';
+}
+
+static void append_indent(/*inout*/String* str, ptrdiff_t n) {
+    static char spaces[] = "                                ";
+    while (n > 0) {
+        ptrdiff_t k = n < 32 ? n : 32;
+        append(str, spaces, k);
+        n -= k;
+    }
+}
+
+// Expands the tabs in the indentation of each line.
+static String expand_tabs(String source) {
+    ptrdiff_t n = source.len;
+    for (ptrdiff_t i = 0; i < source.len; i++) {
+        if (source.s[i] == '\t') n += TAB_WIDTH - 1;
+    }
+    String t = new_string(n + 1);
+    bool indentation = true;
+    ptrdiff_t column = 0;
+    for (ptrdiff_t i = 0; i < source.len; i++) {
+        char c = source.s[i];
+        if (c == '\n') {
+            indentation = true;
+            column = 0;
+        } else if (indentation && c == '\t') {
+            do {
+                t.s[t.len++] = ' ';
+                column++;
+            } while (column % TAB_WIDTH != 0);
+            continue;
+        } else {
+            if (c != ' ') indentation = false;
+            column++;
+        }
+        t.s[t.len++] = c;
+    }
+    t.s[t.len] = '\0';
+    return t;
+}
+
+/*
+Returns the class of character c, which is followed by d. A block comment ends
+with its closing '/', which closing marks. A line comment lasts until the end
+of the line, where the caller resets the state.
+*/
+static int classify(/*inout*/int* state, /*inout*/bool* closing, char c, char d) {
+    int p = *state;
+    *state = next_state(p, c, d);
+    if (*closing) {
+        *closing = false;
+        return COMMENT;
+    }
+    if (p == 4 && *state == 0) {
+        *closing = true;
+        return COMMENT;
+    }
+    if (p == 3 || p == 4 || *state == 3 || *state == 4) return COMMENT;
+    if (p == 0 && (*state == 0 || *state == 5)) return CODE;
+    return LITERAL;
+}
+
+// Checks whether the identifier that ends at position i is token.
+static bool ends_with_token(String text, ptrdiff_t i, String token) {
+    return matches_token(text, i - token.len + 1, token);
+}
+
+static void end_statement(/*inout*/Lexer* x) {
+    x->statement = -1;
+    x->statement_line = -1;
+    x->questions = 0;
+    x->assignment = false;
+    x->enum_token = false;
+    x->struct_token = false;
+    x->typedef_token = false;
+}
+
+static void open_block(/*inout*/Source* s, /*inout*/Lexer* x, ptrdiff_t i, int line) {
+    String t = s->text;
+    s->blocks = reserve(s->blocks, &x->block_cap, s->block_count, sizeof(Block));
+    Block* b = &s->blocks[s->block_count];
+    memset(b, 0, sizeof(Block));
+    b->open = i;
+    b->close = -1;
+    b->open_line = line;
+    b->close_line = -1;
+    b->header = x->statement_line;
+    b->parent = x->top;
+    b->keyword_end = -1;
+    b->cond_open = -1;
+    b->cond_close = -1;
+    b->content_indent = -1;
+    ptrdiff_t start = x->statement;
+    ptrdiff_t p = x->last; // before the brace
+    if (x->paren_count == 0 && p >= start && !x->assignment && !x->enum_token) {
+        b->kind_ok = t.s[p] == ')' || x->struct_token ||
+            ends_with_token(t, p, token_else) || ends_with_token(t, p, token_do);
+    }
+    b->struct_token = x->struct_token;
+    b->typedef_token = x->typedef_token;
+    b->do_token = matches_token(t, start, token_do);
+    if (b->kind_ok && t.s[p] == ')' && x->last_open >= start && t.s[x->last_open] == '(') {
+        // "if (...)", "else if (...)", "for (...)", "while (...)", or "switch (...)"
+        ptrdiff_t q = x->last_open;
+        while (q > start && t.s[q - 1] == ' ') q--;
+        ptrdiff_t r = q;
+        while (r > start && is_identifier_char(t.s[r - 1])) r--;
+        ptrdiff_t first = start;
+        if (matches_token(t, start, token_else)) {
+            first += token_else.len;
+            while (first < r && t.s[first] == ' ') first++;
+        }
+        if (r == first && (matches_token(t, r, token_if) || matches_token(t, r, token_for) ||
+                matches_token(t, r, token_while) || matches_token(t, r, token_switch))) {
+            b->keyword_end = r + (q - r);
+            b->cond_open = x->last_open;
+            b->cond_close = p;
+        }
+    }
+    s->lines[line].opens = s->block_count;
+    x->top = s->block_count++;
+    if (x->paren_count == 0) end_statement(x);
+}
+
+static void close_block(/*inout*/Source* s, /*inout*/Lexer* x, ptrdiff_t i, int line) {
+    if (x->top < 0) {
+        s->valid = false;
+        return;
+    }
+    Block* b = &s->blocks[x->top];
+    b->close = i;
+    b->close_line = line;
+    x->top = b->parent;
+    if (x->paren_count == 0) end_statement(x);
+}
+
+static void lex_code(/*inout*/Source* s, /*inout*/Lexer* x, ptrdiff_t i, int line) {
+    String t = s->text;
+    char c = t.s[i];
+    if (is_identifier_char(c)) {
+        if (i == 0 || !is_identifier_char(t.s[i - 1])) {
+            if (matches_token(t, i, token_struct) || matches_token(t, i, token_union)) {
+                x->struct_token = true;
+            } else if (matches_token(t, i, token_typedef)) {
+                x->typedef_token = true;
+            } else if (matches_token(t, i, token_enum)) {
+                x->enum_token = true;
+            }
+        }
+        return;
+    }
+    switch (c) {
+        case '(': case '[':
+            x->parens = reserve(x->parens, &x->paren_cap, x->paren_count, sizeof(ptrdiff_t));
+            x->parens[x->paren_count++] = i;
+            break;
+        case ')': case ']':
+            if (x->paren_count > 0) x->last_open = x->parens[--x->paren_count];
+            break;
+        case '=':
+            if (x->paren_count == 0 && t.s[i + 1] != '=' &&
+                    (i == 0 || strchr("=!<>", t.s[i - 1]) == NULL)) {
+                x->assignment = true;
+            }
+            break;
+        case '?':
+            if (x->paren_count == 0) x->questions++;
+            break;
+        case ':':
+            // a label ends a statement, like "case 1:"
+            if (x->paren_count == 0) {
+                if (x->questions > 0) x->questions--;
+                else if (t.s[i + 1] != ':' && (i == 0 || t.s[i - 1] != ':')) end_statement(x);
+            }
+            break;
+        case ';':
+            if (x->paren_count == 0) end_statement(x);
+            break;
+        case '{':
+            open_block(s, x, i, line);
+            break;
+        case '}':
+            close_block(s, x, i, line);
+            break;
+    }
+}
+
+/*
+Splits the text of s into lines and blocks and classifies its characters.
+*/
+static void lex(/*inout*/Source* s) {
+    String t = s->text;
+    int n = 0;
+    for (ptrdiff_t i = 0; i < t.len; i++) {
+        if (t.s[i] == '\n') n++;
+    }
+    if (t.len > 0 && t.s[t.len - 1] != '\n') n++;
+    s->line_count = n;
+    s->lines = xcalloc(n > 0 ? n : 1, sizeof(Line));
+    s->kinds = xmalloc(t.len + 1);
+    s->valid = true;
+    Lexer x = {0};
+    x.top = -1;
+    x.last = -1;
+    x.last_open = -1;
+    end_statement(&x);
+    int state = 0;
+    bool closing = false;
+    bool continued = false; // the previous line ended with a line continuation
+    bool pp_continued = false; // ... and belongs to a directive
+    ptrdiff_t pos = 0;
+    for (int k = 0; k < n; k++) {
+        Line* l = &s->lines[k];
+        l->start = pos;
+        char* eol = memchr(t.s + pos, '\n', t.len - pos);
+        ptrdiff_t e = eol != NULL ? eol - t.s : t.len;
+        l->end = e > pos && t.s[e - 1] == '\r' ? e - 1 : e;
+        ptrdiff_t indent = 0;
+        while (pos + indent < l->end && t.s[pos + indent] == ' ') indent++;
+        l->indent = indent;
+        l->first = -1;
+        l->last = -1;
+        l->line_comment = -1;
+        l->opens = -1;
+        l->open_block = -1;
+        l->close_block = -1;
+        l->header_block = -1;
+        l->start_block = x.top;
+        l->start_parens = x.paren_count;
+        bool hash = pos + indent < l->end && t.s[pos + indent] == '#';
+        l->directive = !continued && state == 0 && x.paren_count == 0 && hash;
+        l->preprocessor = pp_continued || (!continued && state == 0 && hash);
+        l->statement = !l->preprocessor && !continued && state == 0 && x.paren_count == 0 &&
+            (x.last < 0 || strchr(";{}:", t.s[x.last]) != NULL);
+        l->block_comment = state == 4;
+        continued = false;
+        for (ptrdiff_t i = pos; i < e; i++) {
+            char c = t.s[i];
+            int kind = classify(&state, &closing, c, t.s[i + 1]);
+            s->kinds[i] = kind;
+            if (kind == COMMENT) {
+                if (state == 3) {
+                    if (l->line_comment < 0) l->line_comment = i;
+                } else {
+                    l->block_comment = true;
+                }
+                continue;
+            }
+            if (kind == CODE && isspace((unsigned char)c)) continue;
+            if (l->first < 0) l->first = i;
+            l->last = i;
+            if (l->preprocessor) continue;
+            if (x.statement < 0) {
+                x.statement = i;
+                x.statement_line = k;
+            }
+            if (kind == CODE) lex_code(s, &x, i, k);
+            x.last = i;
+        }
+        if (e < t.len) s->kinds[e] = CODE;
+        if (state == 3) state = 0;
+        if (state == 5) {
+            continued = true;
+            state = 0;
+        }
+        if (state != 0 && state != 4) {
+            // unterminated literal
+            s->valid = false;
+            state = 0;
+        }
+        pp_continued = l->preprocessor && continued;
+        l->open_end = continued || state == 4;
+        l->end_block = x.top;
+        l->parens = x.paren_count;
+        pos = e + 1;
+    }
+    if (x.top >= 0 || state != 0) s->valid = false;
+    free(x.parens);
+}
+
+// Returns the first character of code or literals in [i, end), -1 if none.
+static ptrdiff_t next_significant(Source* s, ptrdiff_t i, ptrdiff_t end) {
+    for (; i < end; i++) {
+        if (s->kinds[i] != COMMENT && !isspace((unsigned char)s->text.s[i])) return i;
+    }
+    return -1;
+}
+
+// Checks whether the next line opens an Allman style candidate.
+static bool precedes_allman_candidate(Source* s, int k) {
+    int m = k + 1;
+    if (m >= s->line_count) return false;
+    int c = s->lines[m].opens;
+    return c >= 0 && s->blocks[c].candidate && s->lines[m].first == s->blocks[c].open;
+}
+
+// Checks whether the lines (from, to] continue the statement of line from.
+static bool continues(Source* s, int from, int to) {
+    for (int k = from + 1; k <= to; k++) {
+        Line* p = &s->lines[k - 1];
+        if (p->parens == 0 && !p->open_end) return false;
+    }
+    return true;
+}
+
+/*
+Checks whether embrace would reintroduce the braces of block bi from the layout
+of its lines. The candidates among the child blocks have to be known.
+*/
+static bool is_candidate(/*inout*/Source* s, int bi) {
+    Block* b = &s->blocks[bi];
+    if (!b->kind_ok || b->close < 0 || b->header < 0 || b->close_line <= b->open_line) {
+        return false;
+    }
+    String t = s->text;
+    Line* lines = s->lines;
+    Line* o = &lines[b->open_line];
+    Line* c = &lines[b->close_line];
+    Line* h = &lines[b->header];
+    if (o->last != b->open || c->first != b->close || !h->statement) return false;
+    if (o->first == b->open) {
+        // Allman style, the brace is alone on the line after the statement
+        if (b->header >= b->open_line || !continues(s, b->header, b->open_line - 1) ||
+                o->indent != h->indent || o->block_comment ||
+                lines[b->open_line - 1].indent != h->indent) {
+            return false;
+        }
+    } else if (!continues(s, b->header, b->open_line) || o->indent != h->indent) {
+        // embrace matches the indentation of the line before the block
+        return false;
+    }
+    if (c->indent != h->indent || c->block_comment) return false;
+    ptrdiff_t r = next_significant(s, b->close + 1, c->end);
+    if (r >= 0) {
+        bool ok = (t.s[r] == ';' && r == c->last && b->struct_token && !b->typedef_token) ||
+            matches_token(t, r, token_else) ||
+            (b->do_token && matches_token(t, r, token_while) && t.s[c->last] == ';') ||
+            (b->struct_token && b->typedef_token && is_identifier_char(t.s[r]) &&
+                t.s[c->last] == ';');
+        if (!ok) return false;
+    }
+    ptrdiff_t indent = -1;
+    int prev = -1; // previous line with content
+    for (int k = b->open_line + 1; k < b->close_line; k++) {
+        Line* l = &lines[k];
+        if (l->first < 0 && !l->block_comment) continue; // empty for embrace
+        if (l->start_block == bi && !l->preprocessor) {
+            if (l->statement) {
+                if (indent < 0) indent = l->indent;
+                if (l->indent != indent) return false;
+            } else if (prev < 0 || !(lines[prev].parens > 0 || lines[prev].open_end ||
+                    lines[prev].preprocessor)) {
+                // continuation lines follow open parentheses or comments
+                return false;
+            }
+        }
+        if (l->end_block == bi && !l->preprocessor && l->parens == 0 && !l->open_end &&
+                l->first >= 0) {
+            // embrace appends a semicolon
+            char e = t.s[l->last];
+            if (e != ';' && e != '}' && !precedes_allman_candidate(s, k)) return false;
+        }
+        prev = k;
+    }
+    if (indent <= h->indent || lines[prev].preprocessor) return false;
+    b->content_indent = indent;
+    return true;
+}
+
+/*
+Finds the candidates. Initially the braces of all candidates are removed whose
+enclosing blocks are removed as well, since a block with braces is passed
+through as it is.
+*/
+static void find_candidates(/*inout*/Source* s) {
+    for (int i = s->block_count - 1; i >= 0; i--) {
+        s->blocks[i].candidate = is_candidate(s, i);
+    }
+    for (int i = 0; i < s->block_count; i++) {
+        Block* b = &s->blocks[i];
+        b->removed = b->candidate && (b->parent < 0 || s->blocks[b->parent].removed);
+        if (b->candidate) {
+            s->lines[b->open_line].open_block = i;
+            s->lines[b->close_line].close_block = i;
+            s->lines[b->header].header_block = i;
+        }
+    }
+}
+
+// Returns the position after the closing brace of b and what is removed with it.
+static ptrdiff_t close_end(Source* s, Block* b) {
+    Line* l = &s->lines[b->close_line];
+    ptrdiff_t q = b->close + 1;
+    if (b->struct_token && !b->typedef_token) {
+        ptrdiff_t r = next_significant(s, q, l->end);
+        if (r >= 0 && s->text.s[r] == ';') q = r + 1;
+    }
+    while (q < l->end && s->text.s[q] == ' ') q++;
+    return q;
+}
+
+// Checks whether line k has nothing that embrace sees once the braces are removed.
+static bool becomes_empty(Source* s, int k) {
+    Line* l = &s->lines[k];
+    if (l->block_comment) return false;
+    if (l->first < 0) return true;
+    int b = l->open_block;
+    if (b >= 0 && s->blocks[b].removed && l->first == s->blocks[b].open) return true;
+    b = l->close_block;
+    if (b >= 0 && s->blocks[b].removed && l->first == s->blocks[b].close) {
+        return next_significant(s, close_end(s, &s->blocks[b]), l->end) < 0;
+    }
+    return false;
+}
+
+// Returns the indentation of line k once the braces are removed.
+static ptrdiff_t new_indent(Source* s, int k) {
+    Line* l = &s->lines[k];
+    if (!l->directive) return l->indent;
+    // directives have to be at the indentation of the enclosing block
+    int b = l->start_block;
+    if (b < 0) return 0;
+    if (s->blocks[b].removed) return s->blocks[b].content_indent;
+    return l->indent;
+}
+
+// Checks whether embrace appends the semicolon that ends line k (before to).
+static bool strip_semicolon(Source* s, int k, int to) {
+    Line* l = &s->lines[k];
+    if (l->preprocessor || l->last < 0 || l->parens > 0 || l->open_end) return false;
+    // an empty statement, unless it follows a comment like "*/;"
+    if (l->first == l->last && !l->block_comment) return false;
+    if (s->text.s[l->last] != ';' || s->kinds[l->last] != CODE) return false;
+    int b = l->end_block;
+    if (b >= 0 && !s->blocks[b].removed) return false;
+    int c = l->close_block;
+    if (c >= 0 && s->blocks[c].removed && close_end(s, &s->blocks[c]) > l->last) return false;
+    ptrdiff_t end = l->line_comment >= 0 ? l->line_comment : l->end;
+    for (ptrdiff_t i = l->last + 1; i < end; i++) {
+        if (s->kinds[i] == COMMENT) return false;
+    }
+    ptrdiff_t indent = b >= 0 ? s->blocks[b].content_indent : 0;
+    for (int m = k + 1; m < to; m++) {
+        if (!becomes_empty(s, m)) return new_indent(s, m) <= indent;
+    }
+    return true;
+}
+
+typedef struct Edit Edit;
+struct Edit {
+    ptrdiff_t from, to; // replaced range of the text
+    String insert;
+};
+
+/*
+Appends the lines [from, to) of s to out with the braces of the removed blocks
+removed, or unchanged if raw. Records the source line of each line of out in
+map. Returns the number of lines appended.
+*/
+static int render(Source* s, int from, int to, bool raw, /*inout*/String* out,
+        /*out*/int* map, /*inout*/String* scratch) {
+    String t = s->text;
+    int count = 0;
+    for (int k = from; k < to; k++) {
+        Line* l = &s->lines[k];
+        bool newline = l->end < t.len;
+        if (raw) {
+            append(out, t.s + l->start, l->end - l->start);
+            if (newline) append(out, "\n", 1);
+            map[count++] = k;
+            continue;
+        }
+        Edit edits[4];
+        int n = 0;
+        int b = l->close_block;
+        if (b >= 0 && s->blocks[b].removed) {
+            edits[n++] = (Edit){s->blocks[b].close, close_end(s, &s->blocks[b]), {NULL, 0}};
+        }
+        b = l->header_block;
+        Block* h = b >= 0 ? &s->blocks[b] : NULL;
+        if (h != NULL && h->removed && h->keyword_end >= 0 && h->cond_close < l->end) {
+            // "if (...)" -> "if ... do", a condition on several lines keeps its parentheses
+            String cond = trim(make_string2(t.s + h->cond_open + 1, h->cond_close - h->cond_open - 1));
+            scratch->len = 0;
+            append(scratch, " ", 1);
+            append(scratch, cond.s, cond.len);
+            append(scratch, " do", 3);
+            edits[n++] = (Edit){h->keyword_end, h->cond_close + 1, *scratch};
+        }
+        b = l->open_block;
+        if (b >= 0 && s->blocks[b].removed) {
+            ptrdiff_t p = s->blocks[b].open;
+            while (p > l->start && t.s[p - 1] == ' ') p--;
+            edits[n++] = (Edit){p, s->blocks[b].open + 1, {NULL, 0}};
+        }
+        if (strip_semicolon(s, k, to)) {
+            edits[n++] = (Edit){l->last, l->last + 1, {NULL, 0}};
+        }
+        // the edits do not overlap, sort them by position
+        for (int i = 1; i < n; i++) {
+            for (int j = i; j > 0 && edits[j - 1].from > edits[j].from; j--) {
+                Edit e = edits[j];
+                edits[j] = edits[j - 1];
+                edits[j - 1] = e;
+            }
+        }
+        ptrdiff_t line_start = out->len;
+        append_indent(out, new_indent(s, k));
+        ptrdiff_t content_start = out->len;
+        ptrdiff_t i = l->start + l->indent;
+        for (int j = 0; j < n; j++) {
+            ptrdiff_t e = edits[j].from > i ? edits[j].from : i;
+            append(out, t.s + i, e - i);
+            append(out, edits[j].insert.s, edits[j].insert.len);
+            if (edits[j].to > i) i = edits[j].to;
+        }
+        append(out, t.s + i, l->end - i);
+        if (n > 0) {
+            while (out->len > content_start && out->s[out->len - 1] == ' ') out->len--;
+            if (out->len == content_start && l->end > l->start + l->indent) {
+                // only braces, drop the line
+                out->len = line_start;
+                continue;
+            }
+        }
+        if (newline) append(out, "\n", 1);
+        map[count++] = k;
+    }
+    return count;
+}
+
+// Splits the text into tokens. Comments and white space separate tokens.
+static void tokenize(char* s, ptrdiff_t n, /*inout*/Tokens* tokens) {
+    tokens->count = 0;
+    int state = 0;
+    bool closing = false;
+    int line = 0;
+    Token* current = NULL;
+    int current_kind = CODE;
+    bool directive = false;
+    bool line_start = true;
+    for (ptrdiff_t i = 0; i < n; i++) {
+        char c = s[i];
+        if (c == '\n') {
+            directive = directive && state == 5;
+            line_start = true;
+            line++;
+            if (state != 4) state = 0;
+            closing = false;
+            current = NULL;
+            continue;
+        }
+        int p = state;
+        int kind = classify(&state, &closing, c, i + 1 < n ? s[i + 1] : '\0');
+        if (kind == COMMENT || (kind == CODE && isspace((unsigned char)c))) {
+            current = NULL;
+            continue;
+        }
+        if (current != NULL && kind == current_kind &&
+                ((kind == LITERAL && p != 0) ||
+                (kind == CODE && is_identifier_char(c) && is_identifier_char(s[i - 1])))) {
+            current->len++;
+            continue;
+        }
+        if (line_start && c == '#' && p == 0) directive = true;
+        line_start = false;
+        tokens->a = reserve(tokens->a, &tokens->cap, tokens->count, sizeof(Token));
+        current = &tokens->a[tokens->count++];
+        *current = (Token){i, 1, line, directive};
+        current_kind = kind;
+    }
+}
+
+static bool is_token(char* s, Token t, char* word) {
+    return t.len == (ptrdiff_t)strlen(word) && memcmp(s + t.start, word, t.len) == 0;
+}
+
+/*
+Compares the tokens of b with those of a. B may have additional empty
+statements after ";", "{", "}", and directives, and at the beginning, except
+before "else" and "while". Returns -1 if they are equal, otherwise the index of the first
+token of b that differs.
+*/
+static int compare_tokens(char* as, Tokens* a, char* bs, Tokens* b) {
+    int i = 0, j = 0;
+    while (i < a->count || j < b->count) {
+        if (i < a->count && j < b->count && a->a[i].len == b->a[j].len &&
+                memcmp(as + a->a[i].start, bs + b->a[j].start, a->a[i].len) == 0) {
+            i++;
+            j++;
+        } else if (j < b->count && is_token(bs, b->a[j], ";") &&
+                (j == 0 || b->a[j - 1].directive || is_token(bs, b->a[j - 1], ";") || is_token(bs, b->a[j - 1], "{") ||
+                 is_token(bs, b->a[j - 1], "}")) &&
+                !(i < a->count && (is_token(as, a->a[i], "else") || is_token(as, a->a[i], "while")))) {
+            j++;
+        } else {
+            return j;
+        }
+    }
+    return -1;
+}
+
+/*
+Embraces text and compares its tokens with the expected ones. Returns -1 if
+they match, otherwise the line (from 0) where embracing fails or where the
+tokens differ. Text that is followed by more code ends with an empty statement
+at the top level, so that the blocks are closed as they would be by that code.
+*/
+static int verify(String text, bool followed, char* expected_text, Tokens* expected,
+        /*inout*/Tokens* tokens, /*inout*/String* buffer) {
+    // embrace modifies its input
+    buffer->len = 0;
+    append(buffer, text.s, text.len);
+    if (followed) {
+        if (text.len > 0 && text.s[text.len - 1] != '\n') append(buffer, "\n", 1);
+        append(buffer, ";", 1);
+    }
+    append(buffer, "\0\0\0\0\0\0\0", 8);
+    StringArray* lines = split_lines(buffer->s);
+    Embracer e;
+    EmbraceOptions options = {.quiet = true};
+    embrace_begin(&e, "debrace", new_string(2 * text.len + 16), &options);
+    int error = -1;
+    for (ptrdiff_t i = 0; i < lines->len; i++) {
+        if (!embrace_line(&e, &lines->a[i])) {
+            error = e.line_number - 1;
+            break;
+        }
+    }
+    if (embrace_end(&e) && error < 0) {
+        tokenize(e.output.s, e.output.len, tokens);
+        int j = compare_tokens(expected_text, expected, e.output.s, tokens);
+        if (j >= 0) {
+            if (j < tokens->count) error = tokens->a[j].line;
+            else error = lines->len > 0 ? lines->len - 1 : 0;
+        }
+    } else if (error < 0) {
+        error = lines->len > 0 ? lines->len - 1 : 0;
+    }
+    free(e.output.s);
+    free(lines);
+    return error;
+}
+
+/*
+Keeps the braces of a removed block of [b0, b1) because of an error in line
+(source line numbers): the innermost block around the line, otherwise the last
+one before it. Returns false if there is no such block.
+*/
+static bool keep_braces(/*inout*/Source* s, int b0, int b1, int line) {
+    int inner = -1;
+    int before = -1;
+    for (int i = b0; i < b1; i++) {
+        Block* b = &s->blocks[i];
+        if (!b->removed) continue;
+        if (b->header <= line && line <= b->close_line) {
+            inner = i; // the innermost one comes last
+        } else if (b->close_line < line &&
+                (before < 0 || s->blocks[before].close_line < b->close_line)) {
+            before = i;
+        }
+    }
+    int victim = inner >= 0 ? inner : before;
+    if (victim < 0) return false;
+    s->blocks[victim].removed = false;
+    for (int i = victim + 1; i < b1; i++) {
+        Block* b = &s->blocks[i];
+        if (b->removed && b->parent >= 0 && !s->blocks[b->parent].removed) b->removed = false;
+    }
+    return true;
+}
+
+// Checks whether line k starts a top-level statement or definition.
+static bool starts_chunk(Source* s, int k) {
+    Line* l = &s->lines[k];
+    return l->statement && l->start_block < 0 && l->indent == 0 && l->first >= 0;
+}
+
+/*
+Converts braced source_code into debraced C and appends it to output (see
+above). Returns false if the result would not be equivalent, then the source
+code is appended as it is, marked as verbatim.
+*/
+bool debrace_into(char* filename, String source_code, /*inout*/String* output) {
+    require_not_null(filename);
+    require_not_null(output);
+    if (is_verbatim(source_code)) {
+        append(output, source_code.s, source_code.len);
+        return true;
+    }
+    Source s = {0};
+    s.text = expand_tabs(source_code);
+    lex(&s);
+    bool ok = s.valid;
+    String result = new_string(s.text.len + 64);
+    if (ok) {
+        find_candidates(&s);
+        Tokens expected = {0};
+        Tokens tokens = {0};
+        String chunk = new_string(256);
+        String buffer = new_string(256);
+        String scratch = new_string(256);
+        int* map = xmalloc((s.line_count + 1) * sizeof(int));
+        int b0 = 0;
+        for (int from = 0; from < s.line_count;) {
+            int to = from + 1;
+            while (to < s.line_count && !starts_chunk(&s, to)) to++;
+            int b1 = b0;
+            while (b1 < s.block_count && s.blocks[b1].open_line < to) b1++;
+            ptrdiff_t start = s.lines[from].start;
+            ptrdiff_t end = to < s.line_count ? s.lines[to].start : s.text.len;
+            tokenize(s.text.s + start, end - start, &expected);
+            bool raw = false;
+            int retries = 0;
+            for (;;) {
+                chunk.len = 0;
+                int count = render(&s, from, to, raw, &chunk, map, &scratch);
+                if (raw) break;
+                int error = verify(chunk, to < s.line_count, s.text.s + start, &expected,
+                        &tokens, &buffer);
+                if (error < 0) break;
+                int line = count > 0 ? map[error < count ? error : count - 1] : from;
+                if (++retries > MAX_RETRIES || !keep_braces(&s, b0, b1, line)) {
+                    bool any = false;
+                    for (int i = b0; i < b1; i++) {
+                        any = any || s.blocks[i].removed;
+                        s.blocks[i].removed = false;
+                    }
+                    raw = !any;
+                }
+            }
+            append(&result, chunk.s, chunk.len);
+            from = to;
+            b0 = b1;
+        }
+        // the file as a whole
+        tokenize(s.text.s, s.text.len, &expected);
+        ok = verify(result, false, s.text.s, &expected, &tokens, &buffer) < 0;
+        free(expected.a);
+        free(tokens.a);
+        free(chunk.s);
+        free(buffer.s);
+        free(scratch.s);
+        free(map);
+    }
+    if (ok) {
+        append(output, result.s, result.len);
+    } else {
+        append(output, verbatim_marker.s, verbatim_marker.len);
+        append(output, "\n#line 1\n", 9);
+        append(output, source_code.s, source_code.len);
+    }
+    free(result.s);
+    free(s.text.s);
+    free(s.kinds);
+    free(s.lines);
+    free(s.blocks);
+    return ok;
+}
+
+/*
+Returns the path of the debraced file for file in out_dir, e.g., out/src/foo.d.c
+for src/foo.c. The path stays in out_dir (see path_in_dir).
+*/
+char* debraced_path(char* out_dir, char* file) {
+    require_not_null(out_dir);
+    require_not_null(file);
+    char* path = path_in_dir(out_dir, file, 2);
+    int len = strlen(path);
+    if (len > 2 && strcmp(path + len - 2, ".c") == 0 &&
+            !(len > 4 && strcmp(path + len - 4, ".d.c") == 0)) {
+        strcpy(path + len - 2, ".d.c"); // foo.c -> foo.d.c
+    }
+    return path;
+}
+
+typedef struct DebraceFiles DebraceFiles;
+struct DebraceFiles {
+    char** files;
+    Files input;
+    String* output;
+    bool* debraced;
+};
+
+static void debrace_file(int index, int worker, void* context) {
+    DebraceFiles* c = context;
+    String source = c->input.contents[index];
+    if (source.s == NULL) return;
+    c->output[index] = new_string(source.len + 64);
+    c->debraced[index] = debrace_into(c->files[index], source, &c->output[index]);
+}
+
+/*
+Debraces the given files into out_dir (see debraced_path), in parallel. Files
+that would not be equivalent are marked as verbatim, which is reported on
+stderr. Returns the number of files that could not be read or written.
+*/
+int debrace_files(char* out_dir, int count, char** files) {
+    require_not_null(out_dir);
+    require("not negative", count >= 0);
+    int n = count > 0 ? count : 1;
+    DebraceFiles c = {files, read_files(count, files),
+        xcalloc(n, sizeof(String)), xcalloc(n, sizeof(bool))};
+    parallel_for(count, debrace_file, &c);
+    char** names = xmalloc(n * sizeof(char*));
+    String* contents = xmalloc(n * sizeof(String));
+    bool* written = xmalloc(n * sizeof(bool));
+    int errors = 0;
+    int k = 0;
+    for (int i = 0; i < count; i++) {
+        if (c.input.contents[i].s == NULL) {
+            fprintf(stderr, "%s: Cannot read file.\n", files[i]);
+            errors++;
+            continue;
+        }
+        if (!c.debraced[i]) {
+            fprintf(stderr, "%s: Not equivalent when debraced, marked as verbatim.\n", files[i]);
+        }
+        names[k] = debraced_path(out_dir, files[i]);
+        make_dirs(names[k]);
+        contents[k++] = c.output[i];
+    }
+    errors += write_files(k, names, contents, written);
+    for (int i = 0; i < k; i++) {
+        if (!written[i]) fprintf(stderr, "%s: Cannot write file.\n", names[i]);
+        free(names[i]);
+    }
+    for (int i = 0; i < count; i++) free(c.output[i].s);
+    free_files(&c.input);
+    free(c.output);
+    free(c.debraced);
+    free(names);
+    free(contents);
+    free(written);
+    return errors;
+}
+
+// Debraces source and returns the result in a newly allocated String.
+static String debrace_string(char* source, bool* ok) {
+    String output = new_string(64);
+    *ok = debrace_into("test", make_string(source), &output);
+    return output;
+}
+
+void debrace_test(void) {
+    bool ok;
+    String s = debrace_string(
+            "int f(int x) {\n"
+            "    if (x > 0) {\n"
+            "        x--;\n"
+            "    } else {\n"
+            "        x++;\n"
+            "    }\n"
+            "    return x;\n"
+            "}\n", &ok);
+    test_equal_i(ok, true);
+    test_equal_s(s,
+            "int f(int x)\n"
+            "    if x > 0 do\n"
+            "        x--\n"
+            "    else\n"
+            "        x++\n"
+            "    return x\n");
+    free(s.s);
+
+    // Allman style, do-while, typedef struct
+    s = debrace_string(
+            "typedef struct {\n"
+            "    int x;\n"
+            "} P;\n"
+            "\n"
+            "void g(void)\n"
+            "{\n"
+            "    int i = 0;\n"
+            "    do {\n"
+            "        i++;\n"
+            "    } while (i < 3);\n"
+            "}\n", &ok);
+    test_equal_i(ok, true);
+    test_equal_s(s,
+            "typedef struct\n"
+            "    int x\n"
+            "P\n"
+            "\n"
+            "void g(void)\n"
+            "    int i = 0\n"
+            "    do\n"
+            "        i++\n"
+            "    while (i < 3)\n");
+    free(s.s);
+
+    // struct, preprocessor directive within a block
+    s = debrace_string(
+            "struct Q {\n"
+            "    int y;\n"
+            "};\n"
+            "int h(void) {\n"
+            "#ifdef X\n"
+            "    return 1;\n"
+            "#endif\n"
+            "    return 0;\n"
+            "}\n", &ok);
+    test_equal_i(ok, true);
+    test_equal_s(s,
+            "struct Q\n"
+            "    int y\n"
+            "int h(void)\n"
+            "    #ifdef X\n"
+            "    return 1\n"
+            "    #endif\n"
+            "    return 0\n");
+    free(s.s);
+
+    // braces that the layout does not show are kept
+    s = debrace_string(
+            "int k(int x) {\n"
+            "    if (x) { return 1; }\n"
+            "    int a[] = {\n"
+            "        1, 2\n"
+            "    };\n"
+            "    switch (x) {\n"
+            "        case 1: return 2;\n"
+            "    }\n"
+            "    return 0;\n"
+            "}\n", &ok);
+    test_equal_i(ok, true);
+    test_equal_s(s,
+            "int k(int x)\n"
+            "    if (x) { return 1; }\n"
+            "    int a[] = {\n"
+            "        1, 2\n"
+            "    }\n"
+            "    switch x do\n"
+            "        case 1: return 2\n"
+            "    return 0\n");
+    free(s.s);
+
+    // an unbraced body keeps the braces of the enclosing block
+    s = debrace_string(
+            "void u(int x) {\n"
+            "    if (x)\n"
+            "        x++;\n"
+            "}\n", &ok);
+    test_equal_i(ok, true);
+    test_equal_s(s,
+            "void u(int x) {\n"
+            "    if (x)\n"
+            "        x++;\n"
+            "}\n");
+    free(s.s);
+
+    // unbalanced braces
+    s = debrace_string("void v(void) {\n", &ok);
+    test_equal_i(ok, false);
+    test_equal_s(s, "// embrace: verbatim\n#line 1\nvoid v(void) {\n");
+    free(s.s);
+
+    // the files of embrace itself are equivalent when debraced
+    char* files[] = {"util.c", "embrace.c"};
+    for (int i = 0; i < 2; i++) {
+        String source = read_file(files[i]);
+        String output = new_string(64);
+        test_equal_i(debrace_into(files[i], source, &output), true);
+        free(output.s);
+        free(source.s);
+    }
+
+    char* path = debraced_path("out", "./src/foo.c");
+    test_equal_s(make_string(path), "out/src/foo.d.c");
+    free(path);
+}
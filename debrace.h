@@ -0,0 +1,16 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef debrace_h_INCLUDED
+#define debrace_h_INCLUDED
+
+#include "util.h"
+
+bool debrace_into(char* filename, String source_code, /*inout*/String* output);
+char* debraced_path(char* out_dir, char* file);
+int debrace_files(char* out_dir, int count, char** files);
+void debrace_test(void);
+
+#endif // debrace_h_INCLUDED
@@ -38,8 +38,23 @@ end. if
 @date: November 28, 2021
 */
 
+#define _GNU_SOURCE // popen, getrusage
+#include <sys/resource.h>
 #include "util.h"
 #include "embrace.h"
+#include "watch.h"
+#include "parallel.h"
+#include "tags.h"
+#include "includes.h"
+#include "batch.h"
+#include "fileio.h"
+#include "git.h"
+#include "tar.h"
+#include "probes.h"
+#include "manifest.h"
+#include "debrace.h"
+#include "scan.h"
+#include "incremental.h"
 
 
 const int DEBUG = false;
@@ -49,16 +64,11 @@ Returns the number of spaces at the beginning of s. Returns -1 if a tab
 character has been found at the beginning of s, because tab is invalid for
 indentation.
 */
-int indentation(String s) {
-    for (int i = 0; i < s.len; i++) {
-        char c = s.s[i];
-        // error, no tabs allowed for indentation
-        if (c == '\t') return -1;
-        // first non-space character?
-        if (c != ' ') return i;
-        // assert(c == ' ')
-    }
-    return s.len;
+ptrdiff_t indentation(String s) {
+    ptrdiff_t i = leading_spaces(s);
+    // error, no tabs allowed for indentation
+    if (i < s.len && s.s[i] == '\t') return -1;
+    return i;
 }
 
 void indentation_test(void) {
@@ -78,6 +88,19 @@ void indentation_test(void) {
     test_equal_i(indentation(make_string("  ")), 2);
     test_equal_i(indentation(make_string("    ")), 4);
     test_equal_i(indentation(make_string("    hello \t ")), 4);
+    test_equal_i(indentation(make_string("                    x")), 20);
+    test_equal_i(indentation(make_string("                    \tx")), -1);
+    // a very long line
+    String s = new_string(10 * 1000 * 1000 + 2);
+    memset(s.s, ' ', 10 * 1000 * 1000);
+    s.s[10 * 1000 * 1000] = 'x';
+    s.len = 10 * 1000 * 1000 + 1;
+    test_equal_i(indentation(s), 10 * 1000 * 1000);
+    s.s[10 * 1000 * 1000] = '\t';
+    test_equal_i(indentation(s), -1);
+    s.len = 10 * 1000 * 1000;
+    test_equal_i(indentation(s), 10 * 1000 * 1000);
+    free(s.s);
 }
 
 /*
@@ -112,7 +135,7 @@ Computes the next state given the current state and two subsequent characters
 from the input.
 */
 int next_state(int state, char c, char d) {
-    require("valid state", 0 <= state && state < 8);
+    require_checked("valid state", 0 <= state && state < 8);
     int input = 0;
     switch (c) {
         case '"': input = 0; break;
@@ -133,9 +156,9 @@ int next_state(int state, char c, char d) {
         case '*': if (d == '/') input = 5; else input = 7; break;
         default: input = 7; break;
     }
-    ensure("valid input", 0 <= input && input < 8);
+    ensure_checked("valid input", 0 <= input && input < 8);
     state = states[state][input];
-    ensure("valid state", 0 <= state && state < 8);
+    ensure_checked("valid state", 0 <= state && state < 8);
     return state;
 }
 
@@ -163,14 +186,14 @@ void next_state_test(void) {
 Checks if the given character may appear in a C identifier.
 */
 bool is_identifier_char(char c) {
-    return isalnum(c) || c == '_';
+    return isalnum((unsigned char)c) || c == '_';
 }
 
 /*
 Checks whether token appears at position i in line and is surrounded by a
 boundary (a non-identifier char or the beginning or end of the string).
 */
-bool matches_token(String line, int i, String token) {
+bool matches_token(String line, ptrdiff_t i, String token) {
     if (i < 0) return false;
     bool boundary_before = (i == 0 || 
             !is_identifier_char(line.s[i-1]));
@@ -191,37 +214,85 @@ const String token_end = {"end.", 4};
 const String token_struct = {"struct", 6};
 const String token_union = {"union", 5};
 const String token_typedef = {"typedef", 7};
+const String verbatim_marker = {"// embrace: verbatim", 20};
+
+/*
+Checks whether source_code starts with the line "// embrace: verbatim". Such a
+file is braced C already and is emitted unchanged, without embracing it. Batch
+mode and single-file mode copy such files without reading them (see copy_fd).
+*/
+bool is_verbatim(String source_code) {
+    return source_code.len >= verbatim_marker.len &&
+        memcmp(source_code.s, verbatim_marker.s, verbatim_marker.len) == 0;
+}
+
+/*
+Turns "if x do" into "if (x)" (same for "for", "while", and "switch"), where
+li->do_open is the space after "if" and i the position of "do" in the line. The
+line gets shorter: the characters from *moved up to i are moved to the left by
+*removed, which then grows by the characters that are dropped. parse_line moves
+the rest of the line at the end, so that each character is moved only once. If
+the condition started on an earlier line, "(" replaces the space there and, if
+that is in the output, li->open_paren is set, so that embrace_line can insert
+the space again.
+*/
+static void close_condition(/*inout*/LineInfo* li, ptrdiff_t i, /*inout*/ptrdiff_t* moved,
+        /*inout*/ptrdiff_t* removed) {
+    char* s = li->line->s;
+    memmove(s + *moved - *removed, s + *moved, i - *moved);
+    char* at = s + i - *removed; // "do" once moved
+    char* end; // end of the replacement
+    if (li->do_open >= s && li->do_open < at) {
+        String cond = trim(make_string2(li->do_open + 1, at - li->do_open - 1));
+        char* p = li->do_open + 1;
+        memmove(p + 1, cond.s, cond.len);
+        p[0] = '(';
+        p[cond.len + 1] = ')';
+        end = p + cond.len + 2;
+    } else {
+        *li->do_open = '(';
+        if (li->do_open_in_output) li->open_paren = li->do_open;
+        end = at;
+        while (end > s + li->indent && end[-1] == ' ') end--;
+        *end++ = ')';
+    }
+    *moved = i + 2;
+    *removed = *moved - (end - s);
+}
 
 /*
 Counts each opening brace as +1 and each closing brace as -1.
 */
 void parse_line(/*inout*/LineInfo* li) {
-    require_not_null(li);
+    require_not_null_checked(li);
     String* line = li->line;
     // if previous line is a preprocessor line with a continuation,
     // then this one is a preprocessor line as well, otherwise it is not
     li->preprocessor_line = li->preprocessor_line && (li->state == 5);
     // reset state if previos line ended in a line continuation
     if (li->state == 5) li->state = 0;
-    assert("valid state", li->state == 0 || li->state == 4);
+    assert_checked("valid state", li->state == 0 || li->state == 4);
     li->indent = indentation(*line);
     if (!li->preprocessor_line) {
         li->preprocessor_line = (li->state == 0 && line->s[li->indent] == '#');
     }
     // check if '#' appears after public '*' marker
     if (!li->preprocessor_line && li->state == 0 && line->s[li->indent] == '*') {
-        int i = li->indent + 1;
+        ptrdiff_t i = li->indent + 1;
         while (i < line->len && (line->s[i] == ' ' || line->s[i] == '\t')) i++;
         if (i < line->len && line->s[i] == '#') {
             li->preprocessor_line = true;
         }
     }
-    li->end_marker = matches_token(*line, li->indent, token_end);
+    // not within a block comment
+    li->end_marker = li->state == 0 && matches_token(*line, li->indent, token_end);
     li->line_comment_index = line->len;
     li->struct_or_union_token = false;
     li->typedef_token = false;
+    ptrdiff_t moved = 0; // in format mode, the characters from here on are not moved yet
+    ptrdiff_t removed = 0; // characters dropped before moved (see close_condition)
     // replace "if ... do" with "if (...)", same for "for" and "while"
-    for (int i = li->indent; i < line->len; i++) {
+    for (ptrdiff_t i = li->indent; i < line->len; i++) {
         char c = line->s[i];
         char d = line->s[i + 1];
         li->state = next_state(li->state, c, d);
@@ -230,27 +301,29 @@ void parse_line(/*inout*/LineInfo* li) {
                 li->braces++;
             } else if (c == ')' || c == ']' || c == '}') {
                 li->braces--;
-            } else if (c == 'i' && d == 'f' && line->s[i + 2] == ' ') {
-                if (matches_token(*line, i, token_if)) {
-                    li->do_open = line->s + i + 2;
+            } else if (c == 'i' && d == 'f') {
+                // matches_token checks the length first, so that the character
+                // after the token is at most the line separator (same below)
+                if (matches_token(*line, i, token_if) && line->s[i + 2] == ' ') {
+                    li->do_open = line->s + i + 2 - removed;
                     li->do_open_in_output = false;
                     i += 2;
                 }
-            } else if (c == 'f' && d == 'o' && line->s[i + 3] == ' ') {
-                if (matches_token(*line, i, token_for)) {
-                    li->do_open = line->s + i + 3;
+            } else if (c == 'f' && d == 'o') {
+                if (matches_token(*line, i, token_for) && line->s[i + 3] == ' ') {
+                    li->do_open = line->s + i + 3 - removed;
                     li->do_open_in_output = false;
                     i += 3;
                 }
-            } else if (c == 'w' && d == 'h' && line->s[i + 5] == ' ') {
-                if (matches_token(*line, i, token_while)) {
-                    li->do_open = line->s + i + 5;
+            } else if (c == 'w' && d == 'h') {
+                if (matches_token(*line, i, token_while) && line->s[i + 5] == ' ') {
+                    li->do_open = line->s + i + 5 - removed;
                     li->do_open_in_output = false;
                     i += 5;
                 }
-            } else if (c == 's' && d == 'w' && line->s[i + 6] == ' ') {
-                if (matches_token(*line, i, token_switch)) {
-                    li->do_open = line->s + i + 6;
+            } else if (c == 's' && d == 'w') {
+                if (matches_token(*line, i, token_switch) && line->s[i + 6] == ' ') {
+                    li->do_open = line->s + i + 6 - removed;
                     li->do_open_in_output = false;
                     i += 6;
                 }
@@ -271,16 +344,22 @@ void parse_line(/*inout*/LineInfo* li) {
                 }
             } else if (c == 'd' && d == 'o' && li->do_open != NULL) {
                 if (matches_token(*line, i, token_do)) {
-                    *li->do_open = '(';
+                    if (li->format) {
+                        close_condition(li, i, &moved, &removed);
+                        i++;
+                    } else {
+                        // keeps the length of the line
+                        *li->do_open = '(';
+                        line->s[i] = ')';
+                        line->s[i + 1] = ' ';
+                    }
                     li->do_open = NULL;
                     li->do_open_in_output = false;
-                    line->s[i] = ')';
-                    line->s[i + 1] = ' ';
                 }
             }
         } else if (li->state == 3) {
             //printf("[/%d/%s]", i, line->s);
-            li->line_comment_index = i;
+            li->line_comment_index = i - removed;
             // strip line comment
             line->len = i;
             // reset state for line comment (since we are at end of line)
@@ -288,16 +367,21 @@ void parse_line(/*inout*/LineInfo* li) {
             break;
         }
     } // for
+    if (removed > 0) {
+        // the rest of the line and the character after it
+        memmove(line->s + moved - removed, line->s + moved, line->len - moved + 1);
+        line->len -= removed;
+    }
     if (li->state == 0) {
         *line = trim_right(*line);
     }
 }
 
 // Append n spaces (n >= 0) to str.
-bool append_spaces(String* str, int n) {
+bool append_spaces(String* str, ptrdiff_t n) {
     require_not_null(str);
     require("not negative", n >= 0);
-    int new_len = str->len + n;
+    ptrdiff_t new_len = str->len + n;
     panic_if(new_len > str->cap, "append_spaces overflow");
     if (new_len > str->cap) return false;
     memset(str->s + str->len, ' ', n);
@@ -305,24 +389,35 @@ bool append_spaces(String* str, int n) {
     return true;
 }
 
-// Pushes a copy of value onto stack.
+/*
+Pushes a copy of value onto stack. The line of value is copied as well, so that
+the buffer of the line may be reused while the block is open.
+*/
 void push(/*inout*/LineInfo** stack, /*in*/LineInfo* value) {
     require_not_null(stack);
     require_not_null(value);
-    LineInfo* new = xcalloc(1, sizeof(LineInfo));
+    ptrdiff_t n = value->line != NULL ? value->line->len : 0;
+    LineInfo* new = xmalloc(sizeof(LineInfo) + sizeof(String) + n + 1);
     memcpy(new, value, sizeof(LineInfo));
+    if (value->line != NULL) {
+        String* line = (String*)(new + 1);
+        char* s = (char*)(line + 1);
+        memcpy(s, value->line->s, n);
+        s[n] = '\0';
+        *line = make_string2(s, n);
+        new->line = line;
+    }
     new->next = *stack;
     *stack = new;
 }
 
-// Removes the top element from stack and returns it.
-LineInfo pop(/*inout*/LineInfo** stack) {
+// Removes the top element from stack and returns it. The caller frees it.
+LineInfo* pop(/*inout*/LineInfo** stack) {
     require_not_null(stack);
     require("not empty", *stack != NULL);
-    LineInfo result = **stack;
-    LineInfo* next = (*stack)->next;
-    free(*stack);
-    *stack = next;
+    LineInfo* result = *stack;
+    *stack = result->next;
+    result->next = NULL;
     return result;
 }
 
@@ -333,7 +428,7 @@ LineInfo* top(/*in*/LineInfo* stack) {
 }
 
 // Returns the indentation of the top stack element.
-int top_indent(/*in*/LineInfo* stack) {
+ptrdiff_t top_indent(/*in*/LineInfo* stack) {
     require("not empty", stack != NULL);
     return stack->indent;
 }
@@ -344,60 +439,196 @@ bool is_empty(/*in*/LineInfo* stack) {
 }
 
 #define APPEND_EMPTY_LINES \
+    if (format && !is_empty(indent_stack)) empty_lines = 0; \
     while (empty_lines > 0) { \
-        append_spaces(&output, li.indent); \
+        append_spaces(&output, format ? 0 : li.indent); \
         append_char(&output, '\n'); \
         empty_lines--; \
     }
 
-#define PATCH_DO_OPEN \
+#define PATCH_DO_OPEN(appended) \
     if (li.state == 5 && li.do_open != NULL && !li.do_open_in_output) { \
-        int offset = li.do_open - li.line->s; \
-        assert("valid offset", 0 <= offset < li.line->len); \
+        ptrdiff_t offset = li.do_open - (appended).s; \
+        assert("valid offset", 0 <= offset && offset < (appended).len); \
         li.do_open = output.s + output.len + offset; \
         li.do_open_in_output = true; \
     }
 
+// In format mode with line directives, emits a #line directive before the
+// current line if the line numbers of output and source code differ. Must only
+// be used at the beginning of an output line.
+#define SYNC_LINE_NUMBER \
+    if (line_directives && prev_li.state != 4 && prev_li.state != 5) { \
+        e->output_line += count_char(output.s + e->output_counted, \
+                output.len - e->output_counted, '\n'); \
+        e->output_counted = output.len; \
+        if (e->output_line != line_number) { \
+            append_line_directive(&output, line_number, e->filename); \
+            e->output_line = line_number; \
+            e->output_counted = output.len; \
+        } \
+    }
+
 /*
 Adds ia semicolon to the previous line if this line is on same or lower
 indentation level and if the previous line is not a preprocessor line or a
 comment.
 Treat file end as line at level 0.
 Take care of semicolons after struct and union definitions as well as array
-literals.
+literals. In format mode an end marker has become a closing brace, which needs
+no semicolon.
 */
 void append_semicolon(String* str, LineInfo* prev_li) {
     require_not_null(str);
     require_not_null(prev_li);
+    if (prev_li->format && prev_li->end_marker) return;
     if (prev_li->state == 0 && !prev_li->preprocessor_line && prev_li->line != NULL) {
-        int n = prev_li->line->len;
+        ptrdiff_t n = prev_li->line->len;
         if (n > 0 && prev_li->line->s[n - 1] != ';') {
             append_char(str, ';');
         }
     }
 }
 
-void check_errors(LineInfo* li, char* filename, int line_number, int current_indent) {
+/*
+Reports the first error found in li on stderr, unless quiet. Returns true if li
+is valid.
+*/
+bool check_errors(LineInfo* li, char* filename, int line_number, ptrdiff_t current_indent,
+        bool quiet) {
+    char* error = NULL;
     if (li->indent < 0) {
-        fprintf(stderr, "%s:%d: Tab used for indentation. De-braced C-Code "
-               "must only use spaces for indentation.\n", filename, line_number);
-        exit(1);
+        error = "Tab used for indentation. De-braced C-Code must only use spaces for indentation.";
+    } else if (li->braces < 0) {
+        error = "More closing braces than opening braces.";
+    } else if (li->state == 1 || li->state == 2 || li->state == 6 || li->state == 7) {
+        error = "Unterminated string or character literal.";
+    } else if (li->end_marker && li->indent >= current_indent) {
+        error = "Wrong indentation of end marker.";
     }
-    if (li->braces < 0) {
-        fprintf(stderr, "%s:%d: More closing braces than opening braces.\n", 
-                filename, line_number);
-        exit(1);
+    if (error != NULL) {
+        PROBE3(diagnostic, filename, line_number, error);
+        if (!quiet) fprintf(stderr, "%s:%d: %s\n", filename, line_number, error);
     }
-    if (li->state == 1 || li->state == 2 || li->state == 6 || li->state == 7) {
-        fprintf(stderr, "stderr, %s:%d: Unterminated string or character literal.\n", 
-                filename, line_number);
-        exit(1);
+    return error == NULL;
+}
+
+/*
+In format mode, puts the closing brace of the block that has been opened by
+opening on its own line, aligned with the opening line.
+*/
+void append_closing_brace(String* str, LineInfo* opening) {
+    require_not_null(str);
+    require_not_null(opening);
+    append_char(str, '\n');
+    append_spaces(str, opening->indent);
+    append_char(str, '}');
+    if (opening->struct_or_union_token && !opening->typedef_token) {
+        append_char(str, ';');
     }
-    if (li->end_marker && li->indent >= current_indent) {
-        fprintf(stderr, "%s:%d: Wrong indentation of end marker.\n", 
-                filename, line_number);
-        exit(1);
+}
+
+/*
+In format mode, checks if li continues the closing line of the block that has
+been opened by opening, as in "} else {", "} while (x);", and "} Name;".
+*/
+bool joins_closing_brace(LineInfo* li, LineInfo* opening) {
+    require_not_null(li);
+    require_not_null(opening);
+    static const String token_else = {"else", 4};
+    if (matches_token(*li->line, li->indent, token_else)) return true;
+    if (opening->struct_or_union_token && opening->typedef_token) return true;
+    return opening->line != NULL && matches_token(*li->line, li->indent, token_while) && 
+        matches_token(*opening->line, opening->indent, token_do);
+}
+
+// Appends a #line directive for the given line number and file.
+void append_line_directive(String* str, int line_number, char* filename) {
+    require_not_null(str);
+    require_not_null(filename);
+    char number[16];
+    snprintf(number, sizeof(number), "%d", line_number);
+    append_cstring(str, "#line ");
+    append_cstring(str, number);
+    append_cstring(str, " \"");
+    for (char* p = filename; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') append_char(str, '\\');
+        append_char(str, *p);
+    }
+    append_cstring(str, "\"\n");
+}
+
+// Returns the number of occurrences of c in the n characters at s.
+static int count_char(char* s, ptrdiff_t n, char c) {
+    int count = 0;
+    char* end = s + n;
+    while ((s = memchr(s, c, end - s)) != NULL) {
+        count++;
+        s++;
+    }
+    return count;
+}
+
+// Moves p along with the content of a buffer that moved from old_s to new_s.
+static void rebase(char** p, char* old_s, char* new_s) {
+    if (*p != NULL) *p = new_s + (*p - old_s);
+}
+
+/*
+Grows output such that at least n more characters fit. Pointers of li and
+prev_li into output are moved along.
+*/
+static void reserve_output(String* output, ptrdiff_t n, LineInfo* li, LineInfo* prev_li) {
+    if (output->len + n <= output->cap) return;
+    ptrdiff_t cap = 2 * output->cap;
+    if (cap < output->len + n) cap = output->len + n;
+    char* s = realloc(output->s, cap);
+    panic_if(s == NULL, "Cannot allocate memory.");
+    if (li->do_open_in_output) rebase(&li->do_open, output->s, s);
+    if (prev_li->do_open_in_output) rebase(&prev_li->do_open, output->s, s);
+    output->s = s;
+    output->cap = cap;
+}
+
+// Starts a new statement at line. Keeps a copy of line if tags are collected.
+static void start_statement(Embracer* e, String* line, int line_number) {
+    e->statement_line = line_number;
+    if (e->options.tags == NULL) return;
+    if (e->statement.cap < line->len + 1) {
+        char* s = realloc(e->statement.s, line->len + 1);
+        panic_if(s == NULL, "Cannot allocate memory.");
+        e->statement.s = s;
+        e->statement.cap = line->len + 1;
+    }
+    memcpy(e->statement.s, line->s, line->len);
+    e->statement.len = line->len;
+}
+
+// Returns the first line of the statement that ends with prev_li.
+static String statement(Embracer* e, LineInfo* prev_li) {
+    if (prev_li->line != NULL && e->statement_line == e->prev_line_number) {
+        return *prev_li->line;
     }
+    return e->statement;
+}
+
+/*
+Starts embracing a file. The result is appended to output, which is grown as
+needed. Options may be NULL.
+*/
+void embrace_begin(/*out*/Embracer* e, char* filename, String output, EmbraceOptions* options) {
+    require_not_null(e);
+    require_not_null(filename);
+    memset(e, 0, sizeof(Embracer));
+    e->filename = filename;
+    if (options != NULL) e->options = *options;
+    e->options.line_directives = e->options.format && e->options.line_directives;
+    e->output = output;
+    e->output_line = 1;
+    e->output_counted = output.len;
+    e->output_start = output.len;
+    e->ok = true;
+    PROBE1(file__start, filename);
 }
 
 /*
@@ -417,7 +648,7 @@ uses (roughly) the following algorithm:
           emit('}')
           pop()
         if stack_empty: error!
-          # error if stack is empty, which will happen if no matching 
+          # error if stack is empty, which will happen if no matching
           # indentation level was found
         emit(line)
       else:
@@ -425,113 +656,851 @@ uses (roughly) the following algorithm:
 Additionally the algorithm ensures that line continuations inside brackets
 (...), [...], and {...} do not trigger re-bracing. Moreover, string and
 character literals and line and block comments are ignored.
+
+Embrace_line processes the next line of the file and appends it to the output
+of e. The line is modified. It has to stay valid until the next non-empty line
+has been processed. The character after its end has to be its separator (or
+'\0'), followed by at least 6 more readable characters. Returns false if the
+line is not valid debraced C. The error is reported on stderr.
+
+By default the closing braces are appended to the last line of a block, so that
+line numbers do not change. In format mode each closing brace gets its own line
+(except for "} else", "} while", and "} Name" of typedefs), empty lines within
+blocks are removed, end markers are replaced by the closing brace, and "if x do"
+becomes "if (x)". The braces of blocks are placed as astyle places them with
+the options in .astylerc, but other spacing within lines is kept as written,
+and a statement on the line of its "if" gets no braces (unlike with astyle
+--add-braces). With line directives, #line directives are inserted where needed
+to map the output back to source lines.
+
+If options->tags is not NULL, the functions, structs, unions, and typedefs that
+are defined at the top level are added to it. If options->includes is not NULL,
+the files included by #include lines are added to it. If
+options->discard_output is set, the line is only checked and nothing is
+appended to the output.
 */
-String embrace(char* filename, String source_code) {
-    require_not_null(filename);
-    StringArray* source_code_lines = split_lines(source_code.s);
-    String output = new_string(2 * source_code.len);
-    int current_indent = 0;
-    LineInfo* indent_stack = NULL;
-    LineInfo li = {NULL, 0, 0, 0, 0, false, false, false, false, false, NULL, NULL};
-    LineInfo prev_li = li;
-    int empty_lines = 0;
-    for (int line_number = 1; line_number <= source_code_lines->len; line_number++) {
-        li.line = &source_code_lines->a[line_number - 1];
-        parse_line(&li);
-        check_errors(&li, filename, line_number, current_indent);
-        if (DEBUG) printf("i=%d, ind=%d, b=%d, s=%d, pp=%d, do=%p: ", line_number, li.indent, li.braces, li.state, li.preprocessor_line, li.do_open);
-        if (DEBUG) println_string(*li.line);
-
-        if (li.line->len == 0 || li.line->len == li.indent) {
-            if (DEBUG) printf("embrace: empty\n");
-            // Count the number of empty (or all-whitespace) lines. These are 
-            // emitted once the next indentation level is clear.
-            empty_lines++;
-            // preserve previous line as this is an empty line
-            li = prev_li;
-        } else if (prev_li.braces > 0 || prev_li.state != 0 || prev_li.preprocessor_line) {
-            if (DEBUG) printf("embrace: prev special\n");
+bool embrace_line(/*inout*/Embracer* e, /*inout*/String* line) {
+    require_not_null(e);
+    require_not_null(line);
+    require("no previous error", e->ok);
+    bool format = e->options.format;
+    bool line_directives = e->options.line_directives;
+    Tags* tags = e->options.tags;
+    LineInfo* indent_stack = e->indent_stack;
+    LineInfo li = e->li;
+    LineInfo prev_li = e->prev_li;
+    ptrdiff_t current_indent = e->current_indent;
+    ptrdiff_t empty_lines = e->empty_lines;
+    bool emit = !e->options.discard_output;
+    int line_number = ++e->line_number;
+    e->input_bytes += line->len + 1;
+    // parse_line checks this per line in the checked build only
+    assert("valid state", li.state == 0 || li.state == 4 || li.state == 5);
+
+    li.line = line;
+    li.format = format;
+    parse_line(&li);
+    if (!check_errors(&li, e->filename, line_number, current_indent, e->options.quiet)) {
+        e->ok = false;
+        return false;
+    }
+    if (e->options.includes != NULL && li.preprocessor_line) {
+        add_include(e->options.includes, *li.line);
+    }
+    if (li.open_paren != NULL) {
+        // "while(x" -> "while (x" for a condition that started on an earlier line
+        ptrdiff_t at = li.open_paren - e->output.s;
+        li.open_paren = NULL;
+        reserve_output(&e->output, 1, &li, &prev_li);
+        char* p = e->output.s + at;
+        memmove(p + 1, p, e->output.len - at);
+        *p = ' ';
+        e->output.len++;
+        if (at < e->output_counted) e->output_counted++;
+    }
+    // enough for the line, the pending empty lines, and a #line directive
+    // (closing braces are reserved below), so that the output grows linearly
+    if (emit) {
+        reserve_output(&e->output, 2 * line->len + empty_lines * (li.indent + 1) + 
+                2 * strlen(e->filename) + 64, &li, &prev_li);
+    }
+    String output = e->output;
+    if (DEBUG) printf("i=%d, ind=%td, b=%d, s=%d, pp=%d, do=%p: ", line_number, li.indent, li.braces, li.state, li.preprocessor_line, li.do_open);
+    if (DEBUG) println_string(*li.line);
+
+    if (li.line->len == 0 || li.line->len == li.indent) {
+        if (DEBUG) printf("embrace: empty\n");
+        // Count the number of empty (or all-whitespace) lines. These are
+        // emitted once the next indentation level is clear.
+        empty_lines++;
+        // preserve previous line as this is an empty line
+        li = prev_li;
+    } else if (prev_li.braces > 0 || prev_li.state != 0 || prev_li.preprocessor_line) {
+        if (DEBUG) printf("embrace: prev special\n");
+        if (prev_li.braces == 0 && prev_li.state == 0) {
+            // previous line is a complete preprocessor line
+            start_statement(e, li.line, line_number);
+        }
+        if (emit) {
             append_char(&output, '\n');
             APPEND_EMPTY_LINES
-            PATCH_DO_OPEN
+            SYNC_LINE_NUMBER
+            PATCH_DO_OPEN(*li.line)
             append_string(&output, *li.line);
-        } else if (li.indent > current_indent) {
-            if (DEBUG) printf("embrace: larger indent\n");
+        }
+    } else if (li.indent > current_indent) {
+        if (DEBUG) printf("embrace: larger indent\n");
+        if (emit) {
             append_cstring(&output, " {\n");
+            if (format) empty_lines = 0;
             APPEND_EMPTY_LINES
-            PATCH_DO_OPEN
+            SYNC_LINE_NUMBER
+            PATCH_DO_OPEN(*li.line)
             append_string(&output, *li.line);
-            push(&indent_stack, &prev_li);
-            //printf("(pushed: %d, %s)", prev_li.indent, prev_li.line);
-            current_indent = li.indent;
-        } else if (li.indent < current_indent) {
-            if (DEBUG) printf("embrace: smaller indent\n");
+        }
+        if (tags != NULL && is_empty(indent_stack)) {
+            tag_open(tags, statement(e, &prev_li), e->statement_line, &prev_li);
+        }
+        push(&indent_stack, &prev_li);
+        e->depth++;
+        PROBE3(indent__push, line_number, prev_li.indent, e->depth);
+        start_statement(e, li.line, line_number);
+        //printf("(pushed: %d, %s)", prev_li.indent, prev_li.line);
+        current_indent = li.indent;
+    } else if (li.indent < current_indent) {
+        if (DEBUG) printf("embrace: smaller indent\n");
+        if (emit) {
+            // room for the closing braces of the blocks up to the matching one
+            ptrdiff_t closing = 0;
+            for (LineInfo* opening = indent_stack; opening != NULL; opening = opening->next) {
+                closing += opening->indent + 4;
+                if (opening->indent == li.indent) break;
+            }
+            reserve_output(&output, closing, &li, &prev_li);
             append_semicolon(&output, &prev_li);
-            append_char(&output, ' ');
-            while (!is_empty(indent_stack) && top_indent(indent_stack) != li.indent) {
-                pop(&indent_stack);
+            if (!format) append_char(&output, ' ');
+        }
+        while (!is_empty(indent_stack) && top_indent(indent_stack) != li.indent) {
+            LineInfo* opening = pop(&indent_stack);
+            e->depth--;
+            PROBE3(indent__pop, line_number, opening->indent, e->depth);
+            if (!emit) {
+                // only check
+            } else if (format) {
+                append_closing_brace(&output, opening);
+            } else {
                 append_char(&output, '}');
             }
-            if (is_empty(indent_stack)) {
-                fprintf(stderr, "%s:%d: No matching indentation level found.\n", filename, line_number);
-                exit(1);
+            free(opening);
+        }
+        if (is_empty(indent_stack)) {
+            if (!e->options.quiet) {
+                fprintf(stderr, "%s:%d: No matching indentation level found.\n",
+                        e->filename, line_number);
             }
-            assert("matching indentation level found", top_indent(indent_stack) == li.indent);
-            LineInfo match = pop(&indent_stack);
-            // printf("[match: %.*s]", match.line.len, match.line.s);
-            if (li.end_marker) {
+            e->output = output;
+            e->indent_stack = indent_stack;
+            e->ok = false;
+            return false;
+        }
+        assert("matching indentation level found", top_indent(indent_stack) == li.indent);
+        LineInfo* match = pop(&indent_stack);
+        e->depth--;
+        PROBE3(indent__pop, line_number, match->indent, e->depth);
+        // printf("[match: %.*s]", match.line.len, match.line.s);
+        if (tags != NULL && is_empty(indent_stack)) {
+            tag_close(tags, &li, line_number, li.end_marker ? line_number : e->prev_line_number);
+        }
+        start_statement(e, li.line, line_number);
+        if (li.end_marker) {
+            if (!emit) {
+                // only check the marker
+            } else if (format) {
+                empty_lines = 0;
+                append_closing_brace(&output, match);
+            } else {
                 append_char(&output, '\n');
                 APPEND_EMPTY_LINES
                 append_spaces(&output, li.indent);
                 append_char(&output, '}');
-                int offset = li.indent + token_end.len;
-                String marker = make_string2(li.line->s + offset, li.line->len - offset);
-                marker = trim(marker);
-                // printf("[marker: %.*s]", marker.len, marker.s);
-                if (!contains(*match.line, marker)) {
-                    fprintf(stderr, "%s:%d: End marker '%.*s' does not match.\n", 
-                            filename, line_number, marker.len, marker.s);
-                    exit(1);
+            }
+            ptrdiff_t offset = li.indent + token_end.len;
+            String marker = make_string2(li.line->s + offset, li.line->len - offset);
+            marker = trim(marker);
+            // printf("[marker: %.*s]", marker.len, marker.s);
+            // a block opened by the first line of the file has no opening line
+            bool matches = match->line != NULL ? contains(*match->line, marker) : marker.len == 0;
+            PROBE2(end__marker, line_number, matches);
+            if (!matches) {
+                if (!e->options.quiet) {
+                    fprintf(stderr, "%s:%d: End marker '%.*s' does not match.\n",
+                            e->filename, line_number, (int)marker.len, marker.s);
                 }
+                free(match);
+                e->output = output;
+                e->indent_stack = indent_stack;
+                e->ok = false;
+                return false;
+            }
+        } else if (!emit) {
+            // only check
+        } else if (format) {
+            append_closing_brace(&output, match);
+            if (joins_closing_brace(&li, match)) {
+                empty_lines = 0;
+                String rest = make_string2(li.line->s + li.indent, li.line->len - li.indent);
+                append_char(&output, ' ');
+                PATCH_DO_OPEN(rest)
+                append_string(&output, rest);
             } else {
-                append_char(&output, '}');
-                if (match.struct_or_union_token && !match.typedef_token) {
-                    append_char(&output, ';');
-                }
                 append_char(&output, '\n');
                 APPEND_EMPTY_LINES
-                PATCH_DO_OPEN
+                SYNC_LINE_NUMBER
+                PATCH_DO_OPEN(*li.line)
                 append_string(&output, *li.line);
             }
-            current_indent = li.indent;
         } else {
-            if (DEBUG) printf("embrace: else: ");
+            append_char(&output, '}');
+            if (match->struct_or_union_token && !match->typedef_token) {
+                append_char(&output, ';');
+            }
+            append_char(&output, '\n');
+            APPEND_EMPTY_LINES
+            PATCH_DO_OPEN(*li.line)
+            append_string(&output, *li.line);
+        }
+        free(match);
+        current_indent = li.indent;
+    } else {
+        if (DEBUG) printf("embrace: else: ");
+        if (tags != NULL && current_indent == 0) {
+            tag_statement(tags, statement(e, &prev_li), e->statement_line,
+                    &prev_li, &li, line_number);
+        }
+        start_statement(e, li.line, line_number);
+        if (emit) {
             append_semicolon(&output, &prev_li);
-            if (output.len > 0) {
+            if (output.len > 0 || e->flushed) {
                 append_char(&output, '\n');
             }
             APPEND_EMPTY_LINES
-            PATCH_DO_OPEN
+            SYNC_LINE_NUMBER
+            PATCH_DO_OPEN(*li.line)
             if (DEBUG) println_string(*li.line);
             append_string(&output, *li.line);
-            if (DEBUG) printf("li.line->len: %d output->len: %d\n", li.line->len, output.len);
-        } // if
-        prev_li = li;
-    } // for
+            if (DEBUG) printf("li.line->len: %td output->len: %td\n", li.line->len, output.len);
+        }
+    } // if
+    if (li.line == line) e->prev_line_number = line_number;
+    if (li.do_open != NULL && li.state != 5) {
+        // Only a continuation line may close the condition with "do". Forget
+        // the position, so that a later "do" cannot change earlier output or
+        // turn into ")", e.g., after "while (x);", and embrace_flush is not
+        // held back.
+        li.do_open = NULL;
+        li.do_open_in_output = false;
+    }
+    // append_char checks for overflow in the checked build only, reserve_output
+    // leaves room to spare
+    assert("output reserved", !emit || output.len < output.cap);
+
+    e->output = output;
+    e->indent_stack = indent_stack;
+    e->li = li;
+    e->prev_li = li;
+    e->current_indent = current_indent;
+    e->empty_lines = emit ? empty_lines : 0;
+    return true;
+}
+
+/*
+Finishes embracing the file and closes the open blocks. Returns false if an
+error occurred before. Releases the resources of e, except for the output.
+*/
+bool embrace_end(/*inout*/Embracer* e) {
+    require_not_null(e);
+    bool ok = e->ok;
+    if (ok) {
+        LineInfo prev_li = e->prev_li;
+        Tags* tags = e->options.tags;
+        if (tags != NULL) {
+            if (is_empty(e->indent_stack)) {
+                tag_statement(tags, statement(e, &prev_li), e->statement_line, &prev_li, NULL, 0);
+            } else {
+                tag_close(tags, NULL, 0, e->prev_line_number);
+            }
+        }
+        bool emit = !e->options.discard_output;
+        if (emit) {
+            reserve_output(&e->output, e->depth * (e->current_indent + 4) + 4, &e->li, &prev_li);
+            // at end of file need to close any open blocks
+            append_semicolon(&e->output, &prev_li);
+            if (!e->options.format) append_char(&e->output, ' ');
+        }
+        while (!is_empty(e->indent_stack)) {
+            LineInfo* opening = pop(&e->indent_stack);
+            e->depth--;
+            PROBE3(indent__pop, 0, opening->indent, e->depth);
+            if (!emit) {
+                // only check
+            } else if (e->options.format) {
+                append_closing_brace(&e->output, opening);
+            } else {
+                append_char(&e->output, '}');
+                // as if a line at the indentation of the outermost block followed
+                if (is_empty(e->indent_stack) && opening->struct_or_union_token && 
+                        !opening->typedef_token) {
+                    append_char(&e->output, ';');
+                }
+            }
+            free(opening);
+        }
+        if (emit) append_char(&e->output, '\n');
+        assert("output reserved", !emit || e->output.len < e->output.cap);
+        // no "do" follows, so that embrace_flush writes all of the output
+        e->li.do_open = NULL;
+        e->prev_li.do_open = NULL;
+    }
+    while (!is_empty(e->indent_stack)) {
+        free(pop(&e->indent_stack));
+    }
+    assert("indent stack empty", e->indent_stack == NULL);
+    free(e->statement.s);
+    e->statement = (String){NULL, 0, 0};
+    PROBE5(file__end, e->filename, e->line_number, e->input_bytes, 
+            e->flushed_bytes + e->output.len - e->output_start, ok);
+    return ok;
+}
 
-    // at end of file need to close any open blocks
-    append_semicolon(&output, &prev_li);
-    append_char(&output, ' ');
-    while (!is_empty(indent_stack)) {
-        pop(&indent_stack);
-        append_char(&output, '}');
+/*
+Writes the finished part of the output to f and removes it from the output
+buffer. Output that a later "do" may still change is kept. Returns false if
+writing fails.
+*/
+bool embrace_flush(/*inout*/Embracer* e, FILE* f) {
+    require_not_null(e);
+    require_not_null(f);
+    ptrdiff_t n = e->output.len;
+    LineInfo* infos[] = {&e->li, &e->prev_li};
+    for (int i = 0; i < 2; i++) {
+        LineInfo* li = infos[i];
+        if (li->do_open_in_output && li->do_open != NULL && li->do_open - e->output.s < n) {
+            n = li->do_open - e->output.s;
+        }
+    }
+    if (n <= 0) return true;
+    if (e->output_counted < n) {
+        e->output_line += count_char(e->output.s + e->output_counted,
+                n - e->output_counted, '\n');
+        e->output_counted = n;
+    }
+    if (fwrite(e->output.s, 1, n, f) != (size_t)n) return false;
+    memmove(e->output.s, e->output.s + n, e->output.len - n);
+    e->output.len -= n;
+    e->output_counted -= n;
+    for (int i = 0; i < 2; i++) {
+        LineInfo* li = infos[i];
+        if (li->do_open_in_output && li->do_open != NULL) li->do_open -= n;
     }
-    append_char(&output, '\n');
-    assert("indent stack empty", indent_stack == NULL);
+    e->flushed = true;
+    e->flushed_bytes += n;
+    PROBE2(flush, n, e->output.len);
+    return true;
+}
+
+/*
+Embraces source_code (see embrace_line). The result is appended to output,
+which is grown if its capacity does not suffice, so that a caller may reuse the
+same buffer for many files. The content of source_code is modified. Returns
+false if source_code is not valid debraced C. The error is reported on stderr.
+*/
+bool embrace_into(char* filename, String source_code, /*inout*/String* out,
+        EmbraceOptions* options) {
+    require_not_null(filename);
+    require_not_null(out);
+    if (is_verbatim(source_code)) {
+        if (out->len + source_code.len + 1 > out->cap) {
+            ptrdiff_t cap = out->len + source_code.len + 1;
+            char* t = realloc(out->s, cap);
+            panic_if(t == NULL, "Cannot allocate memory.");
+            out->s = t;
+            out->cap = cap;
+        }
+        memcpy(out->s + out->len, source_code.s, source_code.len);
+        out->len += source_code.len;
+        if (options != NULL && options->includes != NULL) {
+            add_includes(options->includes, source_code);
+        }
+        return true;
+    }
+    StringArray* source_code_lines = split_lines(source_code.s);
+    Embracer e;
+    embrace_begin(&e, filename, *out, options);
+    LineInfo none = {NULL};
+    if (!e.options.discard_output) {
+        reserve_output(&e.output, 2 * source_code.len + 2, &none, &none);
+    }
+    for (ptrdiff_t i = 0; i < source_code_lines->len; i++) {
+        if (!embrace_line(&e, &source_code_lines->a[i])) break;
+    }
+    bool ok = embrace_end(&e);
     free(source_code_lines);
+    out->s = e.output.s;
+    out->cap = e.output.cap;
+    if (ok) out->len = e.output.len;
+    return ok;
+}
+
+/*
+Returns the embraced version of source_code in a newly allocated String. Returns
+a String with s == NULL if source_code is not valid debraced C.
+*/
+String embrace(char* filename, String source_code) {
+    String output = new_string(2 * source_code.len + 2);
+    if (!embrace_into(filename, source_code, &output, NULL)) {
+        free(output.s);
+        return (String){NULL, 0, 0};
+    }
+    return output;
+}
+
+// Embraces a copy of source with the given options, a String with s == NULL on error.
+static String embrace_with(char* source, EmbraceOptions* options) {
+    String copy = new_string(strlen(source) + 1);
+    append_cstring(&copy, source);
+    copy.s[copy.len] = '\0';
+    String output = new_string(0);
+    if (!embrace_into("test.d.c", copy, &output, options)) {
+        free(output.s);
+        output = (String){NULL, 0, 0};
+    }
+    free(copy.s);
     return output;
 }
 
+void format_test(void) {
+    EmbraceOptions format = {.format = true};
+    EmbraceOptions directives = {.format = true, .line_directives = true};
+    char* sources[] = {
+        // closing braces on their own lines, conditions in parentheses
+        "int f(void)\n    if x do\n        y++\n    return 0\n",
+        "int f(void)\n    for int i = 0; i < n; i++ do\n        if  x  do  y++\n",
+        "int f(void)\n    while x > 0 \\\n    && y do\n        x--\n    return 0\n",
+        // "} else", "} while", "} Name;"
+        "void f(void)\n    if x do\n        y++\n\n    else\n        z++\n",
+        "void g(void)\n    do\n        x++\n    while (x < 3)\n",
+        "typedef struct Point\n    int x, y\nPoint\nstruct S\n    int a\nint x\n",
+        // end markers become closing braces
+        "int f(void)\n    return 0\nend. f\n\nint x\n",
+        "struct S\n    int a\nend. S\n",
+    };
+    char* expected[] = {
+        "int f(void) {\n    if (x) {\n        y++;\n    }\n    return 0;\n}\n",
+        "int f(void) {\n    for (int i = 0; i < n; i++) {\n        if (x)  y++;\n    }\n}\n",
+        "int f(void) {\n    while (x > 0 \\\n    && y) {\n        x--;\n    }\n    return 0;\n}\n",
+        "void f(void) {\n    if (x) {\n        y++;\n    } else {\n        z++;\n    }\n}\n",
+        "void g(void) {\n    do {\n        x++;\n    } while (x < 3);\n}\n",
+        "typedef struct Point {\n    int x, y;\n} Point;\nstruct S {\n    int a;\n};\nint x;\n",
+        "int f(void) {\n    return 0;\n}\n\nint x;\n",
+        "struct S {\n    int a;\n};\n",
+    };
+    for (int i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        String actual = embrace_with(sources[i], &format);
+        test_equal_s(actual, expected[i]);
+        free(actual.s);
+    }
+
+    // #line directives where the line numbers differ
+    String actual = embrace_with("int f(void)\n    if x do\n\n        y++\n    end. if\n\n"
+            "    return 0\nend. f\n", &directives);
+    test_equal_s(actual, "int f(void) {\n    if (x) {\n#line 4 \"test.d.c\"\n        y++;\n"
+            "    }\n#line 7 \"test.d.c\"\n    return 0;\n}\n");
+    free(actual.s);
+    actual = embrace_with("int f(void)\n    if x do\n        y++\n", &directives);
+    test_equal_s(actual, "int f(void) {\n    if (x) {\n        y++;\n    }\n}\n");
+    free(actual.s);
+
+    // the default mode keeps the length of the lines
+    actual = embrace_with("int f(void)\n    if x do y++\nend. f\n", NULL);
+    test_equal_s(actual, "int f(void) {\n    if(x )  y++; \n}; \n");
+    free(actual.s);
+}
+
+#define STREAM_CHUNK_SIZE (64 * 1024)
+#define STREAM_FLUSH_SIZE (1024 * 1024)
+// room for the separator and the lookahead of parse_line after a line
+#define LINE_PADDING 8
+
+// Appends n characters to line, which is grown as needed.
+static void append_to_line(/*inout*/String* line, char* s, ptrdiff_t n) {
+    if (line->len + n + LINE_PADDING > line->cap) {
+        ptrdiff_t cap = 2 * line->cap;
+        if (cap < line->len + n + LINE_PADDING) cap = line->len + n + LINE_PADDING;
+        char* t = realloc(line->s, cap);
+        panic_if(t == NULL, "Cannot allocate memory.");
+        line->s = t;
+        line->cap = cap;
+    }
+    memcpy(line->s + line->len, s, n);
+    line->len += n;
+}
+
+// If li refers to buffer (outside the output), refers it to scratch instead.
+static void detach_do_open(LineInfo* li, String buffer, char* scratch) {
+    if (!li->do_open_in_output && li->do_open != NULL &&
+            li->do_open >= buffer.s && li->do_open < buffer.s + buffer.cap) {
+        li->do_open = scratch;
+    }
+}
+
+// Writes the n characters of chunk and the rest of in to out.
+static bool copy_stream(char* filename, char* chunk, ptrdiff_t n, FILE* in, FILE* out) {
+    for (; n > 0; n = fread(chunk, 1, STREAM_CHUNK_SIZE, in)) {
+        if (fwrite(chunk, 1, n, out) != n) {
+            fprintf(stderr, "%s: Cannot write output.\n", filename);
+            return false;
+        }
+    }
+    if (ferror(in)) {
+        fprintf(stderr, "%s: Cannot read input.\n", filename);
+        return false;
+    }
+    if (fflush(out) != 0) {
+        fprintf(stderr, "%s: Cannot write output.\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/*
+Embraces the file read from in and writes the result to out. Unlike
+embrace_into, the input is read in chunks and the output is written in pieces,
+so the memory needed depends on the longest line, the nesting depth, and the
+longest run of empty lines, but not on the size of the file. Lines are split as
+by split_lines. Returns false if the input is not valid debraced C or cannot be
+read or written. The error is reported on stderr.
+*/
+bool embrace_stream(char* filename, FILE* in, FILE* out, EmbraceOptions* options) {
+    require_not_null(filename);
+    require_not_null(in);
+    require_not_null(out);
+    char* chunk = xmalloc(STREAM_CHUNK_SIZE + 1);
+    ptrdiff_t n = fread(chunk, 1, STREAM_CHUNK_SIZE, in);
+    if (is_verbatim(make_string2(chunk, n))) {
+        bool ok = copy_stream(filename, chunk, n, in, out);
+        free(chunk);
+        return ok;
+    }
+    Embracer e;
+    embrace_begin(&e, filename, (String){NULL, 0, 0}, options);
+    // Embrace_line needs the previous non-empty line, so lines alternate
+    // between two buffers. The buffer of an empty line is reused right away.
+    String buffers[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    String lines[2];
+    int k = 0;
+    char scratch[LINE_PADDING] = {0};
+    bool separator_seen = false;
+    bool skip_next = false; // skip the character after '\r' (as split_lines)
+    bool at_end = false;
+    bool ok = true;
+    for (bool first = true; ok && !at_end; first = false) {
+        if (!first) n = fread(chunk, 1, STREAM_CHUNK_SIZE, in);
+        if (n == 0) {
+            if (ferror(in)) {
+                fprintf(stderr, "%s: Cannot read input.\n", filename);
+                ok = false;
+                break;
+            }
+            at_end = true;
+        }
+        chunk[n] = '\0'; // for strcspn
+        char* p = chunk;
+        char* end = chunk + n;
+        if (skip_next && p < end) {
+            skip_next = false;
+            p++;
+        }
+        while (ok && (p < end || at_end)) {
+            char* t = p + strcspn(p, "\n\r");
+            append_to_line(&buffers[k], p, t - p);
+            if (t == end && !at_end) break; // line continues in next chunk
+            char separator = '\0';
+            if (t < end) {
+                separator = *t;
+            } else if (!separator_seen && buffers[k].len == 0) {
+                break; // empty input has no lines
+            }
+            if (separator == '\0') at_end = true;
+            separator_seen = true;
+            // separator and zeros as the lookahead of parse_line
+            String* buffer = &buffers[k];
+            append_to_line(buffer, "", 0);
+            buffer->s[buffer->len] = separator;
+            memset(buffer->s + buffer->len + 1, 0, LINE_PADDING - 1);
+            lines[k] = make_string3(buffer->s, buffer->len, buffer->cap);
+            ok = embrace_line(&e, &lines[k]);
+            if (ok && e.output.len >= STREAM_FLUSH_SIZE) {
+                ok = embrace_flush(&e, out);
+            }
+            if (e.li.line == &lines[k]) k = 1 - k;
+            detach_do_open(&e.li, buffers[k], scratch);
+            detach_do_open(&e.prev_li, buffers[k], scratch);
+            buffers[k].len = 0;
+            if (at_end) break;
+            p = t + 1;
+            if (separator == '\r') {
+                if (p < end) {
+                    p++;
+                } else {
+                    skip_next = true;
+                }
+            }
+        }
+    }
+    if (!ok) e.ok = false;
+    ok = embrace_end(&e);
+    if (ok && (!embrace_flush(&e, out) || fflush(out) != 0)) {
+        fprintf(stderr, "%s: Cannot write output.\n", filename);
+        ok = false;
+    }
+    free(e.output.s);
+    free(buffers[0].s);
+    free(buffers[1].s);
+    free(chunk);
+    return ok;
+}
+
+// Embraces source with embrace_stream, reading and writing through temporary files.
+static String embrace_via_stream(char* source, EmbraceOptions* options, bool* ok) {
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    panic_if(in == NULL || out == NULL, "Cannot create temporary file.");
+    fputs(source, in);
+    rewind(in);
+    *ok = embrace_stream("test.d.c", in, out, options);
+    String result = new_string(ftell(out) + 1);
+    rewind(out);
+    result.len = fread(result.s, 1, result.cap - 1, out);
+    result.s[result.len] = '\0';
+    fclose(in);
+    fclose(out);
+    return result;
+}
+
+void embrace_stream_test(void) {
+    // lines longer than a chunk, "\r\n" at the end of a chunk
+    String long_line = new_string(3 * STREAM_CHUNK_SIZE);
+    append_cstring(&long_line, "int a[] = {\r\n");
+    while (long_line.len < STREAM_CHUNK_SIZE - 2) append_cstring(&long_line, "1,");
+    append_cstring(&long_line, "\r\n2}\n");
+    while (long_line.len < 2 * STREAM_CHUNK_SIZE + 100) append_cstring(&long_line, "//");
+    append_cstring(&long_line, "\nint x\n");
+    char* sources[] = {
+        "",
+        "\n",
+        "int x",
+        "int x\n\n\n",
+        "int f(void)\n    if x < 5 do\n        return 1\n\n    return 0\n",
+        "int f(void)\r\n    while x > 0 \\\n        && y do\r\n        x--\r\n",
+        "typedef struct Point\n    int x, y\nend. Point\n\nvoid g(void)\n    do\n        x++\n    while (x < 3)\n",
+        "int f(void)\n    switch x do\n        case 1:\n            return 2\n    return 0\n"
+            "end. f\nstruct S\n    int a /* b\n    */\n#define X \\\n    1\n",
+        "// embrace: verbatim\r\nint f(void) {\n    return 0; } // x\n  int y",
+        long_line.s,
+    };
+    for (int i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        for (int mode = 0; mode < 3; mode++) {
+            EmbraceOptions options = {mode >= 1, mode == 2, NULL};
+            String source = make_string(sources[i]);
+            String copy = new_string(source.len + 1);
+            append_string(&copy, source);
+            copy.s[copy.len] = '\0';
+            String expected = new_string(0);
+            bool expected_ok = embrace_into("test.d.c", copy, &expected, &options);
+            bool ok;
+            String actual = embrace_via_stream(sources[i], &options, &ok);
+            test_equal_i(ok, expected_ok);
+            if (expected_ok) {
+                test_equal_i(actual.len, expected.len);
+                test_equal_i(memcmp(actual.s, expected.s, actual.len), 0);
+            }
+            free(copy.s);
+            free(expected.s);
+            free(actual.s);
+        }
+    }
+    // verbatim files are not changed
+    String verbatim = embrace("test.d.c", make_string(sources[8]));
+    test_equal_s(verbatim, sources[8]);
+    free(verbatim.s);
+    // errors are reported for the right line
+    bool ok;
+    String actual = embrace_via_stream("int f(void)\n    int x\n  int y\n", NULL, &ok);
+    test_equal_i(ok, false);
+    free(actual.s);
+    free(long_line.s);
+}
+
+/*
+Streams more than 4 GB through embrace and checks that the memory used stays
+small. Takes a few minutes. Run with "make large".
+*/
+void embrace_large_test(void) {
+    // 352,000,000 lines of 12 and 13 bytes, i.e., 4.4 GB
+    FILE* in = popen("yes \"$(printf 'int f(void)\\n    return 0')\" | head -n 352000000", "r");
+    FILE* out = fopen("/dev/null", "w");
+    panic_if(in == NULL || out == NULL, "Cannot start generator.");
+    bool ok = embrace_stream("large.d.c", in, out, NULL);
+    test_equal_i(pclose(in), 0);
+    fclose(out);
+    test_equal_i(ok, true);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    test_equal_i(usage.ru_maxrss < 64 * 1024, true); // in KB
+}
+
+/*
+Checks source_code for the errors that embrace would report, without producing
+any output. The content of source_code is modified. Returns false if
+source_code is not valid debraced C. The error is reported on stderr.
+*/
+bool check(char* filename, String source_code) {
+    require_not_null(filename);
+    if (is_verbatim(source_code)) return true;
+    String output = {NULL, 0, 0};
+    EmbraceOptions options = {.discard_output = true};
+    bool ok = embrace_into(filename, source_code, &output, &options);
+    free(output.s);
+    return ok;
+}
+
+#ifndef EMBRACE_NO_MAIN
+
+typedef struct CheckFiles CheckFiles;
+struct CheckFiles {
+    char** filenames;
+    bool* ok; // result per file
+    String* buffers; // input buffer per worker
+};
+
+static void check_file(int index, int worker, void* context) {
+    CheckFiles* c = context;
+    char* filename = c->filenames[index];
+    String* buffer = &c->buffers[worker];
+    if (!read_file_into(filename, buffer)) {
+        fprintf(stderr, "%s: Cannot read file.\n", filename);
+        c->ok[index] = false;
+        return;
+    }
+    c->ok[index] = check(filename, *buffer);
+}
+
+/*
+Checks the given files in parallel. Returns the number of invalid files.
+*/
+int check_files(int count, char** filenames) {
+    int workers = worker_count();
+    CheckFiles c = {filenames, xcalloc(count, sizeof(bool)), xcalloc(workers, sizeof(String))};
+    parallel_for(count, check_file, &c);
+    int errors = 0;
+    for (int i = 0; i < count; i++) {
+        if (!c.ok[i]) errors++;
+    }
+    for (int i = 0; i < workers; i++) {
+        free(c.buffers[i].s);
+    }
+    free(c.buffers);
+    free(c.ok);
+    return errors;
+}
+
+// Checks a copy of source (see check).
+static bool check_source(char* source) {
+    String copy = new_string(strlen(source) + 1);
+    append_cstring(&copy, source);
+    copy.s[copy.len] = '\0';
+    bool ok = check("test.d.c", copy);
+    free(copy.s);
+    return ok;
+}
+
+void check_test(void) {
+    char* valid = "int f(void)\n    if x < 5 do\n        return 1\n\n    return 0\nend. f\n";
+    test_equal_i(check_source(""), true);
+    test_equal_i(check_source(valid), true);
+    test_equal_i(check_source("typedef struct Point\n    int x, y\nend. Point\n"), true);
+    test_equal_i(check_source("void g(void)\n    do\n        x++\n    while (x < 3)\n"), true);
+    test_equal_i(check_source("// embrace: verbatim\nint f(void) {\n\tint x\n"), true);
+    // invalid
+    test_equal_i(check_source("int f(void)\n\treturn 0\n"), false);
+    test_equal_i(check_source("char* s = \"abc\n"), false);
+    test_equal_i(check_source("int x = 1)\n"), false);
+    test_equal_i(check_source("int f(void)\n    int x\n  int y\n"), false);
+    // end markers
+    test_equal_i(check_source("int f(void)\n    return 0\nend. g\n"), false);
+    test_equal_i(check_source("int f(void)\n    return 0\n    end. f\n"), false);
+    test_equal_i(check_source("end. f\n"), false);
+
+    // check_files counts the invalid and unreadable files
+    char dir[] = "/tmp/embrace_check_XXXXXX";
+    panic_if(mkdtemp(dir) == NULL, "Cannot create directory.");
+    char* sources[] = {valid, "int f(void)\n    return 0\nend. g\n", "int x\n", "\tint x\n"};
+    char* files[5];
+    for (int i = 0; i < 5; i++) {
+        files[i] = xmalloc(strlen(dir) + 16);
+        sprintf(files[i], "%s/%d.d.c", dir, i);
+        if (i < 4) write_file(files[i], make_string(sources[i])); // 4.d.c is missing
+    }
+    test_equal_i(check_files(0, files), 0);
+    test_equal_i(check_files(1, files), 0);
+    test_equal_i(check_files(2, files), 1);
+    test_equal_i(check_files(3, files), 1);
+    test_equal_i(check_files(4, files), 2);
+    test_equal_i(check_files(5, files), 3);
+    for (int i = 0; i < 5; i++) {
+        remove(files[i]);
+        free(files[i]);
+    }
+    panic_if(remove(dir) != 0, "Cannot remove directory.");
+}
+
+// Parses a size like 4096, 512k, or 2M. Returns -1 if it is not valid.
+static ptrdiff_t parse_size(char* s) {
+    char* end;
+    long long size = strtoll(s, &end, 10);
+    if (end == s) return -1;
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    return *end == '\0' ? size : -1;
+}
+
+static void usage(void) {
+    printf("Usage: embrace [--format] [--line-directives] [--tags <tags file> | --json-tags <tags file>]\n");
+    printf("               <filename de-braced C file or - for stdin>\n");
+    printf("       embrace [--format] [--line-directives] --state <state file>\n");
+    printf("               <filename de-braced C file>\n");
+    printf("       embrace [--format] [--line-directives] --out <output directory>\n");
+    printf("               <filename de-braced C file>...\n");
+    printf("       embrace [--format] [--line-directives] --unity <bytes per unit, e.g. 512k>\n");
+    printf("               --out <output directory> <filename de-braced C file>...\n");
+    printf("       embrace --tar [--format] [--line-directives] < <input tar> > <output tar>\n");
+    printf("       embrace --check <filename de-braced C file>...\n");
+    printf("       embrace --debrace (<filename braced C file> | --out <output directory>\n");
+    printf("               <filename braced C file>...)\n");
+    printf("       embrace (--changed | --changed-since <rev>) (--check | [--format]\n");
+    printf("               [--line-directives] --out <output directory>) [<pathspec>...]\n");
+    printf("       embrace [--format] [--line-directives] --watch <input directory>\n");
+    printf("               --out <output directory>\n");
+    printf("       embrace --affected <header> [--include-db <file>] [--out <output directory>]\n");
+    printf("Embracing with --include-db <file> records the includes of the embraced files.\n");
+    exit(1);
+}
+
 int main(int argc, char* argv[]) {
     // split_test();
     // split_lines_test();
@@ -542,20 +1511,218 @@ int main(int argc, char* argv[]) {
     // trim_right_test();
     // index_of_test();
     // append_test();
+    // path_in_dir_test();
+    // watch_test();
+    // tags_test();
+    // changed_files_test();
+    // includes_test();
+    // embrace_tar_test();
+    // manifest_test();
+    // debrace_test();
+    // scan_test();
+    // incremental_test();
+    // embrace_stream_test();
+    // embrace_large_test();
+    // check_test();
+    // format_test();
     // exit(0);
 
-    if (argc != 2) {
-        printf("Usage: embrace <filename de-braced C file>\n");
-        exit(1);
+    bool check_mode = false;
+    bool git_mode = false;
+    char* since = NULL;
+    char* watch_dir = NULL;
+    char* out_dir = NULL;
+    char* tags_file = NULL;
+    bool json_tags = false;
+    char* include_db = NULL;
+    char* affected = NULL;
+    ptrdiff_t unity_budget = 0;
+    bool tar_mode = false;
+    bool debrace_mode = false;
+    char* state_file = NULL;
+    EmbraceOptions options = {0};
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--check") == 0) {
+            check_mode = true;
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watch_dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--tags") == 0 && i + 1 < argc) {
+            tags_file = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0) {
+            options.format = true;
+        } else if (strcmp(argv[i], "--line-directives") == 0) {
+            options.format = true;
+            options.line_directives = true;
+        } else if (strcmp(argv[i], "--changed") == 0) {
+            git_mode = true;
+        } else if (strcmp(argv[i], "--changed-since") == 0 && i + 1 < argc) {
+            git_mode = true;
+            since = argv[++i];
+        } else if (strcmp(argv[i], "--json-tags") == 0 && i + 1 < argc) {
+            tags_file = argv[++i];
+            json_tags = true;
+        } else if (strcmp(argv[i], "--include-db") == 0 && i + 1 < argc) {
+            include_db = argv[++i];
+        } else if (strcmp(argv[i], "--affected") == 0 && i + 1 < argc) {
+            affected = argv[++i];
+        } else if (strcmp(argv[i], "--tar") == 0) {
+            tar_mode = true;
+        } else if (strcmp(argv[i], "--debrace") == 0) {
+            debrace_mode = true;
+        } else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+            state_file = argv[++i];
+        } else if (strcmp(argv[i], "--unity") == 0 && i + 1 < argc) {
+            unity_budget = parse_size(argv[++i]);
+            if (unity_budget <= 0) usage();
+        } else {
+            usage();
+        }
+    }
+    // tags are written for a single file, and only embracing formats code
+    bool single_file = affected == NULL && watch_dir == NULL && !git_mode && !check_mode &&
+        out_dir == NULL && unity_budget == 0 && !tar_mode && !debrace_mode;
+    if (tags_file != NULL && !single_file) usage();
+    if (options.format && (check_mode || debrace_mode || affected != NULL)) usage();
+    if (affected != NULL) {
+        // the debraced files that depend on the header, and their embraced files
+        if (i != argc) usage();
+        if (include_db == NULL) include_db = ".embrace-includes";
+        AffectedFiles files;
+        if (!affected_files(include_db, affected, &files)) {
+            fprintf(stderr, "%s: Cannot read include database.\n", include_db);
+            return 1;
+        }
+        for (int k = 0; k < files.count; k++) {
+            char* name = files.names[k];
+            printf("%s\n", name);
+            if (out_dir != NULL) {
+                char* path = embraced_path(out_dir, name);
+                printf("%s\n", path);
+                free(path);
+            } else {
+                printf("%.*s.c\n", (int)strlen(name) - 4, name); // foo.d.c -> foo.c
+            }
+        }
+        free_affected_files(&files);
+        return 0;
+    }
+    if (watch_dir != NULL) {
+        if (out_dir == NULL || i != argc) usage();
+        return watch(watch_dir, out_dir, &options);
+    }
+    if (git_mode) {
+        // the remaining arguments restrict the files, like for git
+        if (check_mode == (out_dir != NULL)) usage();
+        ChangedFiles changed;
+        if (!changed_files(since, argc - i, argv + i, &changed)) return 1;
+        int errors = check_mode ? check_files(changed.count, changed.names) : 
+            embrace_files(out_dir, changed.count, changed.names, include_db, &options);
+        free_changed_files(&changed);
+        return errors == 0 ? 0 : 1;
+    }
+    if (debrace_mode) {
+        // braced C to debraced C, the reverse of embracing
+        if (out_dir != NULL) {
+            if (i >= argc) usage();
+            return debrace_files(out_dir, argc - i, argv + i) == 0 ? 0 : 1;
+        }
+        if (i != argc - 1) usage();
+        String source = read_file(argv[i]);
+        String output = new_string(source.len + 64);
+        // the verbatim file is still written, but the exit status is 1
+        bool debraced = debrace_into(argv[i], source, &output);
+        if (!debraced) {
+            fprintf(stderr, "%s: Not equivalent when debraced, marked as verbatim.\n", argv[i]);
+        }
+        bool written = fwrite(output.s, 1, output.len, stdout) == (size_t)output.len;
+        free(output.s);
+        free(source.s);
+        if (!written || fflush(stdout) != 0) {
+            fprintf(stderr, "%s: Cannot write output.\n", argv[i]);
+            return 1;
+        }
+        return debraced ? 0 : 1;
+    }
+    if (tar_mode) {
+        if (i != argc) usage();
+        return embrace_tar(stdin, stdout, &options) == 0 ? 0 : 1;
+    }
+    if (unity_budget > 0) {
+        if (out_dir == NULL || i >= argc) usage();
+        int errors = embrace_unity(out_dir, unity_budget, argc - i, argv + i, include_db, &options);
+        return errors == 0 ? 0 : 1;
+    }
+    if (out_dir != NULL) {
+        if (i >= argc) usage();
+        return embrace_files(out_dir, argc - i, argv + i, include_db, &options) == 0 ? 0 : 1;
+    }
+    if (check_mode) {
+        if (i >= argc) usage();
+        return check_files(argc - i, argv + i) == 0 ? 0 : 1;
+    }
+    if (i != argc - 1) usage();
+    char* filename = argv[i];
+    if (state_file != NULL) {
+        if (tags_file != NULL || include_db != NULL || strcmp(filename, "-") == 0) usage();
+        String source = read_file(filename);
+        String output = {NULL, 0, 0};
+        bool ok = embrace_incremental(filename, source, state_file, &output, &options, NULL);
+        bool written = !ok || fwrite(output.s, 1, output.len, stdout) == (size_t)output.len;
+        free(output.s);
+        free(source.s);
+        if (!written || fflush(stdout) != 0) {
+            fprintf(stderr, "%s: Cannot write output.\n", filename);
+            return 1;
+        }
+        return ok ? 0 : 1;
     }
-    char* filename = argv[1];
     // printf("embracing %s\n", filename);
 
-    String source_code = read_file(filename);
-    String embraced_source_code = embrace(filename, source_code);
-    print_string(embraced_source_code);
+    // stream the file, so that its size is not limited by memory ("-" is stdin)
+    FILE* in = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    panicf_if(in == NULL, "Cannot read %s", filename);
+    Tags tags = new_tags();
+    if (tags_file != NULL) options.tags = &tags;
+    Includes includes = new_includes();
+    if (include_db != NULL && in != stdin) options.includes = &includes;
+    char head[64];
+    ptrdiff_t n = in != stdin ? read_head(filename, head, sizeof(head)) : -1;
+    if (n >= 0 && is_verbatim(make_string2(head, n))) {
+        // copy the file in the kernel, the includes have to be read though
+        if (fflush(stdout) != 0 || !copy_fd(fileno(in), fileno(stdout))) {
+            fprintf(stderr, "%s: Cannot write output.\n", filename);
+            exit(1);
+        }
+        if (options.includes != NULL) {
+            String source = read_file(filename);
+            add_includes(&includes, source);
+            free(source.s);
+        }
+    } else if (!embrace_stream(filename, in, stdout, &options)) {
+        exit(1);
+    }
+    if (in != stdin) fclose(in);
+    if (options.includes != NULL && !update_include_db(include_db, 1, &filename, &includes)) {
+        fprintf(stderr, "%s: Cannot update include database.\n", include_db);
+        exit(1);
+    }
+    free_includes(&includes);
+    if (tags_file != NULL) {
+        FILE* f = fopen(tags_file, "w");
+        panicf_if(f == NULL, "Cannot write %s", tags_file);
+        if (json_tags) {
+            write_json_tags(f, filename, &tags);
+        } else {
+            write_ctags(f, filename, &tags);
+        }
+        fclose(f);
+    }
 
-    free(source_code.s);
-    free(embraced_source_code.s);
+    free_tags(&tags);
     return 0;
 }
+
+#endif // EMBRACE_NO_MAIN
@@ -16,12 +16,19 @@
 #include <stdbool.h>
 #include "util.h"
 
+/*
+Identifies the output of embrace. Change it whenever embrace produces different
+output for the same input, such that batch runs do not trust earlier manifests
+(see manifest.c).
+*/
+#define EMBRACE_VERSION "2"
+
 typedef struct LineInfo LineInfo;
 struct LineInfo {
     String* line;
-    int indent;
+    ptrdiff_t indent;
     int state;
-    int line_comment_index;
+    ptrdiff_t line_comment_index;
     int braces;
     bool preprocessor_line;
     bool end_marker;
@@ -29,8 +36,84 @@ struct LineInfo {
     bool typedef_token;
     bool do_open_in_output;
     char* do_open;
+    bool format; // "if (x)" rather than "if(x )" (see parse_line)
+    char* open_paren; // "(" that parse_line put into the output, to be spaced (format)
     LineInfo* next;
 };
 
+typedef struct Tags Tags;
+typedef struct Includes Includes;
+
+extern const String token_if;
+extern const String token_for;
+extern const String token_while;
+extern const String token_switch;
+extern const String token_do;
+extern const String token_struct;
+extern const String token_union;
+extern const String token_typedef;
+extern const String verbatim_marker;
+
+ptrdiff_t indentation(String s);
+int next_state(int state, char c, char d);
+bool is_identifier_char(char c);
+bool matches_token(String line, ptrdiff_t i, String token);
+void parse_line(/*inout*/LineInfo* li);
+
+/*
+Options for embrace_into. The default (all fields zero) keeps the line numbers
+of the debraced source code.
+*/
+typedef struct EmbraceOptions EmbraceOptions;
+struct EmbraceOptions {
+    bool format; // braces placed as with .astylerc, line numbers change
+    bool line_directives; // in format mode, emit #line where line numbers differ
+    Tags* tags; // if not NULL, collects top-level definitions
+    Includes* includes; // if not NULL, collects the #include lines
+    bool quiet; // do not report errors on stderr
+    bool discard_output; // only check, do not produce any output (see check)
+};
+
+/*
+The state of embracing a file line by line (see embrace_line). Line numbers are
+int, so a file may have up to INT_MAX lines. Sizes are ptrdiff_t.
+*/
+typedef struct Embracer Embracer;
+struct Embracer {
+    char* filename;
+    EmbraceOptions options;
+    String output; // embraced code that has not been flushed yet
+    LineInfo li; // state after the last non-empty line
+    LineInfo prev_li;
+    LineInfo* indent_stack; // lines that opened the enclosing blocks
+    ptrdiff_t depth; // number of elements on indent_stack
+    ptrdiff_t current_indent;
+    ptrdiff_t empty_lines; // empty lines not emitted yet
+    int line_number; // number of lines processed
+    int prev_line_number; // line number of prev_li
+    int statement_line; // first line of the statement that ends with prev_li
+    String statement; // copy of that line (only if tags are collected)
+    int output_line; // line number of output.s[output_counted]
+    ptrdiff_t output_counted;
+    bool flushed; // some output has been flushed
+    ptrdiff_t output_start; // length of output before the file
+    ptrdiff_t flushed_bytes; // bytes of the file that have been flushed
+    ptrdiff_t input_bytes; // bytes of the lines processed, one separator per line
+    bool ok;
+};
+
+void embrace_begin(/*out*/Embracer* e, char* filename, String output, EmbraceOptions* options);
+bool embrace_line(/*inout*/Embracer* e, /*inout*/String* line);
+bool embrace_end(/*inout*/Embracer* e);
+bool embrace_flush(/*inout*/Embracer* e, FILE* f);
+
+bool embrace_into(char* filename, String source_code, /*inout*/String* output, 
+        EmbraceOptions* options);
+String embrace(char* filename, String source_code);
+bool embrace_stream(char* filename, FILE* in, FILE* out, EmbraceOptions* options);
+bool check(char* filename, String source_code);
+bool is_verbatim(String source_code);
+void append_line_directive(String* str, int line_number, char* filename);
+
 #endif // embrace_h_INCLUDED
 
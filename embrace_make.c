@@ -0,0 +1,105 @@
+/*
+GNU make module that embraces files inside the make process, without starting
+a shell or an embrace process for each file. Build with "make embrace.so" and
+use it like this:
+
+load ./embrace.so
+
+%.c: %.d.c
+	$(embrace $<,$@)
+
+The function expands to the empty string, so the recipe does not run any
+command. The output file is only written if its content changes, so that files
+that depend on it are not rebuilt unnecessarily. Otherwise only its modification
+time is updated, so that make considers it up to date. If the input is not valid
+debraced C, the error is reported and make stops.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // utimensat
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <gnumake.h>
+#include "util.h"
+#include "embrace.h"
+
+int plugin_is_GPL_compatible;
+
+// buffers reused between calls, make calls functions from a single thread
+static String input = {NULL, 0, 0};
+static String output = {NULL, 0, 0};
+static String previous = {NULL, 0, 0};
+
+// Removes spaces and tabs from the beginning and end of s (in place).
+static char* trim_argument(char* s) {
+    String t = trim(make_string(s));
+    if (t.len == 0) return "";
+    t.s[t.len] = '\0';
+    return t.s;
+}
+
+/*
+Reports "message filename" through $(error ...), which stops make. The filename
+is escaped, so that make does not expand "$" in it and unbalanced parentheses
+do not end the function call early.
+*/
+static void make_error(char* message, char* filename) {
+    String text = new_string(strlen(message) + 20 * strlen(filename) + 32);
+    append_cstring(&text, "$(error ");
+    append_cstring(&text, message);
+    append_char(&text, ' ');
+    for (char* p = filename; *p != '\0'; p++) {
+        if (*p == '$') {
+            append_cstring(&text, "$$");
+        } else if (*p == '(') {
+            append_cstring(&text, "$(embrace_open_paren)");
+        } else if (*p == ')') {
+            append_cstring(&text, "$(embrace_close_paren)");
+        } else if (*p == '\n') {
+            append_char(&text, ' '); // make evaluates line by line
+        } else {
+            append_char(&text, *p);
+        }
+    }
+    append_char(&text, ')');
+    text.s[text.len] = '\0';
+    gmk_eval(text.s, NULL);
+    free(text.s);
+}
+
+/*
+Implements $(embrace in.d.c,out.c).
+*/
+static char* func_embrace(const char* name, unsigned int argc, char** argv) {
+    char* in_file = trim_argument(argv[0]);
+    char* out_file = trim_argument(argv[1]);
+    if (!read_file_into(in_file, &input)) {
+        make_error("Cannot read", in_file);
+        return NULL;
+    }
+    output.len = 0;
+    if (!embrace_into(in_file, input, &output, NULL)) {
+        make_error("Cannot embrace", in_file);
+        return NULL;
+    }
+    bool unchanged = read_file_into(out_file, &previous) && previous.len == output.len && 
+        memcmp(previous.s, output.s, output.len) == 0;
+    if (unchanged) {
+        // otherwise the output stays older than the input and the recipe runs again
+        if (utimensat(AT_FDCWD, out_file, NULL, 0) != 0) {
+            make_error("Cannot touch", out_file);
+        }
+    } else if (!write_file(out_file, output)) {
+        make_error("Cannot write", out_file);
+    }
+    return NULL;
+}
+
+int embrace_gmk_setup(const gmk_floc* floc) {
+    gmk_add_function("embrace", func_embrace, 2, 2, GMK_FUNC_DEFAULT);
+    // for parentheses in the messages of make_error
+    gmk_eval("embrace_open_paren := (\nembrace_close_paren := )", NULL);
+    return 1;
+}
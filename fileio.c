@@ -0,0 +1,590 @@
+/*
+Batched file I/O for runs over many files. On Linux, the opens, reads, writes,
+and closes of all files are queued through io_uring (without liburing), so that
+many requests are in flight at the same time instead of one small synchronous
+system call after the other. The contents of all files are read into a single
+arena, which is registered with the kernel as a fixed buffer, if possible.
+Where io_uring is not available (older kernels, seccomp filters, other
+systems) or does not support the operations used here (they are probed, e.g.,
+renameat needs Linux 5.11), the files are read and written one after the other
+with stdio.
+
+Files that are copied unchanged (see copy_file) do not pass through user space:
+they are cloned (reflink) or copied by the kernel, where possible.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "fileio.h"
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+#define MAX_COPY (1 << 30) // bytes per call of copy_file_range or sendfile
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define RING_ENTRIES 256
+
+typedef struct Ring Ring;
+struct Ring {
+    int fd;
+    unsigned entries;
+    unsigned in_flight; // submitted, but not yet completed
+    unsigned prepared; // prepared, but not yet visible to the kernel
+    unsigned unsubmitted; // visible to the kernel, but not yet submitted
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+static bool ring_init(Ring* r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(Ring));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return false;
+    r->entries = p.sq_entries;
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, 
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        close(r->fd);
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, 
+                MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            munmap(r->sq_ring, r->sq_ring_size);
+            close(r->fd);
+            return false;
+        }
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, 
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        if (r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+        munmap(r->sq_ring, r->sq_ring_size);
+        close(r->fd);
+        return false;
+    }
+    char* sq = r->sq_ring;
+    r->sq_head = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    char* cq = r->cq_ring;
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static void ring_exit(Ring* r) {
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+}
+
+/*
+Checks if the kernel supports the given operations on the ring. A kernel that
+can set up a ring may still lack some of them, then each request would fail.
+Probing needs Linux 5.6, which is also the first to support IORING_OP_OPENAT.
+*/
+static bool ring_supports(Ring* r, int count, int* ops) {
+    int max_ops = 256;
+    struct io_uring_probe* probe = xcalloc(1, sizeof(struct io_uring_probe) +
+            max_ops * sizeof(struct io_uring_probe_op));
+    bool ok = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, max_ops) == 0;
+    for (int i = 0; ok && i < count; i++) {
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+// Returns a cleared submission queue entry. The ring must not be full.
+static struct io_uring_sqe* ring_sqe(Ring* r, int op, unsigned long user_data) {
+    require("not full", r->in_flight + r->unsubmitted + r->prepared < r->entries);
+    unsigned tail = *r->sq_tail + r->prepared;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->user_data = user_data;
+    r->sq_array[index] = index;
+    r->prepared++;
+    return sqe;
+}
+
+/*
+Submits the prepared entries and waits until at least wait_count requests have
+completed. Returns false on error.
+*/
+static bool ring_submit(Ring* r, unsigned wait_count) {
+    __atomic_store_n(r->sq_tail, *r->sq_tail + r->prepared, __ATOMIC_RELEASE);
+    r->unsubmitted += r->prepared;
+    r->prepared = 0;
+    int n;
+    do {
+        n = syscall(__NR_io_uring_enter, r->fd, r->unsubmitted, wait_count, 
+                wait_count > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return false;
+    r->unsubmitted -= n;
+    r->in_flight += n;
+    return true;
+}
+
+typedef void (*Complete)(void* context, unsigned long user_data, int result);
+
+// Handles all available completions. Returns the number of completions.
+static int ring_reap(Ring* r, Complete complete, void* context) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+    for (; head != tail; head++, n++) {
+        struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+        complete(context, cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    r->in_flight -= n;
+    return n;
+}
+
+// Makes room for another entry, submitting and reaping as needed.
+static bool ring_reserve(Ring* r, Complete complete, void* context) {
+    while (r->in_flight + r->unsubmitted + r->prepared >= r->entries) {
+        if (!ring_submit(r, r->in_flight > 0 ? 1 : 0)) return false;
+        ring_reap(r, complete, context);
+    }
+    return true;
+}
+
+// Submits all prepared entries and waits for all requests to complete.
+static bool ring_drain(Ring* r, Complete complete, void* context) {
+    while (r->prepared > 0 || r->unsubmitted > 0 || r->in_flight > 0) {
+        if (!ring_submit(r, 1)) return false;
+        ring_reap(r, complete, context);
+    }
+    return true;
+}
+
+// The state of one batch (read or write) of files.
+typedef struct Batch Batch;
+struct Batch {
+    int count;
+    char** names; // files to read, temporary files to write
+    int* fds;
+    struct statx* stats;
+    String* contents;
+    ptrdiff_t* done; // bytes read or written so far
+    bool* ok;
+    bool fixed; // contents are in the registered buffer
+    bool writing;
+};
+
+// Op codes in the low bits of user_data, the file index in the high bits.
+#define USER_DATA(op, i) (((unsigned long)(i) << 2) | (op))
+#define OP_OPEN 0
+#define OP_STAT 1
+#define OP_IO 2
+#define OP_CLOSE 3
+
+// Largest transfer per request (the length field has 32 bits).
+#define MAX_TRANSFER (1 << 30)
+
+static void complete(void* context, unsigned long user_data, int result) {
+    Batch* b = context;
+    int i = (int)(user_data >> 2);
+    switch (user_data & 3) {
+        case OP_OPEN: 
+            b->fds[i] = result;
+            if (result < 0) b->ok[i] = false;
+            break;
+        case OP_STAT: 
+            if (result < 0) b->ok[i] = false;
+            break;
+        case OP_IO: 
+            if (result < 0) {
+                b->ok[i] = false;
+            } else if (result == 0 && b->writing) {
+                b->ok[i] = false;
+            } else if (result == 0) {
+                // end of file, the file has been truncated since statx
+                b->contents[i].len = b->done[i];
+            } else {
+                b->done[i] += result;
+            }
+            break;
+        case OP_CLOSE: 
+            if (result < 0) b->ok[i] = false;
+            b->fds[i] = -1;
+            break;
+    }
+}
+
+// Reads or writes the remaining bytes of all open files. Repeats as long as
+// requests transfer only part of the data.
+static bool transfer(Ring* r, Batch* b) {
+    bool more = true;
+    while (more) {
+        more = false;
+        for (int i = 0; i < b->count; i++) {
+            if (!b->ok[i] || b->done[i] >= b->contents[i].len) continue;
+            more = true;
+            if (!ring_reserve(r, complete, b)) return false;
+            int op = b->writing ? IORING_OP_WRITE : (b->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ);
+            struct io_uring_sqe* sqe = ring_sqe(r, op, USER_DATA(OP_IO, i));
+            sqe->fd = b->fds[i];
+            sqe->addr = (unsigned long)(b->contents[i].s + b->done[i]);
+            ptrdiff_t len = b->contents[i].len - b->done[i];
+            sqe->len = len < MAX_TRANSFER ? len : MAX_TRANSFER;
+            sqe->off = b->done[i];
+            sqe->buf_index = 0;
+        }
+        if (!ring_drain(r, complete, b)) return false;
+    }
+    return true;
+}
+
+static bool close_all(Ring* r, Batch* b) {
+    for (int i = 0; i < b->count; i++) {
+        if (b->fds[i] < 0) continue;
+        if (!ring_reserve(r, complete, b)) return false;
+        struct io_uring_sqe* sqe = ring_sqe(r, IORING_OP_CLOSE, USER_DATA(OP_CLOSE, i));
+        sqe->fd = b->fds[i];
+    }
+    return ring_drain(r, complete, b);
+}
+
+static bool uring_read_files(Files* files) {
+    Ring r;
+    if (!ring_init(&r, RING_ENTRIES)) return false;
+    int ops[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_READ_FIXED,
+        IORING_OP_CLOSE};
+    if (!ring_supports(&r, sizeof(ops) / sizeof(ops[0]), ops)) {
+        ring_exit(&r);
+        return false;
+    }
+    int n = files->count;
+    Batch b = {n, files->names, xmalloc(n * sizeof(int)), xcalloc(n, sizeof(struct statx)), 
+        files->contents, xcalloc(n, sizeof(ptrdiff_t)), xmalloc(n * sizeof(bool)), false, false};
+    for (int i = 0; i < n; i++) {
+        b.fds[i] = -1;
+        b.ok[i] = true;
+    }
+    bool ok = true;
+
+    // open and stat all files
+    for (int i = 0; ok && i < n; i++) {
+        ok = ring_reserve(&r, complete, &b);
+        if (!ok) break;
+        struct io_uring_sqe* sqe = ring_sqe(&r, IORING_OP_OPENAT, USER_DATA(OP_OPEN, i));
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)files->names[i];
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        ok = ring_reserve(&r, complete, &b);
+        if (!ok) break;
+        sqe = ring_sqe(&r, IORING_OP_STATX, USER_DATA(OP_STAT, i));
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)files->names[i];
+        sqe->len = STATX_SIZE;
+        sqe->off = (unsigned long)&b.stats[i];
+    }
+    ok = ok && ring_drain(&r, complete, &b);
+
+    // read all files into one arena
+    if (ok) {
+        size_t total = 0;
+        for (int i = 0; i < n; i++) {
+            if (b.ok[i]) total += b.stats[i].stx_size + 1;
+        }
+        files->arena = xmalloc(total > 0 ? total : 1);
+        struct iovec iov = {files->arena, total};
+        b.fixed = total > 0 && 
+            syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+        char* p = files->arena;
+        for (int i = 0; i < n; i++) {
+            if (!b.ok[i]) continue;
+            ptrdiff_t size = b.stats[i].stx_size;
+            files->contents[i] = (String){p, size, size + 1};
+            p += size + 1;
+        }
+        ok = transfer(&r, &b);
+        if (b.fixed) syscall(__NR_io_uring_register, r.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    }
+    ok = close_all(&r, &b) && ok;
+
+    for (int i = 0; i < n; i++) {
+        if (b.ok[i] && files->contents[i].s != NULL) {
+            files->contents[i].s[files->contents[i].len] = '\0';
+        } else {
+            files->contents[i] = (String){NULL, 0, 0};
+        }
+    }
+    free(b.fds);
+    free(b.stats);
+    free(b.done);
+    free(b.ok);
+    ring_exit(&r);
+    return ok;
+}
+
+static bool uring_write_files(int count, char** names, String* contents, bool* ok) {
+    Ring r;
+    if (!ring_init(&r, RING_ENTRIES)) return false;
+    int ops[] = {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_RENAMEAT,
+        IORING_OP_UNLINKAT};
+    if (!ring_supports(&r, sizeof(ops) / sizeof(ops[0]), ops)) {
+        ring_exit(&r);
+        return false;
+    }
+    // write to temporary files, which are renamed once complete (see write_file)
+    char** tmp_names = xmalloc(count * sizeof(char*));
+    for (int i = 0; i < count; i++) {
+        int n = strlen(names[i]) + 5;
+        tmp_names[i] = xmalloc(n);
+        snprintf(tmp_names[i], n, "%s.tmp", names[i]);
+        ok[i] = true;
+    }
+    Batch b = {count, tmp_names, xmalloc(count * sizeof(int)), NULL, 
+        contents, xcalloc(count, sizeof(ptrdiff_t)), ok, false, true};
+    for (int i = 0; i < count; i++) b.fds[i] = -1;
+    bool success = true;
+    for (int i = 0; success && i < count; i++) {
+        success = ring_reserve(&r, complete, &b);
+        if (!success) break;
+        struct io_uring_sqe* sqe = ring_sqe(&r, IORING_OP_OPENAT, USER_DATA(OP_OPEN, i));
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)tmp_names[i];
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        sqe->len = 0666;
+    }
+    success = success && ring_drain(&r, complete, &b);
+    success = success && transfer(&r, &b);
+    success = close_all(&r, &b) && success;
+    for (int i = 0; success && i < count; i++) {
+        success = ring_reserve(&r, complete, &b);
+        if (!success) break;
+        // rename (or remove) the temporary file, OP_STAT only records errors
+        struct io_uring_sqe* sqe = ring_sqe(&r, ok[i] ? IORING_OP_RENAMEAT : IORING_OP_UNLINKAT, 
+                USER_DATA(OP_STAT, i));
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)tmp_names[i];
+        if (ok[i]) {
+            sqe->len = AT_FDCWD;
+            sqe->addr2 = (unsigned long)names[i];
+        }
+    }
+    success = success && ring_drain(&r, complete, &b);
+    for (int i = 0; i < count; i++) free(tmp_names[i]);
+    free(tmp_names);
+    free(b.fds);
+    free(b.done);
+    ring_exit(&r);
+    return success;
+}
+
+#else
+
+static bool uring_read_files(Files* files) {
+    return false;
+}
+
+static bool uring_write_files(int count, char** names, String* contents, bool* ok) {
+    return false;
+}
+
+#endif
+
+/*
+Reads the given files. The content of a file that cannot be read is a String
+with s == NULL.
+*/
+Files read_files(int count, char** names) {
+    require("not negative", count >= 0);
+    require_not_null(names);
+    Files files = {count, names, xcalloc(count > 0 ? count : 1, sizeof(String)), NULL};
+    if (!uring_read_files(&files)) {
+        // io_uring is not available, fall back to stdio
+        free(files.arena);
+        files.arena = NULL;
+        for (int i = 0; i < count; i++) {
+            files.contents[i] = (String){NULL, 0, 0};
+            if (!read_file_into(names[i], &files.contents[i])) {
+                free(files.contents[i].s);
+                files.contents[i] = (String){NULL, 0, 0};
+            }
+        }
+    }
+    return files;
+}
+
+void free_files(Files* files) {
+    require_not_null(files);
+    if (files->arena != NULL) {
+        free(files->arena);
+    } else {
+        for (int i = 0; i < files->count; i++) free(files->contents[i].s);
+    }
+    free(files->contents);
+    files->contents = NULL;
+    files->arena = NULL;
+}
+
+/*
+Writes contents[i] to the file names[i] for all i. Like write_file, each file is
+first written to a temporary file, which is then renamed. Sets ok[i] to false if
+file i could not be written. Returns the number of files that could not be
+written.
+*/
+int write_files(int count, char** names, String* contents, /*out*/bool* ok) {
+    require("not negative", count >= 0);
+    require_not_null(names);
+    require_not_null(contents);
+    require_not_null(ok);
+    if (!uring_write_files(count, names, contents, ok)) {
+        // io_uring is not available, fall back to stdio
+        for (int i = 0; i < count; i++) {
+            ok[i] = write_file(names[i], contents[i]);
+        }
+    }
+    int errors = 0;
+    for (int i = 0; i < count; i++) {
+        if (!ok[i]) errors++;
+    }
+    return errors;
+}
+
+/*
+Reads up to n bytes from the beginning of the file into buffer. Returns the
+number of bytes read or -1 if the file cannot be read.
+*/
+ptrdiff_t read_head(char* name, char* buffer, ptrdiff_t n) {
+    require_not_null(name);
+    require_not_null(buffer);
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return -1;
+    ptrdiff_t done = 0;
+    while (done < n) {
+        ptrdiff_t m = read(fd, buffer + done, n - done);
+        if (m < 0 && errno == EINTR) continue;
+        if (m < 0) done = -1;
+        if (m <= 0) break;
+        done += m;
+    }
+    close(fd);
+    return done;
+}
+
+/*
+Copies the rest of in to out. On Linux, out is made a clone of in (reflink) if
+both are at the beginning and out is empty, otherwise the data is copied by the
+kernel with copy_file_range or sendfile. Read and write are the fallback, e.g.,
+for other systems or file systems. Returns false on errors.
+*/
+bool copy_fd(int in, int out) {
+    struct stat st;
+    if (fstat(in, &st) != 0) return false;
+#ifdef __linux__
+    struct stat out_st;
+    if (S_ISREG(st.st_mode) && fstat(out, &out_st) == 0 && S_ISREG(out_st.st_mode) &&
+            out_st.st_size == 0 && lseek(in, 0, SEEK_CUR) == 0 && lseek(out, 0, SEEK_CUR) == 0 &&
+            ioctl(out, FICLONE, in) == 0) {
+        return lseek(out, st.st_size, SEEK_SET) == st.st_size;
+    }
+    // these may not be supported for the files, each one continues at the file offsets
+    bool kernel_copy = true;
+    for (ptrdiff_t n; kernel_copy; ) {
+        n = copy_file_range(in, NULL, out, NULL, MAX_COPY, 0);
+        if (n == 0) return true;
+        if (n < 0 && errno == EINTR) continue;
+        kernel_copy = n > 0;
+    }
+    kernel_copy = true;
+    for (ptrdiff_t n; kernel_copy; ) {
+        n = sendfile(out, in, NULL, MAX_COPY);
+        if (n == 0) return true;
+        if (n < 0 && errno == EINTR) continue;
+        kernel_copy = n > 0;
+    }
+#endif
+    char buffer[64 * 1024];
+    for (;;) {
+        ptrdiff_t n = read(in, buffer, sizeof(buffer));
+        if (n == 0) return true;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        for (ptrdiff_t done = 0; done < n; ) {
+            ptrdiff_t m = write(out, buffer + done, n - done);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) return false;
+            done += m;
+        }
+    }
+}
+
+/*
+Copies the file from to the file to (see copy_fd). Like write_file, the copy is
+first written to a temporary file, which is then renamed.
+*/
+bool copy_file(char* from, char* to) {
+    require_not_null(from);
+    require_not_null(to);
+    int in = open(from, O_RDONLY);
+    if (in < 0) return false;
+    int n = strlen(to) + 5;
+    char tmp_name[n];
+    snprintf(tmp_name, n, "%s.tmp", to);
+    int out = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool ok = out >= 0 && copy_fd(in, out);
+    if (out >= 0) ok = close(out) == 0 && ok;
+    close(in);
+    if (ok) ok = rename(tmp_name, to) == 0;
+    if (!ok) remove(tmp_name);
+    return ok;
+}
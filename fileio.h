@@ -0,0 +1,30 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef fileio_h_INCLUDED
+#define fileio_h_INCLUDED
+
+#include "util.h"
+
+/*
+The contents of a set of files, read in one batch.
+*/
+typedef struct Files Files;
+struct Files {
+    int count;
+    char** names;
+    String* contents; // '\0'-terminated, s == NULL if the file cannot be read
+    char* arena; // memory of all contents or NULL if allocated individually
+};
+
+Files read_files(int count, char** names);
+void free_files(Files* files);
+int write_files(int count, char** names, String* contents, /*out*/bool* ok);
+
+ptrdiff_t read_head(char* name, char* buffer, ptrdiff_t n);
+bool copy_fd(int in, int out);
+bool copy_file(char* from, char* to);
+
+#endif // fileio_h_INCLUDED
@@ -0,0 +1,214 @@
+/*
+Git-aware mode: Asks the git repository of the current directory which debraced
+files have changed, so that only these are embraced or checked.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // fork, pipe, mkdtemp
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "util.h"
+#include "git.h"
+
+/*
+Runs git with the given arguments (args[0] is "git", terminated by NULL) and
+appends its output to output. Returns true if git succeeded.
+*/
+static bool run_git(char* args[], /*inout*/String* output) {
+    require_not_null(args);
+    require_not_null(output);
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execvp("git", args);
+        perror("git");
+        _exit(127);
+    }
+    close(fds[1]);
+    ptrdiff_t n;
+    do {
+        if (output->cap - output->len < 4096) {
+            ptrdiff_t cap = 2 * output->cap + 4096;
+            char* s = realloc(output->s, cap);
+            panic_if(s == NULL, "Cannot allocate memory.");
+            output->s = s;
+            output->cap = cap;
+        }
+        n = read(fds[0], output->s + output->len, output->cap - output->len);
+        if (n > 0) output->len += n;
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    close(fds[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    return n == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+Runs git with the arguments followed by "--" and the pathspecs.
+*/
+static bool run_git_paths(char* args[], int pathspec_count, char** pathspecs,
+        /*inout*/String* output) {
+    int n = 0;
+    while (args[n] != NULL) n++;
+    char** a = xmalloc((n + pathspec_count + 2) * sizeof(char*));
+    memcpy(a, args, n * sizeof(char*));
+    a[n] = "--";
+    memcpy(a + n + 1, pathspecs, pathspec_count * sizeof(char*));
+    a[n + 1 + pathspec_count] = NULL;
+    bool ok = run_git(a, output);
+    free(a);
+    return ok;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Checks whether name is an existing debraced file (deleted files are listed too).
+static bool is_debraced_file(char* name) {
+    int n = strlen(name);
+    if (n < 4 || strcmp(name + n - 4, ".d.c") != 0) return false;
+    struct stat st;
+    return stat(name, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/*
+Finds the debraced files in the current directory (and below) that have
+changed. If rev is not NULL, these are the files that differ between rev and
+the working tree, and the untracked files. If rev is NULL, the index is used:
+the files that are staged, that differ from the index (git uses the file stats
+recorded in the index for this), and the untracked files. Ignored files are
+excluded. The pathspecs (may be empty) restrict the files further. Returns
+false if git fails, e.g., if rev is unknown.
+*/
+bool changed_files(char* rev, int pathspec_count, char** pathspecs,
+        /*out*/ChangedFiles* files) {
+    require_not_null(files);
+    require("not negative", pathspec_count >= 0);
+    *files = (ChangedFiles){0, NULL, {NULL, 0, 0}};
+    String* output = &files->output;
+    bool ok;
+    if (rev != NULL) {
+        char* diff[] = {"git", "diff", "--name-only", "-z", "--relative", "--diff-filter=d",
+            "--end-of-options", rev, NULL};
+        char* untracked[] = {"git", "ls-files", "-z", "--others", "--exclude-standard", NULL};
+        ok = run_git_paths(diff, pathspec_count, pathspecs, output) &&
+            run_git_paths(untracked, pathspec_count, pathspecs, output);
+    } else {
+        char* staged[] = {"git", "diff", "--cached", "--name-only", "-z", "--relative",
+            "--diff-filter=d", NULL};
+        char* modified[] = {"git", "ls-files", "-z", "--modified", "--others",
+            "--exclude-standard", NULL};
+        ok = run_git_paths(staged, pathspec_count, pathspecs, output) &&
+            run_git_paths(modified, pathspec_count, pathspecs, output);
+    }
+    if (!ok) {
+        free_changed_files(files);
+        return false;
+    }
+    // the names are separated by '\0', the last one as well
+    int count = 0;
+    for (ptrdiff_t i = 0; i < output->len; i++) {
+        if (output->s[i] == '\0') count++;
+    }
+    files->names = xmalloc((count > 0 ? count : 1) * sizeof(char*));
+    for (char* p = output->s; p < output->s + output->len; p += strlen(p) + 1) {
+        if (is_debraced_file(p)) files->names[files->count++] = p;
+    }
+    // a file may be staged and modified
+    qsort(files->names, files->count, sizeof(char*), compare_names);
+    int n = 0;
+    for (int i = 0; i < files->count; i++) {
+        if (n == 0 || strcmp(files->names[n - 1], files->names[i]) != 0) {
+            files->names[n++] = files->names[i];
+        }
+    }
+    files->count = n;
+    return true;
+}
+
+void free_changed_files(ChangedFiles* files) {
+    require_not_null(files);
+    free(files->names);
+    free(files->output.s);
+    *files = (ChangedFiles){0, NULL, {NULL, 0, 0}};
+}
+
+// Runs a shell command in the test repository.
+static void sh(char* command) {
+    panicf_if(system(command) != 0, "Command failed: %s", command);
+}
+
+// Checks that the changed files are exactly the expected ones (comma-separated).
+static void test_changed(char* rev, int pathspec_count, char** pathspecs, char* expected) {
+    ChangedFiles files;
+    test_equal_i(changed_files(rev, pathspec_count, pathspecs, &files), true);
+    String actual = new_string(4096);
+    for (int i = 0; i < files.count; i++) {
+        if (i > 0) append_char(&actual, ',');
+        append_cstring(&actual, files.names[i]);
+    }
+    test_equal_s(actual, expected);
+    free(actual.s);
+    free_changed_files(&files);
+}
+
+void changed_files_test(void) {
+    char cwd[4096];
+    panic_if(getcwd(cwd, sizeof(cwd)) == NULL, "Cannot get current directory.");
+    char dir[] = "/tmp/embrace_git_XXXXXX";
+    panic_if(mkdtemp(dir) == NULL, "Cannot create directory.");
+    panic_if(chdir(dir) != 0, "Cannot change directory.");
+
+    sh("git init -q . && git config user.name test && git config user.email test@example.com"
+        " && git config commit.gpgsign false");
+    sh("mkdir sub && echo 'int a' > a.d.c && echo 'int b' > b.d.c && echo c > c.txt"
+        " && echo 'int e' > sub/e.d.c && echo 'i*.d.c' > .gitignore");
+    test_changed(NULL, 0, NULL, "a.d.c,b.d.c,sub/e.d.c"); // untracked
+    sh("git add . && git commit -q -m first");
+    test_changed(NULL, 0, NULL, "");
+    test_changed("HEAD", 0, NULL, "");
+
+    // modified, untracked, ignored, deleted, other, and staged files
+    sh("echo 'int a2' >> a.d.c && echo 'int n' > n.d.c && echo 'int i' > i.d.c && rm b.d.c"
+        " && echo c2 >> c.txt && echo 'int e2' >> sub/e.d.c && git add sub/e.d.c");
+    test_changed(NULL, 0, NULL, "a.d.c,n.d.c,sub/e.d.c");
+    test_changed("HEAD", 0, NULL, "a.d.c,n.d.c,sub/e.d.c");
+    char* sub[] = {"sub"};
+    test_changed(NULL, 1, sub, "sub/e.d.c");
+
+    // committed changes are found relative to an older revision only
+    sh("git add -A && git commit -q -m second");
+    test_changed(NULL, 0, NULL, "");
+    test_changed("HEAD", 0, NULL, "");
+    test_changed("HEAD~1", 0, NULL, "a.d.c,n.d.c,sub/e.d.c");
+
+    // names are relative to the current directory
+    panic_if(chdir("sub") != 0, "Cannot change directory.");
+    test_changed("HEAD~1", 0, NULL, "e.d.c");
+    panic_if(chdir("..") != 0, "Cannot change directory.");
+
+    // unknown revision, and a revision that looks like an option
+    ChangedFiles files;
+    test_equal_i(changed_files("no-such-rev", 0, NULL, &files), false);
+    test_equal_i(changed_files("--output=x", 0, NULL, &files), false);
+    test_equal_i(access("x", F_OK) != 0, true);
+
+    panic_if(chdir(cwd) != 0, "Cannot change directory.");
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    sh(command);
+}
@@ -0,0 +1,27 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef git_h_INCLUDED
+#define git_h_INCLUDED
+
+#include "util.h"
+
+/*
+The debraced files (*.d.c) that changed according to git, sorted, relative to
+the current directory.
+*/
+typedef struct ChangedFiles ChangedFiles;
+struct ChangedFiles {
+    int count;
+    char** names; // point into output
+    String output; // output of git, NUL-separated names
+};
+
+bool changed_files(char* rev, int pathspec_count, char** pathspecs,
+        /*out*/ChangedFiles* files);
+void free_changed_files(ChangedFiles* files);
+void changed_files_test(void);
+
+#endif // git_h_INCLUDED
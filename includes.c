@@ -0,0 +1,694 @@
+/*
+Include graph: Records which files each embraced file includes in a small
+database, which is updated whenever files are embraced. This allows finding the
+debraced files that depend on a header without running the preprocessor.
+
+The database is a text file. The first line identifies the format. Each
+further line describes a file: its path, its modification time (ns), its size,
+and the files it includes, separated by tabs. An included file that exists
+relative to the including file (as for #include "...") is stored as a
+normalized path, any other one as written, e.g., <stdio.h>. The includes of
+embraced files are collected while embracing them. Headers reachable from
+embraced files are scanned for #include lines, and scanned again when their
+modification time or size changes.
+
+Updates and queries lock the database (flock), so that parallel runs of
+embrace, e.g., from make -j, do not lose updates.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // flock, st_mtim, mkdtemp
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "embrace.h"
+#include "includes.h"
+
+#define DB_HEADER "embrace-includes 1\n"
+
+static const String token_include = {"include", 7};
+
+Includes new_includes(void) {
+    return (Includes){NULL, 0, 0};
+}
+
+void free_includes(Includes* includes) {
+    require_not_null(includes);
+    for (int i = 0; i < includes->len; i++) {
+        free(includes->names[i]);
+    }
+    free(includes->names);
+    *includes = new_includes();
+}
+
+// Returns a newly allocated copy of the first n characters of s.
+static char* copy(char* s, ptrdiff_t n) {
+    char* t = xmalloc(n + 1);
+    memcpy(t, s, n);
+    t[n] = '\0';
+    return t;
+}
+
+static ptrdiff_t skip_blanks(String line, ptrdiff_t i) {
+    while (i < line.len && (line.s[i] == ' ' || line.s[i] == '\t')) i++;
+    return i;
+}
+
+// Adds name to includes, which takes it over.
+static void push_include(Includes* includes, char* name) {
+    if (includes->len >= includes->cap) {
+        includes->cap = includes->cap == 0 ? 8 : 2 * includes->cap;
+        includes->names = realloc(includes->names, includes->cap * sizeof(char*));
+        panic_if(includes->names == NULL, "Cannot allocate memory.");
+    }
+    includes->names[includes->len++] = name;
+}
+
+/*
+Adds the included file to includes if line is an #include directive with a
+name in quotes or angle brackets, e.g., #include "util.h" or *#include
+<stdio.h> (public). Other lines, and includes of macros, are ignored.
+*/
+void add_include(Includes* includes, String line) {
+    require_not_null(includes);
+    ptrdiff_t i = skip_blanks(line, 0);
+    if (i < line.len && line.s[i] == '*') i = skip_blanks(line, i + 1);
+    if (i >= line.len || line.s[i] != '#') return;
+    i = skip_blanks(line, i + 1);
+    if (!matches_token(line, i, token_include)) return;
+    i = skip_blanks(line, i + token_include.len);
+    if (i >= line.len || (line.s[i] != '"' && line.s[i] != '<')) return;
+    char close = line.s[i] == '"' ? '"' : '>';
+    ptrdiff_t j = i + 1;
+    while (j < line.len && line.s[j] != close) j++;
+    if (j >= line.len || j == i + 1) return;
+    push_include(includes, copy(line.s + i, j + 1 - i));
+}
+
+/*
+Adds the files included by the #include lines of source to includes. Unlike
+embrace_into, this does not know about comments or line continuations, which is
+good enough for headers and verbatim files.
+*/
+void add_includes(Includes* includes, String source) {
+    require_not_null(includes);
+    char* end = source.s + source.len;
+    for (char* p = source.s; p < end; ) {
+        char* eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        if (memchr(p, '#', eol - p) != NULL) add_include(includes, make_string2(p, eol - p));
+        p = eol + 1;
+    }
+}
+
+/*
+Normalizes path in place: removes empty and "." components and resolves
+"name/..", e.g., ./src//../util.h becomes util.h.
+*/
+static void normalize_path(char* path) {
+    bool absolute = path[0] == '/';
+    char* start = path + (absolute ? 1 : 0); // start of the first component
+    char* w = start; // end of the normalized path
+    char* r = start;
+    while (*r != '\0') {
+        while (*r == '/') r++;
+        char* c = r;
+        while (*r != '/' && *r != '\0') r++;
+        ptrdiff_t n = r - c;
+        if (n == 0 || (n == 1 && c[0] == '.')) continue;
+        if (n == 2 && c[0] == '.' && c[1] == '.') {
+            char* q = w; // start of the last component
+            while (q > start && q[-1] != '/') q--;
+            if (w > start && !(w - q == 2 && q[0] == '.' && q[1] == '.')) {
+                w = q > start ? q - 1 : start;
+                continue;
+            }
+            if (absolute && w == start) continue; // "/.." is "/"
+        }
+        if (w > start) *w++ = '/';
+        memmove(w, c, n);
+        w += n;
+    }
+    if (w == path) *w++ = '.';
+    *w = '\0';
+}
+
+static bool is_name(char* include) {
+    return include[0] == '"' || include[0] == '<';
+}
+
+/*
+Returns the file that file includes with name ("x.h" or <x.h>) as a newly
+allocated string: the normalized path if name is in quotes and exists relative
+to the directory of file, otherwise name as written.
+*/
+static char* resolve_include(char* file, char* name) {
+    ptrdiff_t n = strlen(name);
+    if (name[0] == '"') {
+        char* slash = strrchr(file, '/');
+        ptrdiff_t d = slash == NULL || name[1] == '/' ? 0 : slash + 1 - file;
+        char* path = xmalloc(d + n);
+        memcpy(path, file, d);
+        memcpy(path + d, name + 1, n - 2);
+        path[d + n - 2] = '\0';
+        normalize_path(path);
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) return path;
+        free(path);
+    }
+    return copy(name, n);
+}
+
+typedef struct IncludeNode IncludeNode;
+struct IncludeNode {
+    char* path;
+    long long mtime; // ns, -1 if not known
+    long long size;
+    char** includes; // paths or names as written (see resolve_include)
+    int count;
+    bool owns_path; // path was allocated, otherwise it points into the text
+    bool owns_includes; // same for the elements of includes
+    bool removed; // the file no longer exists
+    bool seen;
+};
+
+/*
+The include graph, loaded from the text of the database. The nodes are found by
+path through a hash table.
+*/
+typedef struct IncludeGraph IncludeGraph;
+struct IncludeGraph {
+    IncludeNode* nodes;
+    int len;
+    int cap;
+    int* table; // node index + 1, 0 if empty
+    int table_cap; // power of 2
+    String text;
+};
+
+static unsigned hash_path(char* s) {
+    unsigned h = 2166136261u; // FNV-1a
+    for (; *s != '\0'; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static int find_node(IncludeGraph* g, char* path) {
+    if (g->table_cap == 0) return -1;
+    unsigned mask = g->table_cap - 1;
+    for (unsigned i = hash_path(path) & mask; g->table[i] != 0; i = (i + 1) & mask) {
+        if (strcmp(g->nodes[g->table[i] - 1].path, path) == 0) return g->table[i] - 1;
+    }
+    return -1;
+}
+
+static void insert_node_index(IncludeGraph* g, int index) {
+    unsigned mask = g->table_cap - 1;
+    unsigned i = hash_path(g->nodes[index].path) & mask;
+    while (g->table[i] != 0) i = (i + 1) & mask;
+    g->table[i] = index + 1;
+}
+
+// Adds a node for path, which must not be in g yet. Returns its index.
+static int add_node(IncludeGraph* g, char* path, bool owns_path) {
+    if (2 * (g->len + 1) > g->table_cap) {
+        free(g->table);
+        g->table_cap = g->table_cap == 0 ? 64 : 2 * g->table_cap;
+        g->table = xcalloc(g->table_cap, sizeof(int));
+        for (int i = 0; i < g->len; i++) insert_node_index(g, i);
+    }
+    if (g->len >= g->cap) {
+        g->cap = g->cap == 0 ? 64 : 2 * g->cap;
+        g->nodes = realloc(g->nodes, g->cap * sizeof(IncludeNode));
+        panic_if(g->nodes == NULL, "Cannot allocate memory.");
+    }
+    g->nodes[g->len] = (IncludeNode){path, -1, -1, NULL, 0, owns_path, false, false, false};
+    insert_node_index(g, g->len);
+    return g->len++;
+}
+
+// Replaces the includes of node i by the given ones, which g takes over.
+static void set_includes(IncludeGraph* g, int i, Includes includes) {
+    IncludeNode* node = &g->nodes[i];
+    if (node->owns_includes) {
+        for (int k = 0; k < node->count; k++) free(node->includes[k]);
+    }
+    free(node->includes);
+    node->includes = includes.names;
+    node->count = includes.len;
+    node->owns_includes = true;
+    node->removed = false;
+}
+
+static void free_graph(IncludeGraph* g) {
+    for (int i = 0; i < g->len; i++) {
+        IncludeNode* node = &g->nodes[i];
+        if (node->owns_includes) {
+            for (int k = 0; k < node->count; k++) free(node->includes[k]);
+        }
+        free(node->includes);
+        if (node->owns_path) free(node->path);
+    }
+    free(g->nodes);
+    free(g->table);
+    free(g->text.s);
+}
+
+/*
+Builds the graph from the text of a database, which it takes over. A text in an
+unknown format gives an empty graph, a truncated last line is ignored.
+*/
+static void parse_db(/*out*/IncludeGraph* g, String text) {
+    *g = (IncludeGraph){NULL, 0, 0, NULL, 0, text};
+    ptrdiff_t n = strlen(DB_HEADER);
+    if (text.len < n || strncmp(text.s, DB_HEADER, n) != 0) return;
+    char* end = text.s + text.len;
+    char* eol;
+    for (char* p = text.s + n; p < end && (eol = memchr(p, '\n', end - p)) != NULL; p = eol + 1) {
+        *eol = '\0';
+        int fields = 1;
+        for (char* q = p; q < eol; q++) {
+            if (*q == '\t') {
+                *q = '\0';
+                fields++;
+            }
+        }
+        if (fields < 3 || find_node(g, p) >= 0) continue;
+        int i = add_node(g, p, false);
+        char* field = p + strlen(p) + 1;
+        g->nodes[i].mtime = strtoll(field, NULL, 10);
+        field += strlen(field) + 1;
+        g->nodes[i].size = strtoll(field, NULL, 10);
+        field += strlen(field) + 1;
+        g->nodes[i].count = fields - 3;
+        g->nodes[i].includes = xmalloc((fields - 3 + 1) * sizeof(char*));
+        for (int k = 0; k < fields - 3; k++) {
+            g->nodes[i].includes[k] = field;
+            field += strlen(field) + 1;
+        }
+    }
+}
+
+static int compare_nodes(const void* a, const void* b) {
+    return strcmp((*(IncludeNode* const*)a)->path, (*(IncludeNode* const*)b)->path);
+}
+
+// Returns the text of the database for g, sorted by path.
+static String format_db(IncludeGraph* g) {
+    IncludeNode** nodes = xmalloc((g->len + 1) * sizeof(IncludeNode*));
+    int count = 0;
+    ptrdiff_t size = strlen(DB_HEADER);
+    for (int i = 0; i < g->len; i++) {
+        IncludeNode* node = &g->nodes[i];
+        if (node->removed) continue;
+        nodes[count++] = node;
+        size += strlen(node->path) + 2 * 21 + 3;
+        for (int k = 0; k < node->count; k++) size += strlen(node->includes[k]) + 1;
+    }
+    qsort(nodes, count, sizeof(IncludeNode*), compare_nodes);
+    String text = new_string(size + 1);
+    append_cstring(&text, DB_HEADER);
+    for (int i = 0; i < count; i++) {
+        char numbers[64];
+        snprintf(numbers, sizeof(numbers), "\t%lld\t%lld", nodes[i]->mtime, nodes[i]->size);
+        append_cstring(&text, nodes[i]->path);
+        append_cstring(&text, numbers);
+        for (int k = 0; k < nodes[i]->count; k++) {
+            append_char(&text, '\t');
+            append_cstring(&text, nodes[i]->includes[k]);
+        }
+        append_char(&text, '\n');
+    }
+    free(nodes);
+    return text;
+}
+
+// Reads the rest of the file into text, which is terminated with '\0'.
+static bool read_fd(int fd, /*out*/String* text) {
+    *text = (String){NULL, 0, 0};
+    ptrdiff_t n;
+    do {
+        if (text->cap - text->len < 4096 + 1) {
+            ptrdiff_t cap = 2 * text->cap + 4096 + 1;
+            char* s = realloc(text->s, cap);
+            panic_if(s == NULL, "Cannot allocate memory.");
+            text->s = s;
+            text->cap = cap;
+        }
+        n = read(fd, text->s + text->len, text->cap - text->len - 1);
+        if (n > 0) text->len += n;
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    text->s[text->len] = '\0';
+    return n == 0;
+}
+
+static bool write_fd(int fd, String text) {
+    ptrdiff_t done = 0;
+    while (done < text.len) {
+        ptrdiff_t n = write(fd, text.s + done, text.len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// Opens and locks the database, exclusively for updates.
+static int open_db(char* db, bool update) {
+    int fd = update ? open(db, O_RDWR | O_CREAT, 0666) : open(db, O_RDONLY);
+    if (fd < 0) return -1;
+    while (flock(fd, update ? LOCK_EX : LOCK_SH) != 0) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static long long mtime_ns(struct stat* st) {
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+// Returns the resolved includes of path, which are found by scanning its lines.
+static Includes scan_includes(char* path, String* buffer) {
+    Includes includes = new_includes();
+    if (!read_file_into(path, buffer)) return includes;
+    add_includes(&includes, *buffer);
+    for (int k = 0; k < includes.len; k++) {
+        char* name = includes.names[k];
+        includes.names[k] = resolve_include(path, name);
+        free(name);
+    }
+    return includes;
+}
+
+/*
+Records that each of the files includes the corresponding includes (as
+collected by embrace_into) in the database db, which is created if needed.
+Then scans the headers that these files include, directly or indirectly, if
+they are new or changed, and drops those that no longer exist. Returns false if
+the database cannot be read or written.
+*/
+bool update_include_db(char* db, int count, char** files, Includes* includes) {
+    require_not_null(db);
+    require("not negative", count >= 0);
+    int fd = open_db(db, true);
+    if (fd < 0) return false;
+    String text;
+    bool ok = read_fd(fd, &text);
+    IncludeGraph g;
+    parse_db(&g, text);
+
+    int* queue = xmalloc((g.len + count + 1) * sizeof(int));
+    int queue_cap = g.len + count + 1;
+    int queue_len = 0;
+    for (int i = 0; ok && i < count; i++) {
+        char* path = copy(files[i], strlen(files[i]));
+        normalize_path(path);
+        struct stat st;
+        int j = find_node(&g, path);
+        if (stat(path, &st) != 0 || (j >= 0 && g.nodes[j].seen)) {
+            free(path);
+            continue;
+        }
+        if (j < 0) {
+            j = add_node(&g, path, true);
+        } else {
+            free(path);
+        }
+        Includes resolved = new_includes();
+        for (int k = 0; k < includes[i].len; k++) {
+            push_include(&resolved, resolve_include(g.nodes[j].path, includes[i].names[k]));
+        }
+        set_includes(&g, j, resolved);
+        g.nodes[j].mtime = mtime_ns(&st);
+        g.nodes[j].size = st.st_size;
+        g.nodes[j].seen = true;
+        queue[queue_len++] = j;
+    }
+
+    // visit the headers reachable from the files
+    String buffer = {NULL, 0, 0};
+    for (int q = 0; ok && q < queue_len; q++) {
+        for (int k = 0; k < g.nodes[queue[q]].count; k++) {
+            char* include = g.nodes[queue[q]].includes[k];
+            if (is_name(include)) continue;
+            int j = find_node(&g, include);
+            if (j >= 0 && g.nodes[j].seen) continue;
+            struct stat st;
+            if (stat(include, &st) != 0) {
+                if (j >= 0) g.nodes[j].removed = g.nodes[j].seen = true;
+                continue;
+            }
+            if (j < 0) j = add_node(&g, copy(include, strlen(include)), true);
+            IncludeNode* node = &g.nodes[j];
+            if (node->removed || node->mtime != mtime_ns(&st) || node->size != st.st_size) {
+                set_includes(&g, j, scan_includes(node->path, &buffer));
+                node->mtime = mtime_ns(&st);
+                node->size = st.st_size;
+            }
+            node->seen = true;
+            if (queue_len >= queue_cap) {
+                queue_cap *= 2;
+                queue = realloc(queue, queue_cap * sizeof(int));
+                panic_if(queue == NULL, "Cannot allocate memory.");
+            }
+            queue[queue_len++] = j;
+        }
+    }
+    free(buffer.s);
+    free(queue);
+
+    if (ok) {
+        String out = format_db(&g);
+        ok = ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0 && write_fd(fd, out);
+        free(out.s);
+    }
+    free_graph(&g);
+    return close(fd) == 0 && ok;
+}
+
+/*
+An edge from a node to one of its includes. The key is the last component of the
+included file, without quotes or angle brackets.
+*/
+typedef struct IncludeEdge IncludeEdge;
+struct IncludeEdge {
+    String key;
+    char* include;
+    int node;
+};
+
+static int compare_edges(const void* a, const void* b) {
+    String x = ((IncludeEdge*)a)->key;
+    String y = ((IncludeEdge*)b)->key;
+    int c = memcmp(x.s, y.s, x.len < y.len ? x.len : y.len);
+    return c != 0 ? c : (x.len > y.len) - (x.len < y.len);
+}
+
+// Returns the name of an include without quotes or angle brackets.
+static String include_name(char* include) {
+    String s = make_string(include);
+    return is_name(include) ? make_string2(s.s + 1, s.len - 2) : s;
+}
+
+static String last_component(String path) {
+    ptrdiff_t i = path.len;
+    while (i > 0 && path.s[i - 1] != '/') i--;
+    return make_string2(path.s + i, path.len - i);
+}
+
+/*
+Checks whether include refers to path. An include that is not a path is
+assumed to refer to all paths that end with its name, since it may be found
+through the include search path of the compiler.
+*/
+static bool refers_to(char* include, String path) {
+    if (!is_name(include)) return strcmp(include, path.s) == 0;
+    String name = include_name(include);
+    if (name.len > path.len) return false;
+    if (name.len < path.len && path.s[path.len - name.len - 1] != '/') return false;
+    return memcmp(path.s + path.len - name.len, name.s, name.len) == 0;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+Finds the debraced files that include header, directly or through other
+headers, according to the database db. Debraced files that no longer exist are
+omitted. Returns false if the database cannot be read.
+*/
+bool affected_files(char* db, char* header, /*out*/AffectedFiles* files) {
+    require_not_null(db);
+    require_not_null(header);
+    require_not_null(files);
+    *files = (AffectedFiles){0, NULL};
+    int fd = open_db(db, false);
+    if (fd < 0) return false;
+    String text;
+    bool ok = read_fd(fd, &text);
+    close(fd);
+    IncludeGraph g;
+    parse_db(&g, text);
+
+    int edge_count = 0;
+    for (int i = 0; i < g.len; i++) edge_count += g.nodes[i].count;
+    IncludeEdge* edges = xmalloc((edge_count + 1) * sizeof(IncludeEdge));
+    int e = 0;
+    for (int i = 0; i < g.len; i++) {
+        for (int k = 0; k < g.nodes[i].count; k++) {
+            char* include = g.nodes[i].includes[k];
+            edges[e++] = (IncludeEdge){last_component(include_name(include)), include, i};
+        }
+    }
+    qsort(edges, edge_count, sizeof(IncludeEdge), compare_edges);
+
+    // breadth-first from header along the reversed edges
+    char* target = copy(header, strlen(header));
+    normalize_path(target);
+    int* queue = xmalloc((g.len + 1) * sizeof(int));
+    int queue_len = 0;
+    files->names = xmalloc((g.len + 1) * sizeof(char*));
+    for (int q = -1; ok && q < queue_len; q++) {
+        String path = make_string(q < 0 ? target : g.nodes[queue[q]].path);
+        IncludeEdge key = {last_component(path), NULL, 0};
+        int lo = 0, hi = edge_count; // first edge with key not less than path's
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (compare_edges(&edges[mid], &key) < 0) lo = mid + 1; else hi = mid;
+        }
+        for (int j = lo; j < edge_count && compare_edges(&edges[j], &key) == 0; j++) {
+            IncludeNode* node = &g.nodes[edges[j].node];
+            if (node->seen || !refers_to(edges[j].include, path)) continue;
+            node->seen = true;
+            queue[queue_len++] = edges[j].node;
+            ptrdiff_t n = strlen(node->path);
+            struct stat st;
+            if (n > 4 && strcmp(node->path + n - 4, ".d.c") == 0 && stat(node->path, &st) == 0) {
+                files->names[files->count++] = copy(node->path, n);
+            }
+        }
+    }
+    qsort(files->names, files->count, sizeof(char*), compare_names);
+    free(queue);
+    free(target);
+    free(edges);
+    free_graph(&g);
+    if (!ok) free_affected_files(files);
+    return ok;
+}
+
+void free_affected_files(AffectedFiles* files) {
+    require_not_null(files);
+    for (int i = 0; i < files->count; i++) {
+        free(files->names[i]);
+    }
+    free(files->names);
+    *files = (AffectedFiles){0, NULL};
+}
+
+// Runs a shell command in the test directory.
+static void sh(char* command) {
+    panicf_if(system(command) != 0, "Command failed: %s", command);
+}
+
+// Embraces the file and records its includes in the test database.
+static void embrace_test_file(char* file) {
+    String source = read_file(file);
+    String output = {NULL, 0, 0};
+    Includes includes = new_includes();
+    EmbraceOptions options = {.includes = &includes};
+    test_equal_i(embrace_into(file, source, &output, &options), true);
+    test_equal_i(update_include_db("test.db", 1, &file, &includes), true);
+    free_includes(&includes);
+    free(output.s);
+    free(source.s);
+}
+
+// Checks that the affected files are exactly the expected ones (comma-separated).
+static void test_affected(char* header, char* expected) {
+    AffectedFiles files;
+    test_equal_i(affected_files("test.db", header, &files), true);
+    String actual = new_string(4096);
+    for (int i = 0; i < files.count; i++) {
+        if (i > 0) append_char(&actual, ',');
+        append_cstring(&actual, files.names[i]);
+    }
+    test_equal_s(actual, expected);
+    free(actual.s);
+    free_affected_files(&files);
+}
+
+void includes_test(void) {
+    Includes includes = new_includes();
+    add_include(&includes, make_string("#include <stdio.h>"));
+    add_include(&includes, make_string("  #  include\t\"a/b.h\" // comment"));
+    add_include(&includes, make_string("*#include \"public.h\""));
+    add_include(&includes, make_string("#include MACRO"));
+    add_include(&includes, make_string("#includes \"x.h\""));
+    add_include(&includes, make_string("#include \"open.h"));
+    add_include(&includes, make_string("int x"));
+    test_equal_i(includes.len, 3);
+    test_equal_s(make_string(includes.names[0]), "<stdio.h>");
+    test_equal_s(make_string(includes.names[1]), "\"a/b.h\"");
+    test_equal_s(make_string(includes.names[2]), "\"public.h\"");
+    free_includes(&includes);
+
+    char paths[][32] = {"./a//b/./c.h", "a/../../b.h", "/../a/..", "a/..", "../x/../y"};
+    char* normalized[] = {"a/b/c.h", "../b.h", "/", ".", "../y"};
+    for (int i = 0; i < 5; i++) {
+        normalize_path(paths[i]);
+        test_equal_s(make_string(paths[i]), normalized[i]);
+    }
+
+    char cwd[4096];
+    panic_if(getcwd(cwd, sizeof(cwd)) == NULL, "Cannot get current directory.");
+    char dir[] = "/tmp/embrace_includes_XXXXXX";
+    panic_if(mkdtemp(dir) == NULL, "Cannot create directory.");
+    panic_if(chdir(dir) != 0, "Cannot change directory.");
+
+    sh("mkdir src inc && echo '#include \"inc/base.h\"' > util.h && echo 'int b;' > inc/base.h"
+        " && echo 'int o;' > other.h && echo 'int s;' > inc/sub.h"
+        " && printf '#include <stdio.h>\\n#include \"../util.h\"\\nint main(void)\\n    return 0\\n'"
+        " > src/main.d.c"
+        " && printf '#include \"other.h\"\\n#include \"sub.h\"\\nint x\\n' > src/x.d.c"
+        " && printf '#include \"../other.h\"\\n' > src/y.d.c");
+    embrace_test_file("src/main.d.c");
+    embrace_test_file("./src/x.d.c");
+    embrace_test_file("src/y.d.c");
+    test_affected("util.h", "src/main.d.c");
+    test_affected("inc/base.h", "src/main.d.c"); // through util.h
+    test_affected("./inc/../inc/base.h", "src/main.d.c");
+    test_affected("stdio.h", "src/main.d.c");
+    test_affected("other.h", "src/x.d.c,src/y.d.c"); // "other.h" is not relative to src
+    test_affected("inc/sub.h", "src/x.d.c"); // may be found through -Iinc
+    test_affected("src/x.d.c", "");
+    test_affected("none.h", "");
+
+    // changed headers are scanned again when a file that includes them is embraced
+    sh("echo '#include \"../other.h\"' >> inc/base.h");
+    test_affected("other.h", "src/x.d.c,src/y.d.c");
+    embrace_test_file("src/main.d.c");
+    test_affected("other.h", "src/main.d.c,src/x.d.c,src/y.d.c");
+
+    // changed and deleted files
+    sh("echo 'int x' > src/x.d.c && rm src/y.d.c");
+    embrace_test_file("src/x.d.c");
+    test_affected("other.h", "src/main.d.c");
+    test_affected("inc/sub.h", "");
+
+    AffectedFiles files;
+    test_equal_i(affected_files("no.db", "util.h", &files), false);
+
+    panic_if(chdir(cwd) != 0, "Cannot change directory.");
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    sh(command);
+}
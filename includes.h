@@ -0,0 +1,41 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef includes_h_INCLUDED
+#define includes_h_INCLUDED
+
+#include "util.h"
+
+/*
+The files that a debraced file includes, as written, e.g., "util.h" or
+<stdio.h>, collected by embrace_into from the #include lines of the file.
+*/
+struct Includes {
+    char** names;
+    int len;
+    int cap;
+};
+
+Includes new_includes(void);
+void free_includes(Includes* includes);
+void add_include(Includes* includes, String line);
+void add_includes(Includes* includes, String source);
+
+bool update_include_db(char* db, int count, char** files, Includes* includes);
+
+/*
+The debraced files (*.d.c) that depend on a header, sorted.
+*/
+typedef struct AffectedFiles AffectedFiles;
+struct AffectedFiles {
+    int count;
+    char** names;
+};
+
+bool affected_files(char* db, char* header, /*out*/AffectedFiles* files);
+void free_affected_files(AffectedFiles* files);
+void includes_test(void);
+
+#endif // includes_h_INCLUDED
@@ -0,0 +1,660 @@
+/*
+Incremental embracing: Regenerated files often differ from their previous
+version in a few places only. A state file next to the output records the hash
+of each line of the last version, the output of the last run, and checkpoints:
+lines after which the state of the embracer depends on the line itself only.
+The next run finds the first changed line, takes the output of the last run up
+to the last checkpoint before it, and embraces from there. Once a checkpoint of
+the new file has the same line as a checkpoint of the last version, the states
+are the same, and the output of the last run is taken up to the last checkpoint
+before the next changed line (or to the end). Then embracing resumes there. The
+output is the same as that of a full run.
+
+A line is a checkpoint if it is not empty, not indented, and not an end marker,
+if the line before it leaves no open literal, comment, bracket, line
+continuation, or preprocessor line within a block, and if no later "do" can
+change its output. Embracing such a line with a fresh embracer gives the same
+state as in the full run (only its own output differs, which is taken from the
+last run), since the line closes all open blocks and the state of the lexer
+carries nothing over. With #line directives, the output also depends on the
+line numbers, so output is only taken where they have not moved.
+
+The state file is a text file. The first line identifies the format and the
+version of embrace (EMBRACE_VERSION). The second line has the options, the
+numbers of lines and checkpoints, the size of the output, and the name of the
+file, whose #line directives are part of the output. Then follows a line with
+the hash of each line (16 hex digits), a line with the line number, the output
+offset, and the output line of each checkpoint, and the output. A state of
+another version, for other options, or another file is ignored.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // mkdtemp
+#include <limits.h>
+#include <unistd.h>
+#include "util.h"
+#include "embrace.h"
+#include "incremental.h"
+
+#define STATE_HEADER "embrace-state 1 " EMBRACE_VERSION "\n"
+
+typedef struct Checkpoint Checkpoint;
+struct Checkpoint {
+    int line; // line number
+    ptrdiff_t offset; // length of the output after the line
+    int output_line; // in format mode with line directives (see Embracer)
+};
+
+/*
+The lines of a version of a file, its checkpoints (ascending), and the output.
+*/
+typedef struct State State;
+struct State {
+    int line_count;
+    unsigned long long* hashes;
+    int checkpoint_count;
+    int checkpoint_cap;
+    Checkpoint* checkpoints;
+    String output;
+    String text; // content of the state file, output points into it
+    int* first_with_hash; // see index_checkpoints
+    int* next_with_hash;
+    int hash_mask;
+};
+
+static void free_state(State* s) {
+    free(s->hashes);
+    free(s->checkpoints);
+    free(s->first_with_hash);
+    free(s->next_with_hash);
+    free(s->text.s);
+    memset(s, 0, sizeof(State));
+}
+
+static void add_checkpoint(State* s, int line, ptrdiff_t offset, int output_line) {
+    if (s->checkpoint_count == s->checkpoint_cap) {
+        int cap = s->checkpoint_cap < 16 ? 16 : 2 * s->checkpoint_cap;
+        Checkpoint* c = realloc(s->checkpoints, cap * sizeof(Checkpoint));
+        panic_if(c == NULL, "Cannot allocate memory.");
+        s->checkpoints = c;
+        s->checkpoint_cap = cap;
+    }
+    s->checkpoints[s->checkpoint_count++] = (Checkpoint){line, offset, output_line};
+}
+
+// Returns the index of the first checkpoint at or after the given line.
+static int first_checkpoint(State* s, int line) {
+    int lo = 0, hi = s->checkpoint_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (s->checkpoints[mid].line < line) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Returns the checkpoint of the given line or NULL.
+static Checkpoint* find_checkpoint(State* s, int line) {
+    int k = first_checkpoint(s, line);
+    return k < s->checkpoint_count && s->checkpoints[k].line == line ? &s->checkpoints[k] : NULL;
+}
+
+// Parses the content of a state file (see above) into s.
+static bool parse_state(State* s, char* filename, EmbraceOptions* options) {
+    char* p = s->text.s;
+    char* end = p + s->text.len;
+    ptrdiff_t n = strlen(STATE_HEADER);
+    if (end - p < n || strncmp(p, STATE_HEADER, n) != 0) return false;
+    p += n;
+    char* eol = memchr(p, '\n', end - p);
+    if (eol == NULL) return false;
+    long long v[5]; // format, line directives, lines, checkpoints, output size
+    for (int k = 0; k < 5; k++) {
+        char* q;
+        v[k] = strtoll(p, &q, 10);
+        if (q == p || *q != ' ' || v[k] < 0) return false;
+        p = q + 1;
+    }
+    if (v[0] != options->format || v[1] != options->line_directives) return false;
+    if (eol - p != strlen(filename) || memcmp(p, filename, eol - p) != 0) return false;
+    p = eol + 1;
+    if (v[2] > INT_MAX || v[3] > v[2] || end - p < v[2] * 17) return false;
+    s->line_count = v[2];
+    s->hashes = xmalloc((v[2] + 1) * sizeof(unsigned long long));
+    for (int i = 0; i < s->line_count; i++) {
+        unsigned long long h = 0;
+        for (int k = 0; k < 16; k++) {
+            char c = p[k];
+            int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (d < 0) return false;
+            h = (h << 4) | d;
+        }
+        if (p[16] != '\n') return false;
+        s->hashes[i] = h;
+        p += 17;
+    }
+    s->checkpoints = xmalloc((v[3] + 1) * sizeof(Checkpoint));
+    s->checkpoint_cap = v[3] + 1;
+    for (int i = 0; i < v[3]; i++) {
+        char* q;
+        long line = strtol(p, &q, 10);
+        if (q == p || *q != ' ') return false;
+        p = q + 1;
+        long long offset = strtoll(p, &q, 10);
+        if (q == p || *q != ' ') return false;
+        p = q + 1;
+        long output_line = strtol(p, &q, 10);
+        if (q == p || *q != '\n') return false;
+        p = q + 1;
+        Checkpoint* prev = i > 0 ? &s->checkpoints[i - 1] : NULL;
+        if (line < 1 || line > s->line_count || offset < 0 || offset > v[4] ||
+                output_line < 0 || output_line > INT_MAX ||
+                (prev != NULL && (line <= prev->line || offset < prev->offset))) {
+            return false;
+        }
+        add_checkpoint(s, line, offset, output_line);
+    }
+    if (end - p != v[4]) return false;
+    s->output = make_string2(p, v[4]);
+    return true;
+}
+
+/*
+Reads the state of the last run from state_file. Returns false if there is no
+usable state, then s is empty.
+*/
+static bool read_state(char* state_file, char* filename, EmbraceOptions* options,
+        /*out*/State* s) {
+    memset(s, 0, sizeof(State));
+    if (read_file_into(state_file, &s->text) && parse_state(s, filename, options)) return true;
+    free_state(s);
+    return false;
+}
+
+static bool write_state(char* state_file, char* filename, EmbraceOptions* options, State* s) {
+    ptrdiff_t size = strlen(STATE_HEADER) + strlen(filename) + 128 + 17 * (ptrdiff_t)s->line_count +
+        48 * (ptrdiff_t)s->checkpoint_count + s->output.len;
+    String text = new_string(size);
+    char buf[128];
+    append_cstring(&text, STATE_HEADER);
+    snprintf(buf, sizeof(buf), "%d %d %d %d %td ", options->format, options->line_directives,
+            s->line_count, s->checkpoint_count, s->output.len);
+    append_cstring(&text, buf);
+    append_cstring(&text, filename);
+    append_char(&text, '\n');
+    for (int i = 0; i < s->line_count; i++) {
+        unsigned long long h = s->hashes[i];
+        for (int k = 15; k >= 0; k--) {
+            text.s[text.len + k] = "0123456789abcdef"[h & 15];
+            h >>= 4;
+        }
+        text.len += 16;
+        append_char(&text, '\n');
+    }
+    for (int i = 0; i < s->checkpoint_count; i++) {
+        Checkpoint* c = &s->checkpoints[i];
+        snprintf(buf, sizeof(buf), "%d %td %d\n", c->line, c->offset, c->output_line);
+        append_cstring(&text, buf);
+    }
+    append_string(&text, s->output);
+    bool ok = write_file(state_file, text);
+    free(text.s);
+    return ok;
+}
+
+// Hashes line, 8 characters at a time.
+static unsigned long long hash_line(String line) {
+    unsigned long long h = 0x9e3779b97f4a7c15ULL ^ (unsigned long long)line.len;
+    ptrdiff_t i = 0;
+    for (; i + 8 <= line.len; i += 8) {
+        unsigned long long w;
+        memcpy(&w, line.s + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    unsigned long long w = 0;
+    memcpy(&w, line.s + i, line.len - i);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+// Appends n characters to str, which is grown as needed.
+static void append_bytes(/*inout*/String* str, char* s, ptrdiff_t n) {
+    if (str->len + n + 1 > str->cap) {
+        ptrdiff_t cap = 2 * str->cap;
+        if (cap < str->len + n + 1) cap = str->len + n + 1;
+        char* t = realloc(str->s, cap);
+        panic_if(t == NULL, "Cannot allocate memory.");
+        str->s = t;
+        str->cap = cap;
+    }
+    memcpy(str->s + str->len, s, n);
+    str->len += n;
+}
+
+// Returns the output line (as for #line) at the end of the output of e.
+static int output_line(Embracer* e) {
+    int n = e->output_line;
+    char* end = e->output.s + e->output.len;
+    for (char* p = e->output.s + e->output_counted; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        n++;
+    }
+    return n;
+}
+
+// Checks if the last line of e leaves nothing open for the next line (see above).
+static bool is_plain(Embracer* e) {
+    LineInfo* li = &e->li;
+    // after a preprocessor line, the next line does not close blocks
+    return li->state == 0 && li->braces == 0 && li->do_open == NULL &&
+        (!li->preprocessor_line || e->depth == 0);
+}
+
+/*
+Indexes the checkpoints of s by the hash of their line: first_with_hash[h &
+hash_mask] is the first checkpoint with a line of hash h (or -1), and
+next_with_hash the next one with the same value of h & hash_mask.
+*/
+static void index_checkpoints(State* s) {
+    int size = 16;
+    while (size < 2 * s->checkpoint_count) size *= 2;
+    s->hash_mask = size - 1;
+    s->first_with_hash = xmalloc(size * sizeof(int));
+    s->next_with_hash = xmalloc((s->checkpoint_count + 1) * sizeof(int));
+    for (int b = 0; b < size; b++) s->first_with_hash[b] = -1;
+    for (int k = s->checkpoint_count - 1; k >= 0; k--) {
+        int b = s->hashes[s->checkpoints[k].line - 1] & s->hash_mask;
+        s->next_with_hash[k] = s->first_with_hash[b];
+        s->first_with_hash[b] = k;
+    }
+}
+
+/*
+If checkpoint c of the last run (old) has the same line as checkpoint i of the
+new file, returns the last checkpoint of the last run up to which its output can
+be taken: the last one before the next changed line. Returns the end of the
+checkpoints if the rest of the output can be taken, or NULL if c does not help.
+*/
+static Checkpoint* take_until(State* old, State* new, int i, Checkpoint* c) {
+    int j = c->line;
+    if (old->hashes[j - 1] != new->hashes[i - 1]) return NULL;
+    int run = 0; // unchanged lines after the checkpoint
+    while (i + run < new->line_count && j + run < old->line_count &&
+            new->hashes[i + run] == old->hashes[j + run]) {
+        run++;
+    }
+    Checkpoint* end = old->checkpoints + old->checkpoint_count;
+    if (i + run == new->line_count && j + run == old->line_count) return end;
+    end = old->checkpoints + first_checkpoint(old, j + run + 1) - 1;
+    return end > c ? end : NULL;
+}
+
+/*
+Looks for a checkpoint of the last run (old) whose output can be taken after
+checkpoint i of the new file (see take_until). It is looked for where the lines
+were aligned before (old line i + delta), where they are aligned at the end,
+and then among the checkpoints with the same line. With #line directives, the
+line numbers and output lines (out_line) have to be the same. Sets end to the
+result of take_until.
+*/
+static Checkpoint* find_sync(State* old, State* new, int i, int delta, bool line_directives,
+        int out_line, /*out*/Checkpoint** end) {
+    int candidates[] = {i + delta, i + old->line_count - new->line_count};
+    for (int k = 0; k < 2; k++) {
+        if (line_directives && candidates[k] != i) continue;
+        Checkpoint* c = find_checkpoint(old, candidates[k]);
+        if (c == NULL || (line_directives && c->output_line != out_line)) continue;
+        *end = take_until(old, new, i, c);
+        if (*end != NULL) return c;
+    }
+    if (line_directives || old->checkpoint_count == 0) return NULL;
+    if (old->first_with_hash == NULL) index_checkpoints(old);
+    unsigned long long h = new->hashes[i - 1];
+    int tries = 8; // bounds the effort for lines that occur often
+    for (int k = old->first_with_hash[h & old->hash_mask]; k >= 0 && tries > 0;
+            k = old->next_with_hash[k]) {
+        Checkpoint* c = &old->checkpoints[k];
+        if (old->hashes[c->line - 1] != h) continue;
+        tries--;
+        *end = take_until(old, new, i, c);
+        if (*end != NULL) return c;
+    }
+    return NULL;
+}
+
+/*
+Brings e, which has just been started, into the state after line, which is line
+number i of the file and corresponds to checkpoint c of the last run. The output
+of e is cut to len and continued with taken, the output of the last run up to
+the checkpoint.
+*/
+static bool resume(/*inout*/Embracer* e, String* line, int i, Checkpoint* c, ptrdiff_t len,
+        String taken) {
+    bool quiet = e->options.quiet;
+    e->options.quiet = true;
+    e->line_number = i - 1;
+    bool ok = embrace_line(e, line) && e->li.line == line && e->li.do_open == NULL;
+    e->options.quiet = quiet;
+    if (!ok) return false;
+    e->output.len = len;
+    append_bytes(&e->output, taken.s, taken.len);
+    e->output_counted = e->output.len;
+    e->output_line = c->output_line;
+    return true;
+}
+
+// Ends e, drops what this adds to the output, and starts e again.
+static void restart(/*inout*/Embracer* e, char* filename, ptrdiff_t len, EmbraceOptions* o) {
+    embrace_end(e);
+    embrace_begin(e, filename, make_string3(e->output.s, len, e->output.cap), o);
+}
+
+/*
+Embraces source_code like embrace_into, but reuses the output of the last run
+as recorded in state_file (see above), which is then updated. Tags and includes
+are not supported. The content of source_code is modified. If embraced_lines is
+not NULL, it is set to the number of lines that have been embraced in this run.
+Returns false if source_code is not valid debraced C. The error is reported on
+stderr.
+*/
+bool embrace_incremental(char* filename, String source_code, char* state_file,
+        /*inout*/String* out, EmbraceOptions* options, /*out*/int* embraced_lines) {
+    require_not_null(filename);
+    require_not_null(state_file);
+    require_not_null(out);
+    EmbraceOptions o = {0};
+    if (options != NULL) o = *options;
+    o.line_directives = o.format && o.line_directives;
+    require("no tags or includes", o.tags == NULL && o.includes == NULL);
+    if (embraced_lines != NULL) *embraced_lines = 0;
+    if (is_verbatim(source_code)) return embrace_into(filename, source_code, out, &o);
+
+    StringArray* lines = split_lines(source_code.s);
+    int n = lines->len;
+    State new = {0};
+    new.line_count = n;
+    new.hashes = xmalloc((n + 1) * sizeof(unsigned long long));
+    for (int i = 0; i < n; i++) new.hashes[i] = hash_line(lines->a[i]);
+    State old;
+    bool have_old = read_state(state_file, filename, &o, &old);
+    int m = old.line_count;
+    int same = 0; // unchanged lines at the beginning
+    while (same < n && same < m && new.hashes[same] == old.hashes[same]) same++;
+    if (have_old && same == n && n == m) {
+        append_bytes(out, old.output.s, old.output.len);
+        free_state(&old);
+        free_state(&new);
+        free(lines);
+        return true;
+    }
+
+    // resume at the last checkpoint within the unchanged lines
+    int k = first_checkpoint(&old, same + 1);
+    for (int i = 0; i < k; i++) {
+        Checkpoint* c = &old.checkpoints[i];
+        add_checkpoint(&new, c->line, c->offset, c->output_line);
+    }
+    int first = k > 0 ? old.checkpoints[k - 1].line : 0;
+    ptrdiff_t start = out->len;
+    Embracer e;
+    embrace_begin(&e, filename, *out, &o);
+    if (first > 0 && !resume(&e, &lines->a[first - 1], first, &old.checkpoints[k - 1], start,
+            make_string2(old.output.s, old.checkpoints[k - 1].offset))) {
+        // the state does not fit the file after all, embrace all of it
+        restart(&e, filename, start, &o);
+        free_state(&old);
+        first = 0;
+        new.checkpoint_count = 0;
+    }
+    int embraced = first > 0 ? 1 : 0;
+    int delta = 0; // old line number minus new line number where output was last taken
+    bool taken_to_end = false;
+    bool ok = true;
+    for (int i = first + 1; i <= n && e.ok; i++) {
+        String* line = &lines->a[i - 1];
+        bool plain = is_plain(&e);
+        if (!embrace_line(&e, line)) break;
+        embraced++;
+        if (!plain || e.li.line != line || e.li.indent != 0 || e.li.end_marker ||
+                e.li.do_open != NULL) {
+            continue;
+        }
+        int out_line = o.line_directives ? output_line(&e) : 0;
+        add_checkpoint(&new, i, e.output.len - start, out_line);
+        Checkpoint* end;
+        Checkpoint* c = find_sync(&old, &new, i, delta, o.line_directives, out_line, &end);
+        if (c == NULL) continue;
+        ptrdiff_t len = e.output.len;
+        ptrdiff_t shift = len - start - c->offset;
+        int j = c->line;
+        if (end == old.checkpoints + old.checkpoint_count) {
+            ok = embrace_end(&e);
+            e.output.len = len;
+            append_bytes(&e.output, old.output.s + c->offset, old.output.len - c->offset);
+            for (c++; c < end; c++) {
+                add_checkpoint(&new, c->line + n - m, c->offset + shift, c->output_line);
+            }
+            taken_to_end = true;
+            break;
+        }
+        restart(&e, filename, len, &o);
+        int i2 = i + end->line - j;
+        if (!resume(&e, &lines->a[i2 - 1], i2, end, len,
+                make_string2(old.output.s + c->offset, end->offset - c->offset))) {
+            // only if hashes collide, embrace all of it
+            restart(&e, filename, start, &o);
+            free_state(&old);
+            new.checkpoint_count = 0;
+            embraced = 0;
+            delta = 0;
+            i = 0;
+            continue;
+        }
+        for (c++; c <= end; c++) {
+            add_checkpoint(&new, c->line + i - j, c->offset + shift, c->output_line);
+        }
+        embraced++;
+        delta = j - i;
+        i = i2;
+    }
+    if (!taken_to_end) ok = embrace_end(&e);
+    out->s = e.output.s;
+    out->cap = e.output.cap;
+    if (ok) {
+        out->len = e.output.len;
+        new.output = make_string2(out->s + start, out->len - start);
+        if (!write_state(state_file, filename, &o, &new)) {
+            fprintf(stderr, "%s: Cannot write state file.\n", state_file);
+        }
+    }
+    if (embraced_lines != NULL) *embraced_lines = embraced;
+    free_state(&old);
+    free_state(&new);
+    free(lines);
+    return ok;
+}
+
+// Returns a copy of s (embracing modifies its input).
+static String copy_source(char* s) {
+    ptrdiff_t n = strlen(s);
+    String t = new_string(n + 1);
+    memcpy(t.s, s, n + 1);
+    t.len = n;
+    return t;
+}
+
+// Embraces source incrementally and compares the result to a full run.
+static void check_incremental(char* source, char* state_file, EmbraceOptions* options,
+        int expected_embraced) {
+    String full = new_string(2 * strlen(source) + 2);
+    String copy = copy_source(source);
+    bool full_ok = embrace_into("test.d.c", copy, &full, options);
+    free(copy.s);
+    copy = copy_source(source);
+    String output = {NULL, 0, 0};
+    int embraced;
+    bool ok = embrace_incremental("test.d.c", copy, state_file, &output, options, &embraced);
+    test_equal_i(ok, full_ok);
+    if (ok && full_ok) {
+        test_equal_i(output.len == full.len && memcmp(output.s, full.s, full.len) == 0, true);
+    }
+    if (expected_embraced >= 0) test_equal_i(embraced, expected_embraced);
+    free(copy.s);
+    free(output.s);
+    free(full.s);
+}
+
+void incremental_test(void) {
+    char dir[] = "/tmp/embrace_incremental_XXXXXX";
+    panic_if(mkdtemp(dir) == NULL, "Cannot create directory.");
+    char state_file[64];
+    snprintf(state_file, sizeof(state_file), "%s/test.state", dir);
+    EmbraceOptions quiet = {.quiet = true};
+
+    char* a =
+        "#include <stdio.h>\n"
+        "\n"
+        "int f(int x)\n"
+        "    return x + 1\n"
+        "\n"
+        "int g(int x)\n"
+        "    if x > 0 do\n"
+        "        return 1\n"
+        "    return 0\n"
+        "\n"
+        "int h(int x)\n"
+        "    return x\n";
+    check_incremental(a, state_file, NULL, 13); // no state yet, 12 lines and an empty one
+    check_incremental(a, state_file, NULL, 0); // unchanged
+    // a changed line in the middle, from the checkpoint at line 6 until the
+    // checkpoint at line 11, where the states converge
+    char* b =
+        "#include <stdio.h>\n"
+        "\n"
+        "int f(int x)\n"
+        "    return x + 1\n"
+        "\n"
+        "int g(int x)\n"
+        "    if x > 1 do\n"
+        "        return 1\n"
+        "    return 0\n"
+        "\n"
+        "int h(int x)\n"
+        "    return x\n";
+    check_incremental(b, state_file, NULL, 6);
+    // inserted lines
+    char* c =
+        "#include <stdio.h>\n"
+        "\n"
+        "int f(int x)\n"
+        "    return x + 1\n"
+        "\n"
+        "int e(int x)\n"
+        "    return 2\n"
+        "\n"
+        "int g(int x)\n"
+        "    if x > 1 do\n"
+        "        return 1\n"
+        "    return 0\n"
+        "\n"
+        "int h(int x)\n"
+        "    return x\n";
+    check_incremental(c, state_file, NULL, 7); // from the checkpoint at line 3 until line 9
+    // an invalid version does not change the state
+    check_incremental("int f(void)\n  x\n y\n", state_file, &quiet, -1);
+    check_incremental(a, state_file, NULL, 9);
+    // changes in two places, the output in between is taken
+    char* d =
+        "#include <stdio.h>\n"
+        "\n"
+        "int f(int x)\n"
+        "    return x + 2\n"
+        "\n"
+        "int g(int x)\n"
+        "    if x > 0 do\n"
+        "        return 1\n"
+        "    return 0\n"
+        "\n"
+        "int h(int x)\n"
+        "    return -x\n";
+    check_incremental(d, state_file, NULL, 7); // 3 to 6 and 11 to 13
+    // lines inserted in two places, the output in between is found by the hash
+    // of the checkpoint line, since the lines moved
+    char* e =
+        "#include <stdio.h>\n"
+        "\n"
+        "int f(int x)\n"
+        "    x++\n"
+        "    return x + 2\n"
+        "\n"
+        "int g(int x)\n"
+        "    if x > 0 do\n"
+        "        return 1\n"
+        "    return 0\n"
+        "\n"
+        "int h(int x)\n"
+        "    x--\n"
+        "    x--\n"
+        "    return -x\n";
+    check_incremental(e, state_file, NULL, 10); // 3 to 7 and 12 to 16
+    check_incremental(a, state_file, NULL, 7);
+    // removed lines at the end, a struct that needs a semicolon at the end
+    check_incremental("#include <stdio.h>\n\nstruct S\n    int x\n", state_file, NULL, 5);
+    check_incremental("#include <stdio.h>\n\nstruct S\n    int x\n    int y\n", state_file, NULL, 4);
+
+    // format mode with line directives, output is only taken where the line
+    // numbers are the same
+    EmbraceOptions format = {.format = true, .line_directives = true};
+    EmbraceOptions quiet_format = {.format = true, .line_directives = true, .quiet = true};
+    check_incremental(a, state_file, &format, 13);
+    check_incremental(b, state_file, &format, 6);
+    check_incremental(c, state_file, &format, 14);
+    check_incremental(b, state_file, &format, 11);
+
+    // a damaged state file is ignored
+    write_file(state_file, make_string(STATE_HEADER "0 0 100 0 0 test.d.c\n"));
+    check_incremental(a, state_file, NULL, 13);
+
+    // random edits of a file give the same output as full runs
+    char* sample[] = {
+        "int f(int x)", "    return x", "", "struct S", "    int a", "    int b",
+        "typedef struct T", "    int c", "T", "int g(void)", "    do", "        x++",
+        "    while (x < 5)", "    if x", "        > 0 do", "        y()", "    else",
+        "        z()", "end. g", "#define A \\", "    1", "/* a", "b */", "int a[] = {",
+        "1, 2 }", "if x do", "    int x = (1 +", "2)", "enum E { A, B }",
+    };
+    int sample_count = sizeof(sample) / sizeof(sample[0]);
+    int file[64];
+    int len = 0;
+    unsigned seed = 1;
+    String source = new_string(64 * 32);
+    for (int round = 0; round < 2000; round++) {
+        seed = seed * 1103515245 + 12345;
+        int r = (seed >> 8) % 64;
+        int op = (seed >> 20) % 3;
+        if (op == 0 && len < 64) { // insert
+            int at = len > 0 ? r % (len + 1) : 0;
+            memmove(file + at + 1, file + at, (len - at) * sizeof(int));
+            file[at] = (seed >> 14) % sample_count;
+            len++;
+        } else if (op == 1 && len > 0) { // delete
+            int at = r % len;
+            memmove(file + at, file + at + 1, (len - at - 1) * sizeof(int));
+            len--;
+        } else if (len > 0) { // replace
+            file[r % len] = (seed >> 14) % sample_count;
+        }
+        source.len = 0;
+        for (int i = 0; i < len; i++) {
+            append_cstring(&source, sample[file[i]]);
+            append_char(&source, '\n');
+        }
+        source.s[source.len] = '\0';
+        check_incremental(source.s, state_file, (round / 500) % 2 == 0 ? &quiet : &quiet_format, -1);
+    }
+    free(source.s);
+
+    remove(state_file);
+    rmdir(dir);
+}
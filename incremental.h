@@ -0,0 +1,16 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef incremental_h_INCLUDED
+#define incremental_h_INCLUDED
+
+#include "util.h"
+#include "embrace.h"
+
+bool embrace_incremental(char* filename, String source_code, char* state_file,
+        /*inout*/String* output, EmbraceOptions* options, /*out*/int* embraced_lines);
+void incremental_test(void);
+
+#endif // incremental_h_INCLUDED
@@ -0,0 +1,18 @@
+/*
+Runs embrace_large_test, which streams more than 4 GB through embrace and checks
+that the memory used stays small. Takes a few minutes. Run with "make large".
+Exits with a nonzero status if a check fails.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#include "util.h"
+#include "embrace.h"
+
+void embrace_large_test(void); // see embrace.c
+
+int main(void) {
+    embrace_large_test();
+    return base_tests_passed() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,328 @@
+/*
+Manifest: Records for each file of a batch run the size, modification time, and
+inode of the input file, and the hash, size, and modification time of the
+output file it was embraced into, in out_dir/.embrace-manifest. A later batch
+run stats all inputs and outputs in parallel (statx on Linux) and skips the
+files whose records still match, without opening them. An unchanged run over a
+large tree thus costs a few system calls per file.
+
+The manifest is a text file. The first line identifies the format, the version
+of embrace (EMBRACE_VERSION), and the options that change the output (format
+and line directives); a manifest of another version or for other options is
+ignored.
+Each further line describes a file: its path and the numbers above, separated
+by tabs, sorted by path. An input that changed within the resolution of the
+file system's clock right before the manifest was written might have the same
+modification time after a further change, so records with a modification time
+that is not older than the manifest are not trusted (as in git's index).
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // statx, st_mtim, mkdtemp
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "embrace.h"
+#include "parallel.h"
+#include "batch.h"
+#include "manifest.h"
+
+#define MANIFEST_NAME ".embrace-manifest"
+#define MANIFEST_HEADER "embrace-manifest 1 " EMBRACE_VERSION
+
+// Writes the first line of a manifest for the given options (may be NULL) to header.
+static void manifest_header(/*out*/char* header, int size, EmbraceOptions* options) {
+    EmbraceOptions o = {0};
+    if (options != NULL) o = *options;
+    snprintf(header, size, MANIFEST_HEADER " %d %d\n", o.format, o.format && o.line_directives);
+}
+
+// Returns the path of the manifest of out_dir as a newly allocated string.
+static char* manifest_path(char* out_dir) {
+    int n = strlen(out_dir) + strlen(MANIFEST_NAME) + 2;
+    char* path = xmalloc(n);
+    snprintf(path, n, "%s/%s", out_dir, MANIFEST_NAME);
+    return path;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    return strcmp(((ManifestEntry*)a)->path, ((ManifestEntry*)b)->path);
+}
+
+/*
+Reads the manifest of out_dir. A missing manifest, one in an unknown format, or
+one of another version of embrace or for other options gives an empty manifest.
+A truncated last line is ignored.
+*/
+Manifest read_manifest(char* out_dir, EmbraceOptions* options) {
+    require_not_null(out_dir);
+    Manifest m = {0, NULL, 0, {NULL, 0, 0}};
+    char* path = manifest_path(out_dir);
+    struct stat st;
+    // stat before reading, such that a concurrent update makes records less trusted
+    bool ok = stat(path, &st) == 0 && read_file_into(path, &m.text);
+    free(path);
+    char header[64];
+    manifest_header(header, sizeof(header), options);
+    ptrdiff_t n = strlen(header);
+    if (!ok || m.text.len < n || strncmp(m.text.s, header, n) != 0) return m;
+    m.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    int cap = 16;
+    m.entries = xmalloc(cap * sizeof(ManifestEntry));
+    char* end = m.text.s + m.text.len;
+    char* eol;
+    for (char* p = m.text.s + n; p < end && (eol = memchr(p, '\n', end - p)) != NULL; p = eol + 1) {
+        *eol = '\0';
+        char* tab = strchr(p, '\t');
+        if (tab == NULL) continue;
+        *tab = '\0';
+        ManifestEntry e = {p};
+        if (sscanf(tab + 1, "%lld\t%lld\t%lld\t%llx\t%lld\t%lld", &e.size, &e.mtime, &e.inode,
+                &e.hash, &e.output_size, &e.output_mtime) != 6) {
+            continue;
+        }
+        if (m.len >= cap) {
+            cap *= 2;
+            m.entries = realloc(m.entries, cap * sizeof(ManifestEntry));
+            panic_if(m.entries == NULL, "Cannot allocate memory.");
+        }
+        m.entries[m.len++] = e;
+    }
+    // written sorted, but do not rely on it
+    qsort(m.entries, m.len, sizeof(ManifestEntry), compare_entries);
+    return m;
+}
+
+void free_manifest(Manifest* manifest) {
+    require_not_null(manifest);
+    free(manifest->entries);
+    free(manifest->text.s);
+    *manifest = (Manifest){0, NULL, 0, {NULL, 0, 0}};
+}
+
+// Gets size, modification time, and inode of the file. Size is -1 if it does not exist.
+static void stat_file(char* name, /*out*/long long* size, /*out*/long long* mtime,
+        /*out*/long long* inode) {
+    *size = -1;
+    *mtime = 0;
+    *inode = 0;
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+    // only the fields needed, and no synchronization with remote file systems
+    struct statx stx;
+    if (statx(AT_FDCWD, name, AT_STATX_SYNC_AS_STAT, STATX_TYPE | STATX_SIZE | STATX_MTIME |
+            STATX_INO, &stx) != 0 || !S_ISREG(stx.stx_mode)) {
+        return;
+    }
+    *size = stx.stx_size;
+    *mtime = stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+    *inode = stx.stx_ino;
+#else
+    struct stat st;
+    if (stat(name, &st) != 0 || !S_ISREG(st.st_mode)) return;
+    *size = st.st_size;
+    *mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    *inode = st.st_ino;
+#endif
+}
+
+typedef struct StatFiles StatFiles;
+struct StatFiles {
+    char** files;
+    char** outputs;
+    ManifestEntry* entries;
+};
+
+static void stat_entry(int index, int worker, void* context) {
+    StatFiles* s = context;
+    ManifestEntry* e = &s->entries[index];
+    long long inode;
+    if (s->files != NULL) {
+        e->path = s->files[index];
+        e->hash = 0;
+        stat_file(e->path, &e->size, &e->mtime, &e->inode);
+    }
+    stat_file(s->outputs[index], &e->output_size, &e->output_mtime, &inode);
+}
+
+/*
+Stats the input files and their output files in parallel and records the
+results in entries (except for the hash). If files is NULL, only the outputs
+are stated and the input fields of the entries are left unchanged.
+*/
+void stat_files(int count, char** files, char** outputs, /*out*/ManifestEntry* entries) {
+    require("not negative", count >= 0);
+    require_not_null(outputs);
+    require_not_null(entries);
+    StatFiles s = {files, outputs, entries};
+    parallel_for(count, stat_entry, &s);
+}
+
+// Returns the entry of the input file or NULL if there is none.
+ManifestEntry* find_entry(Manifest* manifest, char* path) {
+    require_not_null(manifest);
+    require_not_null(path);
+    ManifestEntry key = {path};
+    if (manifest->len == 0) return NULL;
+    return bsearch(&key, manifest->entries, manifest->len, sizeof(ManifestEntry), compare_entries);
+}
+
+/*
+Checks whether the input and output files (stated with stat_files) are the ones
+recorded in the manifest, i.e., whether the input need not be embraced again.
+*/
+bool is_unchanged(Manifest* manifest, ManifestEntry* current) {
+    require_not_null(current);
+    ManifestEntry* e = find_entry(manifest, current->path);
+    return e != NULL && current->size >= 0 && current->output_size >= 0
+        && e->size == current->size && e->mtime == current->mtime
+        && e->inode == current->inode && e->mtime < manifest->mtime
+        && e->output_size == current->output_size && e->output_mtime == current->output_mtime;
+}
+
+// FNV-1a, 64 bits. Never returns 0, which means unknown.
+unsigned long long hash_output(String output) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (ptrdiff_t i = 0; i < output.len; i++) {
+        h ^= (unsigned char)output.s[i];
+        h *= 1099511628211ULL;
+    }
+    return h != 0 ? h : 1;
+}
+
+/*
+Writes the manifest of out_dir with the entries of manifest, replaced or
+complemented by the updates. An update with a size of -1 removes the entry of
+the file. Files whose names contain tabs or newlines are not recorded.
+*/
+bool write_manifest(char* out_dir, Manifest* manifest, int count, ManifestEntry* updates,
+        EmbraceOptions* options) {
+    require_not_null(out_dir);
+    require_not_null(manifest);
+    require("not negative", count >= 0);
+    ManifestEntry* sorted = xmalloc((count + 1) * sizeof(ManifestEntry));
+    memcpy(sorted, updates, count * sizeof(ManifestEntry));
+    qsort(sorted, count, sizeof(ManifestEntry), compare_entries);
+    char header[64];
+    manifest_header(header, sizeof(header), options);
+    String text = new_string(strlen(header) + (manifest->len + count) * 128 + 1);
+    append_cstring(&text, header);
+    int i = 0, k = 0;
+    while (i < manifest->len || k < count) {
+        ManifestEntry* e;
+        if (k >= count || (i < manifest->len &&
+                strcmp(manifest->entries[i].path, sorted[k].path) < 0)) {
+            e = &manifest->entries[i++];
+        } else {
+            if (i < manifest->len && strcmp(manifest->entries[i].path, sorted[k].path) == 0) i++;
+            e = &sorted[k++];
+            // the last update of a file wins
+            if (k < count && strcmp(e->path, sorted[k].path) == 0) continue;
+        }
+        if (e->size < 0 || strpbrk(e->path, "\t\n") != NULL) continue;
+        char numbers[160];
+        snprintf(numbers, sizeof(numbers), "\t%lld\t%lld\t%lld\t%016llx\t%lld\t%lld\n",
+            e->size, e->mtime, e->inode, e->hash, e->output_size, e->output_mtime);
+        append_cstring(&text, e->path);
+        append_cstring(&text, numbers);
+    }
+    char* path = manifest_path(out_dir);
+    bool ok = make_dirs(path) && write_file(path, text);
+    free(path);
+    free(text.s);
+    free(sorted);
+    return ok;
+}
+
+// Runs a shell command in the test directory.
+static void sh(char* command) {
+    panicf_if(system(command) != 0, "Command failed: %s", command);
+}
+
+static long long inode_of(char* name) {
+    struct stat st;
+    return stat(name, &st) == 0 ? (long long)st.st_ino : -1;
+}
+
+static int manifest_lines(void) {
+    String text = read_file("out/" MANIFEST_NAME);
+    int lines = 0;
+    for (ptrdiff_t i = 0; i < text.len; i++) lines += text.s[i] == '\n';
+    free(text.s);
+    return lines;
+}
+
+void manifest_test(void) {
+    test_equal_i(hash_output(make_string("")) != 0, true);
+    test_equal_i(hash_output(make_string("a")) != hash_output(make_string("b")), true);
+
+    char cwd[4096];
+    panic_if(getcwd(cwd, sizeof(cwd)) == NULL, "Cannot get current directory.");
+    char dir[] = "/tmp/embrace_manifest_XXXXXX";
+    panic_if(mkdtemp(dir) == NULL, "Cannot create directory.");
+    panic_if(chdir(dir) != 0, "Cannot change directory.");
+
+    // old modification times, such that the records are trusted
+    sh("printf 'int f(void)\\n    return 1\\n' > a.d.c && printf 'int x\\n' > b.d.c"
+        " && touch -d '2020-01-01' a.d.c b.d.c");
+    char* files[] = {"a.d.c", "b.d.c"};
+    test_equal_i(embrace_files("out", 2, files, NULL, NULL), 0);
+    test_equal_i(manifest_lines(), 3);
+    Manifest m = read_manifest("out", NULL);
+    test_equal_i(m.len, 2);
+    ManifestEntry current[2];
+    char* outputs[] = {"out/a.c", "out/b.c"};
+    stat_files(2, files, outputs, current);
+    test_equal_i(is_unchanged(&m, &current[0]), true);
+    test_equal_i(is_unchanged(&m, &current[1]), true);
+    free_manifest(&m);
+
+    // unchanged: outputs are not written again (write_file gives a new inode)
+    long long a = inode_of("out/a.c");
+    long long b = inode_of("out/b.c");
+    test_equal_i(embrace_files("out", 2, files, NULL, NULL), 0);
+    test_equal_i(inode_of("out/a.c") == a, true);
+
+    // same content, new modification time: embraced, but the output is kept
+    sh("touch a.d.c");
+    test_equal_i(embrace_files("out", 2, files, NULL, NULL), 0);
+    test_equal_i(inode_of("out/a.c") == a, true);
+
+    // changed input, deleted output
+    sh("printf 'int y\\n' > b.d.c && rm out/a.c");
+    test_equal_i(embrace_files("out", 2, files, NULL, NULL), 0);
+    test_equal_i(inode_of("out/b.c") != b, true);
+    String s = read_file("out/b.c");
+    test_equal_s(s, "int y; \n");
+    free(s.s);
+    test_equal_i(inode_of("out/a.c") >= 0, true);
+
+    // a file that cannot be embraced is removed from the manifest
+    sh("rm b.d.c");
+    test_equal_i(embrace_files("out", 2, files, NULL, NULL), 1);
+    test_equal_i(manifest_lines(), 2);
+
+    // other options, the file is embraced again
+    EmbraceOptions format = {.format = true};
+    test_equal_i(embrace_files("out", 1, files, NULL, &format), 0);
+    s = read_file("out/a.c");
+    test_equal_s(s, "int f(void) {\n    return 1;\n}\n");
+    free(s.s);
+    test_equal_i(manifest_lines(), 2);
+    m = read_manifest("out", NULL);
+    test_equal_i(m.len, 0);
+    free_manifest(&m);
+
+    // another version
+    sh("printf 'embrace-manifest 1 0\\na.d.c\\t1\\t1\\t1\\t1\\t1\\t1\\n' > out/" MANIFEST_NAME);
+    m = read_manifest("out", NULL);
+    test_equal_i(m.len, 0);
+    free_manifest(&m);
+
+    panic_if(chdir(cwd) != 0, "Cannot change directory.");
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    sh(command);
+}
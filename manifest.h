@@ -0,0 +1,48 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef manifest_h_INCLUDED
+#define manifest_h_INCLUDED
+
+#include "util.h"
+#include "embrace.h"
+
+/*
+What a batch run knows about an input file and its output file. A size of -1
+means that the file does not exist.
+*/
+typedef struct ManifestEntry ManifestEntry;
+struct ManifestEntry {
+    char* path; // of the input file
+    long long size;
+    long long mtime; // ns
+    long long inode;
+    unsigned long long hash; // of the output, 0 if not known
+    long long output_size;
+    long long output_mtime; // ns
+};
+
+/*
+The entries of the manifest of an output directory, sorted by path.
+*/
+typedef struct Manifest Manifest;
+struct Manifest {
+    int len;
+    ManifestEntry* entries;
+    long long mtime; // of the manifest file, ns
+    String text; // the entries point into it
+};
+
+Manifest read_manifest(char* out_dir, EmbraceOptions* options);
+void free_manifest(Manifest* manifest);
+void stat_files(int count, char** files, char** outputs, /*out*/ManifestEntry* entries);
+ManifestEntry* find_entry(Manifest* manifest, char* path);
+bool is_unchanged(Manifest* manifest, ManifestEntry* current);
+unsigned long long hash_output(String output);
+bool write_manifest(char* out_dir, Manifest* manifest, int count, ManifestEntry* updates,
+        EmbraceOptions* options);
+void manifest_test(void);
+
+#endif // manifest_h_INCLUDED
@@ -0,0 +1,158 @@
+/*
+Micro-benchmarks of the kernels of embrace. Run with "make microbench", which
+prints a table and writes microbench.json for comparison between commits.
+
+Usage: microbench [--json <file>] [--seconds <seconds per benchmark>]
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#include "util.h"
+#include "embrace.h"
+#include "scan.h"
+
+// A typical piece of debraced C, repeated to get the benchmark input.
+static char* sample =
+    "#include <stdio.h>\n"
+    "#include \"util.h\"\n"
+    "\n"
+    "typedef struct Node\n"
+    "    char* name // the name\n"
+    "    struct Node* next\n"
+    "Node\n"
+    "\n"
+    "/*\n"
+    "Adds a node with the given name to the end of the list.\n"
+    "*/\n"
+    "void add(WaitList* list, char* name)\n"
+    "    require_not_null(list)\n"
+    "    require(\"not empty\", strlen(name) > 0)\n"
+    "    Node* new = new_node(name, NULL)\n"
+    "    if list->first == NULL do\n"
+    "        list->first = new\n"
+    "        list->last = new\n"
+    "    else\n"
+    "        list->last->next = new\n"
+    "        list->last = new\n"
+    "\n"
+    "int count_digits(char* s, int n)\n"
+    "    int count = 0\n"
+    "    for int i = 0; i < n && s[i] != '\\0'; i++ do\n"
+    "        if s[i] >= '0' && s[i] <= '9' do\n"
+    "            count++\n"
+    "    while count > 100 do\n"
+    "        count /= 10\n"
+    "    switch count do\n"
+    "        case 0: printf(\"none, \\\"%d\\\"\\n\", count); break\n"
+    "        default: break\n"
+    "    return count\n"
+    "end. count_digits\n"
+    "\n";
+
+#define SAMPLE_SIZE (64 * 1024)
+
+// Counts the scan events.
+static void count_event(ScanEvent* event, void* context) {
+    (*(long*)context)++;
+}
+
+// Returns copies of sample that together have about SAMPLE_SIZE characters.
+static String make_input(void) {
+    ptrdiff_t n = strlen(sample);
+    String input = new_string(SAMPLE_SIZE + n + 1);
+    while (input.len < SAMPLE_SIZE) append_cstring(&input, sample);
+    input.s[input.len] = '\0';
+    return input;
+}
+
+int main(int argc, char* argv[]) {
+    char* json_file = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_file = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            bench_seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: microbench [--json <file>] [--seconds <seconds>]\n");
+            exit(1);
+        }
+    }
+
+    String input = make_input();
+    // parse_line modifies its line, so it works on a copy of the input
+    String work = new_string(input.len + 1);
+    StringArray* lines = split_lines(input.s);
+
+    bench("next_state", input.len) {
+        int state = 0;
+        for (ptrdiff_t i = 0; i < input.len; i++) {
+            state = next_state(state, input.s[i], input.s[i + 1]);
+            if (state == 3) state = 0; // line comments end at the line end
+        }
+        bench_use(state);
+    }
+
+    String token = make_string("while");
+    bench("matches_token", input.len) {
+        int count = 0;
+        for (ptrdiff_t i = 0; i < input.len; i++) {
+            count += matches_token(input, i, token);
+        }
+        bench_use(count);
+    }
+
+    bench("indentation", input.len) {
+        ptrdiff_t sum = 0;
+        for (ptrdiff_t i = 0; i < lines->len; i++) {
+            sum += indentation(lines->a[i]);
+        }
+        bench_use(sum);
+    }
+
+    bench("split_lines", input.len) {
+        StringArray* a = split_lines(input.s);
+        bench_use(a);
+        free(a);
+    }
+
+    bench("parse_line", input.len) {
+        memcpy(work.s, input.s, input.len + 1);
+        LineInfo li = {NULL};
+        for (ptrdiff_t i = 0; i < lines->len; i++) {
+            String line = make_string2(work.s + (lines->a[i].s - input.s), lines->a[i].len);
+            li.line = &line;
+            parse_line(&li);
+        }
+        bench_use(li.state);
+    }
+
+    bench("scan_source", input.len) {
+        long events = 0;
+        scan_source(input, SCAN_ALL, count_event, &events);
+        bench_use(events);
+    }
+
+    String output = new_string(2 * input.len + 2);
+    bench("embrace_into", input.len) {
+        memcpy(work.s, input.s, input.len + 1);
+        output.len = 0;
+        bool ok = embrace_into("microbench.d.c", make_string2(work.s, input.len), &output, NULL);
+        panic_if(!ok, "Invalid benchmark input.");
+        bench_use(output.s);
+    }
+
+    bench_report(stdout, false);
+    if (json_file != NULL) {
+        FILE* f = fopen(json_file, "w");
+        panicf_if(f == NULL, "Cannot write %s", json_file);
+        bench_report(f, true);
+        fclose(f);
+    }
+
+    free(output.s);
+    free(lines);
+    free(work.s);
+    free(input.s);
+    return 0;
+}
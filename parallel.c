@@ -0,0 +1,78 @@
+/*
+Runs independent tasks on a fixed number of worker threads. The items are
+handed out one at a time, so that a few large files do not leave the other
+workers idle.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <unistd.h>
+#include "util.h"
+#include "parallel.h"
+
+typedef struct Work Work;
+struct Work {
+    pthread_mutex_t mutex;
+    int next; // next item to hand out
+    int count;
+    ParallelTask task;
+    void* context;
+};
+
+typedef struct Worker Worker;
+struct Worker {
+    pthread_t thread;
+    int id;
+    Work* work;
+};
+
+/*
+Returns the number of workers used by parallel_for. This is the number of
+online processors.
+*/
+int worker_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > 256 ? 256 : (int)n;
+}
+
+static void* work_loop(void* arg) {
+    Worker* worker = arg;
+    Work* work = worker->work;
+    for (;;) {
+        pthread_mutex_lock(&work->mutex);
+        int i = work->next++;
+        pthread_mutex_unlock(&work->mutex);
+        if (i >= work->count) break;
+        work->task(i, worker->id, work->context);
+    }
+    return NULL;
+}
+
+/*
+Calls task for each index in [0, count) and returns when all calls have
+finished. The calls are distributed over worker_count() threads.
+*/
+void parallel_for(int count, ParallelTask task, void* context) {
+    require("not negative", count >= 0);
+    require_not_null(task);
+    Work work = {PTHREAD_MUTEX_INITIALIZER, 0, count, task, context};
+    int n = worker_count();
+    if (n > count) n = count;
+    if (n <= 1) {
+        for (int i = 0; i < count; i++) task(i, 0, context);
+        return;
+    }
+    Worker workers[n];
+    for (int i = 0; i < n; i++) {
+        workers[i].id = i;
+        workers[i].work = &work;
+        panic_if(pthread_create(&workers[i].thread, NULL, work_loop, &workers[i]) != 0, 
+                "Cannot create thread.");
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+}
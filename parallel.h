@@ -0,0 +1,18 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef parallel_h_INCLUDED
+#define parallel_h_INCLUDED
+
+/*
+A task processes item index. The worker (0 <= worker < worker_count()) allows
+the task to reuse per-worker buffers.
+*/
+typedef void (*ParallelTask)(int index, int worker, void* context);
+
+int worker_count(void);
+void parallel_for(int count, ParallelTask task, void* context);
+
+#endif // parallel_h_INCLUDED
@@ -0,0 +1,306 @@
+/*
+Generates pathological inputs for embrace and checks that each one is processed
+within a time limit that is linear in its size. Run with "make pathological".
+
+The cases are deep nesting, very long lines of different kinds, many end
+markers, and many empty lines. Each case is embraced by embrace_stream in the
+default mode and in format mode with #line directives, and checked by check.
+The braced cases are debraced by debrace_into instead, e.g., a function with
+many blocks that keep their braces, each of which needs another check.
+The time limit is 1 s plus 0.1 s per MB (of input and output), which a linear
+implementation meets easily, but a quadratic one does not. Each case runs in a
+child process, whose maximum resident set size has to stay within a fixed
+budget of 256 MB (the largest inputs are about 50 MB).
+
+Usage: pathological [<case name>]
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // clock_gettime, wait4
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "util.h"
+#include "embrace.h"
+#include "debrace.h"
+
+#define MB (1000 * 1000)
+#define LEVELS 10000
+#define MEMORY_LIMIT (256 * 1024) // max. resident set size per case in KB
+
+// Appends n copies of t to str, which is grown as needed.
+static void put(/*inout*/String* str, char* t, ptrdiff_t n) {
+    ptrdiff_t m = strlen(t);
+    if (str->len + n * m + 1 > str->cap) {
+        ptrdiff_t cap = 2 * str->cap + n * m + 1;
+        char* s = realloc(str->s, cap);
+        panic_if(s == NULL, "Cannot allocate memory.");
+        str->s = s;
+        str->cap = cap;
+    }
+    for (ptrdiff_t i = 0; i < n; i++) {
+        memcpy(str->s + str->len, t, m);
+        str->len += m;
+    }
+    str->s[str->len] = '\0';
+}
+
+// 10k nested blocks, closed by a single line.
+static void deep_nesting(String* s) {
+    for (int i = 0; i < LEVELS; i++) {
+        put(s, " ", i);
+        put(s, "while x do\n", 1);
+    }
+    put(s, " ", LEVELS);
+    put(s, "x++\n", 1);
+    put(s, "int y\n", 1);
+}
+
+// 10k nested blocks, each closed by its own end marker.
+static void deep_end_markers(String* s) {
+    char line[64];
+    for (int i = 0; i < LEVELS; i++) {
+        put(s, " ", i);
+        snprintf(line, sizeof(line), "void f%d(void)\n", i);
+        put(s, line, 1);
+    }
+    put(s, " ", LEVELS);
+    put(s, "x++\n", 1);
+    for (int i = LEVELS - 1; i >= 0; i--) {
+        put(s, " ", i);
+        snprintf(line, sizeof(line), "end. f%d\n", i);
+        put(s, line, 1);
+    }
+}
+
+// 300k top-level functions, each with an end marker.
+static void many_end_markers(String* s) {
+    put(s, "int f(void)\n    return 0\nend. f\n", 300 * 1000);
+}
+
+// 1000 times 100 levels of nesting and back.
+static void sawtooth(String* s) {
+    for (int k = 0; k < 1000; k++) {
+        for (int i = 0; i < 100; i++) {
+            put(s, "  ", i);
+            put(s, "if x do\n", 1);
+        }
+        put(s, "y\n", 1);
+    }
+}
+
+// A 10 MB line of code.
+static void long_line(String* s) {
+    put(s, "x = a", 1);
+    put(s, " + a", 10 * MB / 4);
+    put(s, "\n", 1);
+}
+
+// A 10 MB line of "if" and "do" tokens.
+static void long_if_do(String* s) {
+    put(s, "if x do ", 10 * MB / 8);
+    put(s, "\n    y\n", 1);
+}
+
+// 10 MB of open brackets in one line, closed in the next.
+static void long_brackets(String* s) {
+    put(s, "x = ", 1);
+    put(s, "(", 10 * MB);
+    put(s, "\n", 1);
+    put(s, ")", 10 * MB);
+    put(s, "\n", 1);
+}
+
+// A 10 MB string literal and a 10 MB block comment.
+static void long_literal(String* s) {
+    put(s, "char* s = \"", 1);
+    put(s, "a\\\"", 10 * MB / 3);
+    put(s, "\"\n/*", 1);
+    put(s, "*", 10 * MB);
+    put(s, "\n", 1);
+    put(s, "*/\n", 1);
+}
+
+// A 10 MB indentation.
+static void long_indentation(String* s) {
+    put(s, "void f(void)\n", 1);
+    put(s, " ", 10 * MB);
+    put(s, "x++\n", 1);
+}
+
+// An end marker that is 5 MB long, which has to be found in the opening line.
+static void long_end_marker(String* s) {
+    put(s, "void f_", 1);
+    put(s, "ab", 5 * MB / 2);
+    put(s, "(void)\n    x++\nend. f_", 1);
+    put(s, "ab", 5 * MB / 2);
+    put(s, "\n", 1);
+}
+
+// 1M empty lines within a block.
+static void empty_lines(String* s) {
+    put(s, "void f(void)\n    x++\n", 1);
+    put(s, "\n", MB);
+    put(s, "    y++\n", 1);
+}
+
+// 10 MB of bytes that are not ASCII.
+static void high_bytes(String* s) {
+    put(s, "x = a", 1);
+    put(s, "\x80\xff", 5 * MB);
+    put(s, "\n", 1);
+}
+
+// A function with 20k blocks, each of which has to keep its braces.
+static void debrace_retries(String* s) {
+    char line[64];
+    put(s, "int f(int x) {\n", 1);
+    for (int i = 0; i < 20000; i++) {
+        snprintf(line, sizeof(line), "    if (x > %d) {\n", i);
+        put(s, line, 1);
+        put(s, "        if (x) {}\n        while (x) {}\n    }\n", 1);
+    }
+    put(s, "    return x;\n}\n", 1);
+}
+
+typedef struct Case Case;
+struct Case {
+    char* name;
+    void (*generate)(String* s);
+    bool braced; // braced C for debrace_into
+};
+
+static Case cases[] = {
+    {"deep_nesting", deep_nesting},
+    {"deep_end_markers", deep_end_markers},
+    {"many_end_markers", many_end_markers},
+    {"sawtooth", sawtooth},
+    {"long_line", long_line},
+    {"long_if_do", long_if_do},
+    {"long_brackets", long_brackets},
+    {"long_literal", long_literal},
+    {"long_indentation", long_indentation},
+    {"long_end_marker", long_end_marker},
+    {"empty_lines", empty_lines},
+    {"high_bytes", high_bytes},
+    {"debrace_retries", debrace_retries, true},
+};
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Embraces input with the given options. Returns the size of the output or -1.
+static long long embrace_file(FILE* in, EmbraceOptions* options) {
+    FILE* out = tmpfile();
+    panic_if(out == NULL, "Cannot create temporary file.");
+    rewind(in);
+    bool ok = embrace_stream("pathological.d.c", in, out, options);
+    long long size = ftell(out);
+    fclose(out);
+    return ok ? size : -1;
+}
+
+// Reports whether the time for bytes of input and output is within the limit.
+static bool within_limit(char* name, char* mode, double seconds, long long bytes) {
+    double limit = 1.0 + 0.1 * bytes / MB;
+    bool ok = seconds <= limit;
+    printf("%-18s %-8s %8.1f MB %8.3f s (limit %.1f s)%s\n", name, mode,
+            (double)bytes / MB, seconds, limit, ok ? "" : " TOO SLOW");
+    return ok;
+}
+
+// Runs case c and returns the number of failures.
+static int run_case(Case* c) {
+    int failures = 0;
+    String source = {NULL, 0, 0};
+    c->generate(&source);
+    if (c->braced) {
+        String output = new_string(source.len + 64);
+        double start = now();
+        debrace_into("pathological.c", source, &output);
+        double seconds = now() - start;
+        if (!within_limit(c->name, "debrace", seconds, source.len + output.len)) failures++;
+        free(output.s);
+        free(source.s);
+        return failures;
+    }
+    FILE* in = tmpfile();
+    panic_if(in == NULL, "Cannot create temporary file.");
+    panic_if(fwrite(source.s, 1, source.len, in) != source.len, "Cannot write.");
+
+    EmbraceOptions options[] = {{false, false, NULL}, {true, true, NULL}};
+    char* modes[] = {"default", "format"};
+    for (int m = 0; m < 2; m++) {
+        double start = now();
+        long long size = embrace_file(in, &options[m]);
+        double seconds = now() - start;
+        if (size < 0) {
+            printf("%-18s %-8s failed\n", c->name, modes[m]);
+            failures++;
+        } else if (!within_limit(c->name, modes[m], seconds, source.len + size)) {
+            failures++;
+        }
+    }
+
+    double start = now();
+    bool ok = check("pathological.d.c", source);
+    double seconds = now() - start;
+    if (!ok) {
+        printf("%-18s %-8s failed\n", c->name, "check");
+        failures++;
+    } else if (!within_limit(c->name, "check", seconds, source.len)) {
+        failures++;
+    }
+    fclose(in);
+    free(source.s);
+    return failures;
+}
+
+/*
+Runs case c in a child process and checks the maximum resident set size of the
+child against MEMORY_LIMIT. Returns the number of failures.
+*/
+static int run_child(Case* c) {
+    fflush(stdout);
+    pid_t pid = fork();
+    panic_if(pid < 0, "Cannot fork.");
+    if (pid == 0) {
+        int failures = run_case(c);
+        exit(failures < 100 ? failures : 100);
+    }
+    int status;
+    struct rusage usage;
+    panic_if(wait4(pid, &status, 0, &usage) != pid, "Cannot wait for child.");
+    int failures = 0;
+    if (!WIFEXITED(status)) {
+        printf("%-18s crashed\n", c->name);
+        failures++;
+    } else {
+        failures += WEXITSTATUS(status);
+    }
+    bool ok = usage.ru_maxrss <= MEMORY_LIMIT; // in KB
+    printf("%-18s %-8s %8.1f MB max. resident (limit %d MB)%s\n", c->name, "memory",
+            usage.ru_maxrss / 1024.0, MEMORY_LIMIT / 1024, ok ? "" : " TOO LARGE");
+    if (!ok) failures++;
+    return failures;
+}
+
+int main(int argc, char* argv[]) {
+    int failures = 0;
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Case* c = &cases[i];
+        if (argc > 1 && strcmp(argv[1], c->name) != 0) continue;
+        failures += run_child(c);
+    }
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
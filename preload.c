@@ -0,0 +1,341 @@
+/*
+Preload library: Serves embraced files to programs that insist on opening the
+.c files, without writing them to disk. Build with "make
+libembrace_preload.so" and run a program with
+
+    EMBRACE_PRELOAD_PATHS=/path/to/src:/other/src LD_PRELOAD=/path/to/libembrace_preload.so program
+
+When the program opens foo.c for reading (open, openat, fopen, and their
+variants) in one of the configured directories (or below), and foo.c does not
+exist, but foo.d.c does, foo.d.c is embraced in-process and the program gets a
+file descriptor of a memfd that holds the result. The result is cached per
+process by path, modification time, and size of foo.d.c. Each open gets its own
+file offset. Programs that check for foo.c with stat before opening it do not
+see it, because stat is not intercepted. Without EMBRACE_PRELOAD_PATHS, all
+opens are passed through.
+
+Only the intercepted functions are visible outside of the library (see the
+Makefile), so that the functions of embrace do not interpose on functions of
+the same name in the program.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // RTLD_NEXT, memfd_create
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "embrace.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+typedef int (*OpenFunction)(const char* path, int flags, ...);
+typedef int (*OpenatFunction)(int dirfd, const char* path, int flags, ...);
+typedef FILE* (*FopenFunction)(const char* path, const char* mode);
+
+static OpenFunction real_open;
+static OpenFunction real_open64;
+static OpenatFunction real_openat;
+static OpenatFunction real_openat64;
+static FopenFunction real_fopen;
+static FopenFunction real_fopen64;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char** prefixes; // configured directories, without trailing '/'
+static int prefix_count;
+
+// An embraced file, held by a sealed memfd.
+typedef struct CachedFile CachedFile;
+struct CachedFile {
+    char* path; // of the debraced file
+    long long mtime; // ns
+    long long size;
+    int fd;
+};
+
+static CachedFile* cache;
+static int cache_len;
+static int cache_cap;
+
+static void init(void) {
+    real_open = (OpenFunction)dlsym(RTLD_NEXT, "open");
+    real_open64 = (OpenFunction)dlsym(RTLD_NEXT, "open64");
+    real_openat = (OpenatFunction)dlsym(RTLD_NEXT, "openat");
+    real_openat64 = (OpenatFunction)dlsym(RTLD_NEXT, "openat64");
+    real_fopen = (FopenFunction)dlsym(RTLD_NEXT, "fopen");
+    real_fopen64 = (FopenFunction)dlsym(RTLD_NEXT, "fopen64");
+    if (real_open64 == NULL) real_open64 = real_open;
+    if (real_openat64 == NULL) real_openat64 = real_openat;
+    if (real_fopen64 == NULL) real_fopen64 = real_fopen;
+    char* paths = getenv("EMBRACE_PRELOAD_PATHS");
+    if (paths == NULL || *paths == '\0') return;
+    paths = strdup(paths);
+    if (paths == NULL) return;
+    int n = 1;
+    for (char* p = paths; *p != '\0'; p++) n += *p == ':';
+    prefixes = malloc(n * sizeof(char*));
+    if (prefixes == NULL) return;
+    for (char* p = strtok(paths, ":"); p != NULL; p = strtok(NULL, ":")) {
+        int len = strlen(p);
+        while (len > 1 && p[len - 1] == '/') p[--len] = '\0';
+        prefixes[prefix_count++] = p;
+    }
+}
+
+// Checks whether path is in one of the configured directories or below.
+static bool is_configured(char* path) {
+    for (int i = 0; i < prefix_count; i++) {
+        int n = strlen(prefixes[i]);
+        if (strncmp(path, prefixes[i], n) == 0 && (path[n] == '/' || strcmp(prefixes[i], "/") == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Returns the absolute path of the debraced file for path as a newly allocated
+string (foo.d.c for foo.c) if path should be served from it, otherwise NULL.
+*/
+static char* debraced_path(int dirfd, const char* path) {
+    if (prefix_count == 0 || path == NULL) return NULL;
+    int n = strlen(path);
+    if (n < 2 || strcmp(path + n - 2, ".c") != 0) return NULL;
+    if (n >= 4 && strcmp(path + n - 4, ".d.c") == 0) return NULL;
+    char dir[4096];
+    if (path[0] == '/') {
+        dir[0] = '\0';
+    } else if (dirfd == AT_FDCWD) {
+        if (getcwd(dir, sizeof(dir)) == NULL) return NULL;
+    } else {
+        char link[64];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+        ptrdiff_t len = readlink(link, dir, sizeof(dir) - 1);
+        if (len < 0) return NULL;
+        dir[len] = '\0';
+    }
+    int d = strlen(dir);
+    char* debraced = malloc(2 * (d + n + 4));
+    if (debraced == NULL) return NULL;
+    char* requested = debraced + d + n + 4;
+    sprintf(debraced, "%s%s%.*s.d.c", dir, d > 0 ? "/" : "", n - 2, path);
+    sprintf(requested, "%s%s%s", dir, d > 0 ? "/" : "", path);
+    struct stat st;
+    if (!is_configured(debraced) || stat(requested, &st) == 0 || errno != ENOENT
+            || stat(debraced, &st) != 0 || !S_ISREG(st.st_mode)) {
+        free(debraced);
+        return NULL;
+    }
+    // the requested file does not exist, but the debraced one does
+    return debraced;
+}
+
+// Reads the file with the real open, such that the library does not recurse.
+static bool read_source(char* path, /*out*/String* source) {
+    int fd = real_open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    *source = (String){NULL, 0, 0};
+    ptrdiff_t n;
+    do {
+        if (source->cap - source->len < 65536 + 1) {
+            ptrdiff_t cap = 2 * source->cap + 65536 + 1;
+            char* s = realloc(source->s, cap);
+            if (s == NULL) {
+                n = -1;
+                break;
+            }
+            source->s = s;
+            source->cap = cap;
+        }
+        n = read(fd, source->s + source->len, source->cap - source->len - 1);
+        if (n > 0) source->len += n;
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    close(fd);
+    if (n != 0) {
+        free(source->s);
+        return false;
+    }
+    source->s[source->len] = '\0';
+    return true;
+}
+
+// Embraces the file into a new sealed memfd. Returns the memfd or -1.
+static int embrace_to_memfd(char* path) {
+    String source;
+    if (!read_source(path, &source)) return -1;
+    String output = {NULL, 0, 0};
+    bool ok = embrace_into(path, source, &output, NULL);
+    free(source.s);
+    int fd = -1;
+    if (ok) {
+        char* name = strrchr(path, '/');
+        fd = memfd_create(name != NULL ? name + 1 : path, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    }
+    ptrdiff_t done = 0;
+    while (fd >= 0 && done < output.len) {
+        ptrdiff_t n = write(fd, output.s + done, output.len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            fd = -1;
+        } else {
+            done += n;
+        }
+    }
+    free(output.s);
+    if (fd >= 0) fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return fd;
+}
+
+// Opens the memfd again, which gives a file descriptor with its own offset.
+static int reopen(int memfd, int flags) {
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", memfd);
+    return real_open(link, (flags & ~(O_CREAT | O_TRUNC | O_EXCL)) | O_RDONLY);
+}
+
+/*
+Returns a file descriptor for the embraced version of the debraced file, from
+the cache if the file did not change. Returns -1 and sets errno to EIO if the
+file cannot be embraced.
+*/
+static int serve(char* debraced, int flags) {
+    struct stat st;
+    if (stat(debraced, &st) != 0) return -1;
+    long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    pthread_mutex_lock(&cache_mutex);
+    CachedFile* c = NULL;
+    for (int i = 0; i < cache_len; i++) {
+        if (strcmp(cache[i].path, debraced) == 0) c = &cache[i];
+    }
+    int fd = -1;
+    if (c != NULL && c->mtime == mtime && c->size == st.st_size) {
+        // the program may have closed the memfd, e.g., when it closed all files
+        fd = reopen(c->fd, flags);
+    }
+    if (fd < 0) {
+        int memfd = embrace_to_memfd(debraced);
+        if (memfd >= 0 && c == NULL && cache_len >= cache_cap) {
+            int cap = cache_cap == 0 ? 16 : 2 * cache_cap;
+            CachedFile* a = realloc(cache, cap * sizeof(CachedFile));
+            if (a != NULL) {
+                cache = a;
+                cache_cap = cap;
+            }
+        }
+        if (memfd >= 0 && c == NULL && cache_len < cache_cap) {
+            c = &cache[cache_len++];
+            c->path = strdup(debraced);
+            c->fd = -1;
+        }
+        if (memfd >= 0 && c != NULL && c->path != NULL) {
+            if (c->fd >= 0) close(c->fd);
+            *c = (CachedFile){c->path, mtime, st.st_size, memfd};
+            fd = reopen(memfd, flags);
+        } else if (memfd >= 0) {
+            fd = reopen(memfd, flags);
+            close(memfd);
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (fd < 0) errno = EIO;
+    return fd;
+}
+
+static bool is_read_only(int flags) {
+    return (flags & O_ACCMODE) == O_RDONLY && (flags & (O_CREAT | O_TRUNC)) == 0;
+}
+
+// The real functions are only known after init.
+static int open_at(OpenatFunction* real, int dirfd, const char* path, int flags, mode_t mode) {
+    pthread_once(&init_once, init);
+    char* debraced = is_read_only(flags) ? debraced_path(dirfd, path) : NULL;
+    if (debraced == NULL) return (*real)(dirfd, path, flags, mode);
+    int fd = serve(debraced, flags);
+    free(debraced);
+    return fd;
+}
+
+static int open_cwd(OpenFunction* real, const char* path, int flags, mode_t mode) {
+    pthread_once(&init_once, init);
+    char* debraced = is_read_only(flags) ? debraced_path(AT_FDCWD, path) : NULL;
+    if (debraced == NULL) return (*real)(path, flags, mode);
+    int fd = serve(debraced, flags);
+    free(debraced);
+    return fd;
+}
+
+static FILE* open_file(FopenFunction* real, const char* path, const char* mode) {
+    pthread_once(&init_once, init);
+    bool read_only = mode != NULL && mode[0] == 'r' && strchr(mode, '+') == NULL;
+    char* debraced = read_only ? debraced_path(AT_FDCWD, path) : NULL;
+    if (debraced == NULL) return (*real)(path, mode);
+    int fd = serve(debraced, O_RDONLY | (strchr(mode, 'e') != NULL ? O_CLOEXEC : 0));
+    free(debraced);
+    if (fd < 0) return NULL;
+    FILE* f = fdopen(fd, "r");
+    if (f == NULL) close(fd);
+    return f;
+}
+
+// The mode argument is only present with O_CREAT or O_TMPFILE.
+#define MODE_ARG(flags) \
+    mode_t mode = 0; \
+    if ((flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE) { \
+        va_list args; \
+        va_start(args, flags); \
+        mode = va_arg(args, mode_t); \
+        va_end(args); \
+    }
+
+EXPORT int open(const char* path, int flags, ...) {
+    MODE_ARG(flags)
+    return open_cwd(&real_open, path, flags, mode);
+}
+
+EXPORT int open64(const char* path, int flags, ...) {
+    MODE_ARG(flags)
+    return open_cwd(&real_open64, path, flags, mode);
+}
+
+EXPORT int __open_2(const char* path, int flags) {
+    return open_cwd(&real_open, path, flags, 0);
+}
+
+EXPORT int __open64_2(const char* path, int flags) {
+    return open_cwd(&real_open64, path, flags, 0);
+}
+
+EXPORT int openat(int dirfd, const char* path, int flags, ...) {
+    MODE_ARG(flags)
+    return open_at(&real_openat, dirfd, path, flags, mode);
+}
+
+EXPORT int openat64(int dirfd, const char* path, int flags, ...) {
+    MODE_ARG(flags)
+    return open_at(&real_openat64, dirfd, path, flags, mode);
+}
+
+EXPORT int __openat_2(int dirfd, const char* path, int flags) {
+    return open_at(&real_openat, dirfd, path, flags, 0);
+}
+
+EXPORT int __openat64_2(int dirfd, const char* path, int flags) {
+    return open_at(&real_openat64, dirfd, path, flags, 0);
+}
+
+EXPORT FILE* fopen(const char* path, const char* mode) {
+    return open_file(&real_fopen, path, mode);
+}
+
+EXPORT FILE* fopen64(const char* path, const char* mode) {
+    return open_file(&real_fopen64, path, mode);
+}
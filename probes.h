@@ -0,0 +1,61 @@
+/*
+USDT (user-level statically defined tracing) probes in the hot paths of
+embrace. A tracer such as bpftrace or perf can attach to them in a running
+process, e.g.:
+
+    bpftrace -e 'usdt:./embrace:embrace:flush { @bytes = hist(arg0); }'
+
+When no tracer is attached, each probe is a single nop instruction. Its
+arguments are values that are at hand anyway. Where <sys/sdt.h> is not
+available (systemtap-sdt-dev on Debian, systemtap-sdt-devel on Fedora), the
+probes compile to nothing.
+
+The probe names and arguments are a stable interface. Probes are only added,
+never changed or removed. Provider "embrace":
+
+    file__start(char* filename)
+        embrace_begin starts a file
+    file__end(char* filename, int lines, ptrdiff_t input_bytes,
+            ptrdiff_t output_bytes, int ok)
+        embrace_end finishes a file; input bytes count one separator per line;
+        ok is 0 if the file is not valid debraced C
+    indent__push(int line, ptrdiff_t indent, ptrdiff_t depth)
+        line opens a block; indent of the line before it (the block header);
+        depth after the push
+    indent__pop(int line, ptrdiff_t indent, ptrdiff_t depth)
+        line (0 at the end of the file) closes a block; indent of its header;
+        depth after the pop
+    end__marker(int line, int matches)
+        an end marker is checked against its block header
+    diagnostic(char* filename, int line, char* message)
+        check_errors finds an error (also if errors are not reported)
+    flush(ptrdiff_t bytes, ptrdiff_t pending)
+        embrace_flush writes bytes; pending bytes stay in the output buffer
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef probes_h_INCLUDED
+#define probes_h_INCLUDED
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SDT
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE1(name, a) STAP_PROBE1(embrace, name, a)
+#define PROBE2(name, a, b) STAP_PROBE2(embrace, name, a, b)
+#define PROBE3(name, a, b, c) STAP_PROBE3(embrace, name, a, b, c)
+#define PROBE5(name, a, b, c, d, f) STAP_PROBE5(embrace, name, a, b, c, d, f)
+#else
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE3(name, a, b, c) ((void)0)
+#define PROBE5(name, a, b, c, d, f) ((void)0)
+#endif
+
+#endif // probes_h_INCLUDED
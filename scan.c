@@ -0,0 +1,228 @@
+/*
+A push-style scanner of debraced C for tools that analyze the code (linters,
+tag generators, metrics) in a single pass per file. It uses the lexer of embrace
+(next_state) and reports line starts with their indentation, preprocessor
+lines, brackets, keywords, end markers, comments, literals, and the changes of
+the lexer state as events to a handler. Only the selected kinds of events are
+reported, so that the cost of the scan is mostly independent of the handler.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#include "util.h"
+#include "embrace.h"
+#include "scan.h"
+
+static const String scan_token_end = {"end.", 4};
+
+static const String keywords[] = {
+    {"auto", 4}, {"break", 5}, {"case", 4}, {"char", 4}, {"const", 5},
+    {"continue", 8}, {"default", 7}, {"do", 2}, {"double", 6}, {"else", 4},
+    {"enum", 4}, {"extern", 6}, {"float", 5}, {"for", 3}, {"goto", 4}, {"if", 2},
+    {"inline", 6}, {"int", 3}, {"long", 4}, {"register", 8}, {"restrict", 8},
+    {"return", 6}, {"short", 5}, {"signed", 6}, {"sizeof", 6}, {"static", 6},
+    {"struct", 6}, {"switch", 6}, {"typedef", 7}, {"union", 5}, {"unsigned", 8},
+    {"void", 4}, {"volatile", 8}, {"while", 5}, {"_Bool", 5}, {"_Complex", 8},
+    {"_Imaginary", 10},
+};
+
+// Checks if the identifier s[0..n-1] is a C99 keyword.
+static bool is_keyword(char* s, ptrdiff_t n) {
+    if (n < 2 || n > 10 || !(islower((unsigned char)s[0]) || s[0] == '_')) return false;
+    for (int k = 0; k < (int)(sizeof(keywords) / sizeof(keywords[0])); k++) {
+        if (keywords[k].len == n && keywords[k].s[0] == s[0] &&
+                memcmp(keywords[k].s, s, n) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reports an event of the given kind, if it has been selected.
+static void emit_event(Scanner* s, ScanKind kind, ptrdiff_t column, String text, int state) {
+    if ((s->kinds & kind) == 0) return;
+    ScanEvent event = {kind, s->line_number, column, text, s->depth, state};
+    s->handler(&event, s->context);
+}
+
+// Reports line[column..column+len-1] as an event of the given kind.
+static void emit(Scanner* s, ScanKind kind, String line, ptrdiff_t column, ptrdiff_t len,
+        int state) {
+    emit_event(s, kind, column, make_string2(line.s + column, len), state);
+}
+
+/*
+Starts scanning a file. The handler is called with context for each event of
+the given kinds (e.g., SCAN_LINE | SCAN_KEYWORD, or SCAN_ALL).
+*/
+void scan_begin(/*out*/Scanner* s, int kinds, ScanHandler handler, void* context) {
+    require_not_null(s);
+    require_not_null(handler);
+    memset(s, 0, sizeof(Scanner));
+    s->handler = handler;
+    s->context = context;
+    s->kinds = kinds;
+}
+
+/*
+Scans the next line of the file. The character after the end of the line has to
+be its separator (or '\0'), as for embrace_line. The line is not modified. As in
+parse_line, line comments and literals end at the end of the line, while block
+comments and line continuations carry over to the next line.
+*/
+void scan_line(/*inout*/Scanner* s, String line) {
+    require_not_null(s);
+    require_not_null(line.s);
+    s->line_number++;
+    int state = s->state;
+    // a continuation line of a preprocessor line is a preprocessor line as well
+    bool preprocessor_line = s->preprocessor_line && state == 5;
+    if (state != 4) state = 0;
+    ptrdiff_t first = line.len - trim_left(line).len; // after spaces and tabs
+    emit_event(s, SCAN_LINE, indentation(line), line, state);
+    if (state == 0 && first < line.len) {
+        char c = line.s[first];
+        if (c == '*') { // public marker, as in "* #define"
+            ptrdiff_t i = first + 1;
+            while (i < line.len && (line.s[i] == ' ' || line.s[i] == '\t')) i++;
+            c = i < line.len ? line.s[i] : c;
+        }
+        preprocessor_line = preprocessor_line || c == '#';
+        if (matches_token(line, first, scan_token_end)) {
+            ptrdiff_t i = first + scan_token_end.len;
+            ptrdiff_t j = i;
+            while (j < line.len && !(line.s[j] == '/' &&
+                    (line.s[j + 1] == '/' || line.s[j + 1] == '*'))) {
+                j++;
+            }
+            String marker = trim(make_string2(line.s + i, j - i));
+            emit(s, SCAN_END_MARKER, line, marker.len > 0 ? marker.s - line.s : i,
+                    marker.len, state);
+        }
+    }
+    if (preprocessor_line) emit(s, SCAN_PREPROCESSOR, line, first, line.len - first, state);
+
+    ptrdiff_t start = first; // start of the current comment or literal
+    for (ptrdiff_t i = first; i < line.len; i++) {
+        char c = line.s[i];
+        char d = line.s[i + 1];
+        int next = next_state(state, c, d);
+        if (next != state) {
+            int prev = state;
+            state = next;
+            if (prev == 0) start = i;
+            emit(s, SCAN_STATE, line, i, 1, state);
+            if (state == 0 && prev == 4) {
+                emit(s, SCAN_COMMENT, line, start, i + 2 - start, state);
+            } else if (state == 0) {
+                emit(s, SCAN_LITERAL, line, start, i + 1 - start, state);
+            } else if (state == 3) {
+                emit(s, SCAN_COMMENT, line, i, line.len - i, state);
+                state = 0;
+                break;
+            }
+        } else if (state == 0) {
+            if (c == '(' || c == '[' || c == '{') {
+                s->depth++;
+                emit(s, SCAN_OPEN, line, i, 1, state);
+            } else if (c == ')' || c == ']' || c == '}') {
+                s->depth--;
+                emit(s, SCAN_CLOSE, line, i, 1, state);
+            } else if (is_identifier_char(c)) {
+                // identifier characters do not change the state, skip to the end
+                ptrdiff_t j = i + 1;
+                while (j < line.len && is_identifier_char(line.s[j])) j++;
+                if ((s->kinds & SCAN_KEYWORD) && is_keyword(line.s + i, j - i)) {
+                    emit(s, SCAN_KEYWORD, line, i, j - i, state);
+                }
+                i = j - 1;
+            }
+        }
+    }
+    if (state == 4 && start < line.len) {
+        emit(s, SCAN_COMMENT, line, start, line.len - start, state);
+    } else if (state != 0 && state != 4 && state != 5) {
+        emit(s, SCAN_LITERAL, line, start, line.len - start, state); // unterminated
+    }
+    emit(s, SCAN_LINE_END, line, line.len, 0, state);
+    s->state = state;
+    s->preprocessor_line = preprocessor_line;
+}
+
+/*
+Scans source, which has to be terminated by '\0' (as by read_file), line by
+line.
+*/
+void scan_source(String source, int kinds, ScanHandler handler, void* context) {
+    require_not_null(source.s);
+    Scanner s;
+    scan_begin(&s, kinds, handler, context);
+    char* end = source.s + source.len;
+    for (char* p = source.s; p < end; ) {
+        char* eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        scan_line(&s, make_string2(p, eol - p));
+        p = eol + 1;
+    }
+}
+
+// Appends a compact description of each event to the String in context.
+static void describe_event(ScanEvent* event, void* context) {
+    String* out = context;
+    char buf[32];
+    char* names = "LlPockmC\"s";
+    int k = 0;
+    while ((1 << k) != event->kind) k++;
+    snprintf(buf, sizeof(buf), "%d:%td%c", event->line, event->column, names[k]);
+    append_cstring(out, buf);
+    append_string(out, event->text);
+    snprintf(buf, sizeof(buf), "/%d/%d ", event->depth, event->state);
+    append_cstring(out, buf);
+}
+
+static String describe(char* source, int kinds) {
+    String out = new_string(1024);
+    scan_source(make_string(source), kinds, describe_event, &out);
+    if (out.len > 0) out.len--;
+    out.s[out.len] = '\0';
+    return out;
+}
+
+void scan_test(void) {
+    String s;
+    s = describe("int f(void)\n    return 0\n", SCAN_ALL);
+    test_equal_s(s, "1:0Lint f(void)/0/0 1:0kint/0/0 1:5o(/1/0 1:6kvoid/1/0 1:10c)/0/0 "
+            "1:11l/0/0 2:4L    return 0/0/0 2:4kreturn/0/0 2:12l/0/0");
+    free(s.s);
+
+    // keywords only as whole identifiers, not in literals or comments
+    s = describe("if x do // if\n    ifx = \"while\"", SCAN_KEYWORD | SCAN_COMMENT | SCAN_LITERAL);
+    test_equal_s(s, "1:0kif/0/0 1:5kdo/0/0 1:8C// if/0/3 2:10\"\"while\"/0/0");
+    free(s.s);
+
+    // block comments across lines and state changes
+    s = describe("a /* b\n  c */ d", SCAN_COMMENT | SCAN_STATE);
+    test_equal_s(s, "1:2s//0/4 1:2C/* b/0/4 2:4s*/0/0 2:2Cc *//0/0");
+    free(s.s);
+
+    // brackets that continue on the next line, character literals
+    s = describe("f(x,\n  '(')\n", SCAN_OPEN | SCAN_CLOSE | SCAN_LITERAL | SCAN_LINE);
+    test_equal_s(s, "1:0Lf(x,/0/0 1:1o(/1/0 2:2L  '(')/1/0 2:2\"'('/1/0 2:5c)/0/0");
+    free(s.s);
+
+    // preprocessor lines with continuations and the public marker
+    s = describe("#define A \\\n    1\nx\n* #include <a.h>", SCAN_PREPROCESSOR);
+    test_equal_s(s, "1:0P#define A \\/0/0 2:4P1/0/0 4:0P* #include <a.h>/0/0");
+    free(s.s);
+
+    // end markers
+    s = describe("    end. if // c\n    end.\nend.x", SCAN_END_MARKER);
+    test_equal_s(s, "1:9mif/0/0 2:8m/0/0");
+    free(s.s);
+
+    // tabs for indentation, unterminated literal
+    s = describe("\tx\n\"abc", SCAN_LINE | SCAN_LITERAL);
+    test_equal_s(s, "1:-1L\tx/0/0 2:0L\"abc/0/0 2:0\"\"abc/0/1");
+    free(s.s);
+}
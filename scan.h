@@ -0,0 +1,70 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef scan_h_INCLUDED
+#define scan_h_INCLUDED
+
+#include "util.h"
+
+/*
+The kinds of scan events. They are bit flags, so that a set of kinds can be
+selected with |.
+*/
+typedef enum ScanKind ScanKind;
+enum ScanKind {
+    SCAN_LINE = 1, // text is the line, column its indentation (-1 for a tab)
+    SCAN_LINE_END = 2, // end of a line
+    SCAN_PREPROCESSOR = 4, // line (or continuation line) of a directive
+    SCAN_OPEN = 8, // ( [ {
+    SCAN_CLOSE = 16, // ) ] }
+    SCAN_KEYWORD = 32, // a C keyword
+    SCAN_END_MARKER = 64, // "end.", text is the marker after it (may be empty)
+    SCAN_COMMENT = 128, // the part of a comment that is on this line
+    SCAN_LITERAL = 256, // the part of a string or character literal on this line
+    SCAN_STATE = 512, // the lexer state changed (see next_state)
+    SCAN_ALL = 1023,
+};
+
+/*
+An event of the scanner. Text points into the scanned line and is only valid
+during the call of the handler. Column is the byte offset of text in the line
+(except for SCAN_LINE). Depth is the bracket depth (parentheses,
+brackets, and braces) after the event, counted across lines like
+LineInfo.braces. State is the lexer state after the event (see next_state).
+*/
+typedef struct ScanEvent ScanEvent;
+struct ScanEvent {
+    ScanKind kind;
+    int line; // line number, starting at 1
+    ptrdiff_t column;
+    String text;
+    int depth;
+    int state;
+};
+
+typedef void (*ScanHandler)(ScanEvent* event, void* context);
+
+/*
+The state of scanning a file line by line. It recognizes the same strings,
+comments, brackets, preprocessor lines, and end markers as parse_line, without
+changing the lines.
+*/
+typedef struct Scanner Scanner;
+struct Scanner {
+    ScanHandler handler;
+    void* context;
+    int kinds; // the kinds of events that are reported
+    int line_number; // number of lines scanned
+    int state; // lexer state at the end of the last line
+    int depth;
+    bool preprocessor_line; // the last line is a preprocessor line
+};
+
+void scan_begin(/*out*/Scanner* s, int kinds, ScanHandler handler, void* context);
+void scan_line(/*inout*/Scanner* s, String line);
+void scan_source(String source, int kinds, ScanHandler handler, void* context);
+void scan_test(void);
+
+#endif // scan_h_INCLUDED
@@ -0,0 +1,278 @@
+/*
+Collects the functions, structs, unions, and typedefs defined at the top level
+of a debraced file while it is being embraced. The tags can be written in ctags
+format or as JSON.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#include "util.h"
+#include "embrace.h"
+#include "tags.h"
+
+static const String tag_token_struct = {"struct", 6};
+static const String tag_token_union = {"union", 5};
+
+Tags new_tags(void) {
+    return (Tags){NULL, 0, 0, -1, false, false, 0};
+}
+
+void free_tags(Tags* tags) {
+    require_not_null(tags);
+    for (int i = 0; i < tags->len; i++) {
+        free(tags->a[i].name.s);
+    }
+    free(tags->a);
+    *tags = new_tags();
+}
+
+// Returns the index of token in line or -1.
+static ptrdiff_t find_token(String line, String token) {
+    for (ptrdiff_t i = 0; i + token.len <= line.len; i++) {
+        if (line.s[i] == token.s[0] && matches_token(line, i, token)) return i;
+    }
+    return -1;
+}
+
+// Returns the identifier that starts at or after index i.
+static String identifier_after(String line, ptrdiff_t i) {
+    while (i < line.len && (line.s[i] == ' ' || line.s[i] == '*')) i++;
+    ptrdiff_t j = i;
+    while (j < line.len && is_identifier_char(line.s[j])) j++;
+    return make_string2(line.s + i, j - i);
+}
+
+// Returns the identifier that ends right before index i (ignoring spaces).
+static String identifier_before(String line, ptrdiff_t i) {
+    while (i > 0 && line.s[i - 1] == ' ') i--;
+    ptrdiff_t j = i;
+    while (j > 0 && is_identifier_char(line.s[j - 1])) j--;
+    return make_string2(line.s + j, i - j);
+}
+
+// Returns the first identifier of line.
+static String first_identifier(String line) {
+    ptrdiff_t i = 0;
+    while (i < line.len && !is_identifier_char(line.s[i])) i++;
+    return identifier_after(line, i);
+}
+
+/*
+Returns the name declared by a one-line typedef, e.g., Length in
+"typedef int Length", Fn in "typedef void (*Fn)(int)", Row in 
+"typedef int Row[10]".
+*/
+static String typedef_name(String line) {
+    ptrdiff_t i = index_of(line, make_string("(*"));
+    if (i >= 0) return identifier_after(line, i + 2);
+    i = index_of(line, make_string("["));
+    if (i >= 0) return identifier_before(line, i);
+    i = line.len;
+    while (i > 0 && (line.s[i - 1] == ';' || line.s[i - 1] == ' ')) i--;
+    return identifier_before(line, i);
+}
+
+static void add_tag(Tags* tags, char kind, String name, int line, int end_line) {
+    if (tags->len >= tags->cap) {
+        tags->cap = tags->cap == 0 ? 16 : 2 * tags->cap;
+        tags->a = realloc(tags->a, tags->cap * sizeof(Tag));
+        panic_if(tags->a == NULL, "Cannot allocate memory.");
+    }
+    // copy the name, since the line may be a reused buffer
+    char* s = xmalloc(name.len + 1);
+    memcpy(s, name.s, name.len);
+    s[name.len] = '\0';
+    tags->a[tags->len++] = (Tag){kind, make_string2(s, name.len), line, end_line};
+}
+
+/*
+Called when a top-level block is opened. The statement that opens the block
+starts with first_line at line_number, opening is its last line.
+*/
+void tag_open(Tags* tags, String first_line, int line_number, LineInfo* opening) {
+    require_not_null(tags);
+    require_not_null(opening);
+    tags->open = -1;
+    tags->typedef_open = false;
+    if (opening->line == NULL || opening->preprocessor_line) return;
+    if (opening->struct_or_union_token) {
+        ptrdiff_t i = find_token(first_line, tag_token_struct);
+        char kind = 's';
+        if (i < 0) {
+            i = find_token(first_line, tag_token_union);
+            kind = 'u';
+        }
+        tags->typedef_open = opening->typedef_token;
+        tags->typedef_line = line_number;
+        String name = i < 0 ? make_string2(first_line.s, 0) : 
+            identifier_after(first_line, i + (kind == 's' ? 6 : 5));
+        if (name.len > 0) {
+            tags->open = tags->len;
+            add_tag(tags, kind, name, line_number, line_number);
+        }
+    } else if (!opening->typedef_token) {
+        ptrdiff_t i = index_of(first_line, make_string("("));
+        String name = i < 0 ? make_string2(first_line.s, 0) : identifier_before(first_line, i);
+        if (name.len > 0) {
+            tags->open = tags->len;
+            add_tag(tags, 'f', name, line_number, line_number);
+        }
+    }
+}
+
+/*
+Called when the open top-level block is closed. The block ends at end_line.
+Closing is the line at line_number that follows the block or NULL at the end
+of the file.
+*/
+void tag_close(Tags* tags, LineInfo* closing, int line_number, int end_line) {
+    require_not_null(tags);
+    if (tags->open >= 0) {
+        tags->a[tags->open].end_line = end_line;
+        tags->open = -1;
+    }
+    if (tags->typedef_open && closing != NULL) {
+        if (closing->end_marker) {
+            tags->typedef_name_pending = true;
+        } else {
+            String name = first_identifier(*closing->line);
+            if (name.len > 0) add_tag(tags, 't', name, tags->typedef_line, line_number);
+        }
+    }
+    tags->typedef_open = false;
+}
+
+/*
+Called for each top-level statement that does not open a block. The previous
+statement starts with first_line at line_number, prev is its last line. Li is
+the line at li_line_number that starts the next statement or NULL at the end of
+the file.
+*/
+void tag_statement(Tags* tags, String first_line, int line_number, LineInfo* prev, 
+        LineInfo* li, int li_line_number) {
+    require_not_null(tags);
+    require_not_null(prev);
+    if (prev->line != NULL && prev->typedef_token && !prev->preprocessor_line && 
+            !prev->end_marker && first_line.s == prev->line->s) {
+        String name = typedef_name(*prev->line);
+        if (name.len > 0) add_tag(tags, 't', name, line_number, line_number);
+    }
+    if (tags->typedef_name_pending && li != NULL) {
+        tags->typedef_name_pending = false;
+        String name = first_identifier(*li->line);
+        if (name.len > 0) add_tag(tags, 't', name, tags->typedef_line, li_line_number);
+    }
+}
+
+static int compare_tags(const void* a, const void* b) {
+    const Tag* s = a;
+    const Tag* t = b;
+    ptrdiff_t n = s->name.len < t->name.len ? s->name.len : t->name.len;
+    int c = memcmp(s->name.s, t->name.s, n);
+    if (c != 0) return c;
+    if (s->name.len != t->name.len) return s->name.len < t->name.len ? -1 : 1;
+    return s->line - t->line;
+}
+
+/*
+Writes the tags in (sorted) extended ctags format, including the line and end
+fields.
+*/
+void write_ctags(FILE* f, char* filename, Tags* tags) {
+    require_not_null(f);
+    require_not_null(filename);
+    require_not_null(tags);
+    qsort(tags->a, tags->len, sizeof(Tag), compare_tags);
+    fprintf(f, "!_TAG_FILE_FORMAT\t2\t/extended format/\n");
+    fprintf(f, "!_TAG_FILE_SORTED\t1\t/0=unsorted, 1=sorted, 2=foldcase/\n");
+    for (int i = 0; i < tags->len; i++) {
+        Tag* t = &tags->a[i];
+        fprintf(f, "%.*s\t%s\t%d;\"\t%c\tline:%d\tend:%d\n", 
+                (int)t->name.len, t->name.s, filename, t->line, t->kind, t->line, t->end_line);
+    }
+}
+
+static void write_json_string(FILE* f, char* s) {
+    fputc('"', f);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static char* kind_name(char kind) {
+    switch (kind) {
+        case 'f': return "function";
+        case 's': return "struct";
+        case 'u': return "union";
+        case 't': return "typedef";
+        default: return "unknown";
+    }
+}
+
+/*
+Writes the tags as a JSON array of objects with name, kind, file, line, and end
+fields, in the order of their definition.
+*/
+void write_json_tags(FILE* f, char* filename, Tags* tags) {
+    require_not_null(f);
+    require_not_null(filename);
+    require_not_null(tags);
+    fprintf(f, "[");
+    for (int i = 0; i < tags->len; i++) {
+        Tag* t = &tags->a[i];
+        fprintf(f, "%s\n  {\"name\": \"%.*s\", \"kind\": \"%s\", \"file\": ", 
+                i == 0 ? "" : ",", (int)t->name.len, t->name.s, kind_name(t->kind));
+        write_json_string(f, filename);
+        fprintf(f, ", \"line\": %d, \"end\": %d}", t->line, t->end_line);
+    }
+    fprintf(f, "\n]\n");
+}
+
+void tags_test(void) {
+    char source[] = 
+        "typedef int Length\n"
+        "typedef void (*Fn)(int)\n"
+        "\n"
+        "typedef struct Point\n"
+        "    int x, y\n"
+        "Point\n"
+        "\n"
+        "union Value\n"
+        "    int i\n"
+        "    double d\n"
+        "end. Value\n"
+        "\n"
+        "int main(int argc,\n"
+        "        char* argv[])\n"
+        "    if argc > 1 do\n"
+        "        return 1\n"
+        "    return 0\n";
+    String output = {NULL, 0, 0};
+    Tags tags = new_tags();
+    EmbraceOptions options = {.tags = &tags};
+    test_equal_i(embrace_into("test", make_string(source), &output, &options), true);
+    test_equal_i(tags.len, 6);
+    test_equal_s(tags.a[0].name, "Length");
+    test_equal_i(tags.a[0].kind, 't');
+    test_equal_s(tags.a[1].name, "Fn");
+    test_equal_s(tags.a[2].name, "Point");
+    test_equal_i(tags.a[2].kind, 's');
+    test_equal_i(tags.a[2].line, 4);
+    test_equal_i(tags.a[2].end_line, 5);
+    test_equal_s(tags.a[3].name, "Point");
+    test_equal_i(tags.a[3].kind, 't');
+    test_equal_i(tags.a[3].end_line, 6);
+    test_equal_s(tags.a[4].name, "Value");
+    test_equal_i(tags.a[4].kind, 'u');
+    test_equal_i(tags.a[4].line, 8);
+    test_equal_i(tags.a[4].end_line, 11);
+    test_equal_s(tags.a[5].name, "main");
+    test_equal_i(tags.a[5].kind, 'f');
+    test_equal_i(tags.a[5].line, 13);
+    test_equal_i(tags.a[5].end_line, 17);
+    free_tags(&tags);
+    free(output.s);
+}
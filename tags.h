@@ -0,0 +1,48 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef tags_h_INCLUDED
+#define tags_h_INCLUDED
+
+#include "util.h"
+#include "embrace.h"
+
+/*
+A function, struct, union, or typedef defined at the top level of a file.
+*/
+typedef struct Tag Tag;
+struct Tag {
+    char kind; // 'f' function, 's' struct, 'u' union, 't' typedef
+    String name;
+    int line; // first line
+    int end_line; // last line
+};
+
+/*
+The tags of a file, collected by embrace_into while embracing the file.
+*/
+struct Tags {
+    Tag* a;
+    int len;
+    int cap;
+    int open; // index of the tag of the open top-level block or -1
+    bool typedef_open; // the open block is the body of a typedef
+    bool typedef_name_pending; // typedef name follows on next top-level line
+    int typedef_line; // first line of pending typedef
+};
+
+Tags new_tags(void);
+void free_tags(Tags* tags);
+
+void tag_open(Tags* tags, String first_line, int line_number, LineInfo* opening);
+void tag_close(Tags* tags, LineInfo* closing, int line_number, int end_line);
+void tag_statement(Tags* tags, String first_line, int line_number, LineInfo* prev, 
+        LineInfo* li, int li_line_number);
+
+void write_ctags(FILE* f, char* filename, Tags* tags);
+void write_json_tags(FILE* f, char* filename, Tags* tags);
+void tags_test(void);
+
+#endif // tags_h_INCLUDED
@@ -0,0 +1,460 @@
+/*
+Tar mode: Reads a tar archive and writes a tar archive, in which each regular
+file foo.d.c is replaced by the embraced foo.c. All other entries (headers,
+directories, links, ...) are copied unchanged. The entries are read in
+batches, the files of a batch are embraced in parallel, and the entries are
+written in the order of the input archive. A whole tree can thus be embraced
+as one sequential stream, without creating any files.
+
+Reads POSIX ustar archives, including pax extended headers and GNU long names,
+as written by GNU tar and bsdtar. The embraced files get POSIX ustar headers,
+with a pax path record if the name does not fit. Other pax records (e.g.,
+mtime with fractions of seconds) are kept.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE // mkdtemp, chdir
+#include <unistd.h>
+#include "util.h"
+#include "embrace.h"
+#include "parallel.h"
+#include "tar.h"
+
+#define BLOCK 512
+#define RECORD (20 * BLOCK) // the output is padded to a multiple of this
+#define BATCH_SIZE (64 * 1024 * 1024)
+#define BATCH_ENTRIES 4096
+
+// offsets of the fields of a header block
+#define NAME 0
+#define MODE 100
+#define SIZE 124
+#define MTIME 136
+#define CHECKSUM 148
+#define TYPE 156
+#define MAGIC 257
+#define UNAME 265
+#define PREFIX 345
+
+/*
+An entry of the archive. Raw holds the blocks as read: the extended headers,
+the header, and the padded content. Only the embraced output of a debraced file
+is not written from raw.
+*/
+typedef struct TarEntry TarEntry;
+struct TarEntry {
+    String raw;
+    char* name; // full name, NULL for the end of the archive
+    char* header; // points into raw
+    String content; // points into raw, followed by '\0'
+    String pax; // pax records of the entry except path and size
+    bool source; // regular file *.d.c
+    String output; // embraced content
+    bool ok;
+};
+
+static bool is_zero_block(char* b) {
+    for (int i = 0; i < BLOCK; i++) {
+        if (b[i] != '\0') return false;
+    }
+    return true;
+}
+
+// Parses a numeric field: octal, or big-endian base-256 if the high bit is set.
+static long long get_number(char* field, int width) {
+    unsigned char* f = (unsigned char*)field;
+    long long n = 0;
+    if (f[0] & 0x80) {
+        n = f[0] & 0x3f;
+        for (int i = 1; i < width; i++) n = (n << 8) | f[i];
+        return n;
+    }
+    int i = 0;
+    while (i < width && field[i] == ' ') i++;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; i++) n = 8 * n + (field[i] - '0');
+    return n;
+}
+
+// Sets a numeric field: octal if n fits, otherwise base-256 (a GNU extension).
+static void put_number(char* field, int width, long long n) {
+    if (n >= 0 && n < (1LL << (3 * (width - 1)))) {
+        snprintf(field, width, "%0*llo", width - 1, n);
+    } else {
+        for (int i = width - 1; i > 0; i--) {
+            field[i] = (char)(n & 0xff);
+            n >>= 8;
+        }
+        field[0] = (char)0x80;
+    }
+}
+
+static unsigned checksum(char* b) {
+    unsigned sum = 0;
+    for (int i = 0; i < BLOCK; i++) {
+        sum += (i >= CHECKSUM && i < CHECKSUM + 8) ? ' ' : (unsigned char)b[i];
+    }
+    return sum;
+}
+
+static void set_checksum(char* b) {
+    snprintf(b + CHECKSUM, 8, "%06o", checksum(b));
+    b[CHECKSUM + 7] = ' ';
+}
+
+// Returns the field of at most n characters as a newly allocated string.
+static char* get_string(char* field, int n) {
+    int len = strnlen(field, n);
+    char* s = xmalloc(len + 1);
+    memcpy(s, field, len);
+    s[len] = '\0';
+    return s;
+}
+
+// Appends n bytes from in to raw, which is grown as needed.
+static bool read_into(FILE* in, /*inout*/String* raw, ptrdiff_t n) {
+    if (raw->len + n + 1 > raw->cap) {
+        ptrdiff_t cap = 2 * raw->cap + n + 1;
+        char* s = realloc(raw->s, cap);
+        panic_if(s == NULL, "Cannot allocate memory.");
+        raw->s = s;
+        raw->cap = cap;
+    }
+    if (fread(raw->s + raw->len, 1, n, in) != n) return false;
+    raw->len += n;
+    raw->s[raw->len] = '\0';
+    return true;
+}
+
+static ptrdiff_t padded(ptrdiff_t size) {
+    return (size + BLOCK - 1) / BLOCK * BLOCK;
+}
+
+/*
+Parses the pax records ("<length> <key>=<value>\n") of an extended header.
+Keeps path and size, appends the other records to pax.
+*/
+static bool parse_pax(String records, /*inout*/char** path, /*inout*/long long* size,
+        /*inout*/String* pax) {
+    char* p = records.s;
+    char* end = records.s + records.len;
+    while (p < end && *p != '\0') {
+        char* q;
+        long long len = strtoll(p, &q, 10);
+        if (len <= 0 || len > end - p || *q != ' ' || p[len - 1] != '\n') return false;
+        char* key = q + 1;
+        char* eq = memchr(key, '=', p + len - key);
+        if (eq == NULL) return false;
+        char* value = eq + 1;
+        ptrdiff_t value_len = p + len - 1 - value;
+        if (eq - key == 4 && memcmp(key, "path", 4) == 0) {
+            free(*path);
+            *path = get_string(value, value_len);
+        } else if (eq - key == 4 && memcmp(key, "size", 4) == 0) {
+            *size = strtoll(value, NULL, 10);
+        } else {
+            String record = make_string2(p, len);
+            ptrdiff_t cap = pax->len + len;
+            pax->s = realloc(pax->s, cap);
+            panic_if(pax->s == NULL, "Cannot allocate memory.");
+            pax->cap = cap;
+            append_string(pax, record);
+        }
+        p += len;
+    }
+    return true;
+}
+
+/*
+Reads the next entry. Returns 1 for an entry, 0 at the end of the archive, and
+-1 if the input is not a valid archive.
+*/
+static int read_entry(FILE* in, /*out*/TarEntry* e) {
+    *e = (TarEntry){{NULL, 0, 0}};
+    char* path = NULL; // from a pax header or a GNU long name
+    long long pax_size = -1;
+    for (;;) {
+        ptrdiff_t start = e->raw.len;
+        int c = getc(in);
+        if (c == EOF) {
+            // a missing end-of-archive marker is accepted
+            free(path);
+            return start == 0 && !ferror(in) ? 0 : -1;
+        }
+        ungetc(c, in);
+        if (!read_into(in, &e->raw, BLOCK)) break;
+        char* b = e->raw.s + start;
+        if (is_zero_block(b)) {
+            free(path);
+            return start == 0 ? 0 : -1;
+        }
+        if (get_number(b + CHECKSUM, 8) != checksum(b)) break;
+        char type = b[TYPE];
+        bool has_data = !(type >= '1' && type <= '6');
+        long long size = has_data ? get_number(b + SIZE, 12) : 0;
+        if (type != 'x' && type != 'L' && type != 'K' && pax_size >= 0) size = pax_size;
+        if (size < 0 || !read_into(in, &e->raw, padded(size))) break;
+        b = e->raw.s + start; // raw may have moved
+        String data = make_string2(e->raw.s + start + BLOCK, size);
+        if (type == 'x') {
+            if (!parse_pax(data, &path, &pax_size, &e->pax)) break;
+        } else if (type == 'L') {
+            free(path);
+            path = get_string(data.s, data.len);
+        } else if (type != 'K') {
+            // the actual header
+            e->header = e->raw.s + start;
+            if (path != NULL) {
+                e->name = path;
+            } else if (memcmp(b + MAGIC, "ustar\0", 6) == 0 && b[PREFIX] != '\0') {
+                char* prefix = get_string(b + PREFIX, 155);
+                char* name = get_string(b + NAME, 100);
+                e->name = xmalloc(strlen(prefix) + strlen(name) + 2);
+                sprintf(e->name, "%s/%s", prefix, name);
+                free(prefix);
+                free(name);
+            } else {
+                e->name = get_string(b + NAME, 100);
+            }
+            e->content = data;
+            int n = strlen(e->name);
+            e->source = (type == '0' || type == '\0' || type == '7') &&
+                n > 4 && strcmp(e->name + n - 4, ".d.c") == 0;
+            return 1;
+        }
+    }
+    free(path);
+    return -1;
+}
+
+static void free_entry(TarEntry* e) {
+    free(e->raw.s);
+    free(e->name);
+    free(e->pax.s);
+    free(e->output.s);
+}
+
+// Returns the number of decimal digits of n.
+static int digits(ptrdiff_t n) {
+    int d = 1;
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+/*
+Fills the name and prefix fields of header with name. Returns false if name
+does not fit.
+*/
+static bool put_name(char* header, char* name) {
+    ptrdiff_t n = strlen(name);
+    if (n <= 100) {
+        memcpy(header + NAME, name, n);
+        return true;
+    }
+    for (ptrdiff_t i = n - 1; i > 0; i--) {
+        if (name[i] == '/' && i <= 155 && n - i - 1 <= 100) {
+            memcpy(header + PREFIX, name, i);
+            memcpy(header + NAME, name + i + 1, n - i - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool write_padded(FILE* out, char* s, ptrdiff_t n) {
+    static char zeros[BLOCK];
+    return fwrite(s, 1, n, out) == n && fwrite(zeros, 1, padded(n) - n, out) == padded(n) - n;
+}
+
+// Writes the embraced file of a debraced file: foo.c for foo.d.c.
+static bool write_embraced(FILE* out, TarEntry* e) {
+    int n = strlen(e->name);
+    char* name = xmalloc(n + 1);
+    memcpy(name, e->name, n - 4);
+    strcpy(name + n - 4, ".c");
+
+    // mode, uid, gid, mtime, uname, and gname as in the input
+    char header[BLOCK] = {0};
+    memcpy(header + MODE, e->header + MODE, SIZE - MODE);
+    memcpy(header + MTIME, e->header + MTIME, 12);
+    memcpy(header + UNAME, e->header + UNAME, 64);
+    put_number(header + SIZE, 12, e->output.len);
+    header[TYPE] = '0';
+    memcpy(header + MAGIC, "ustar\0" "00", 8);
+    bool fits = put_name(header, name);
+    set_checksum(header);
+
+    bool ok = true;
+    if (!fits || e->pax.len > 0) {
+        String records = new_string(e->pax.len + (fits ? 0 : strlen(name) + 32));
+        append_string(&records, e->pax);
+        if (!fits) {
+            ptrdiff_t len = strlen(" path=\n") + strlen(name);
+            len += digits(len + digits(len));
+            char number[32];
+            snprintf(number, sizeof(number), "%td path=", len);
+            append_cstring(&records, number);
+            append_cstring(&records, name);
+            append_char(&records, '\n');
+        }
+        char pax[BLOCK] = {0};
+        snprintf(pax + NAME, 100, "PaxHeaders/%s", strrchr(name, '/') ? strrchr(name, '/') + 1 : name);
+        memcpy(pax + MODE, "0000644", 8);
+        memcpy(pax + MODE + 8, header + MODE + 8, 16); // uid, gid
+        memcpy(pax + MTIME, header + MTIME, 12);
+        put_number(pax + SIZE, 12, records.len);
+        pax[TYPE] = 'x';
+        memcpy(pax + MAGIC, "ustar\0" "00", 8);
+        set_checksum(pax);
+        ok = fwrite(pax, 1, BLOCK, out) == BLOCK && write_padded(out, records.s, records.len);
+        free(records.s);
+    }
+    ok = ok && fwrite(header, 1, BLOCK, out) == BLOCK &&
+        write_padded(out, e->output.s, e->output.len);
+    free(name);
+    return ok;
+}
+
+typedef struct TarBatch TarBatch;
+struct TarBatch {
+    TarEntry* entries;
+    int count;
+    EmbraceOptions* options;
+};
+
+static void embrace_entry(int index, int worker, void* context) {
+    TarBatch* b = context;
+    TarEntry* e = &b->entries[index];
+    if (!e->source) return;
+    e->ok = embrace_into(e->name, e->content, &e->output, b->options);
+}
+
+/*
+Embraces the debraced files in the tar archive read from in and writes the
+resulting archive to out. Files that cannot be embraced are left out. Returns
+the number of such files, plus one if the input is not a valid archive or the
+output cannot be written (then the output ends after the last complete entry).
+The options must not collect tags.
+*/
+int embrace_tar(FILE* in, FILE* out, EmbraceOptions* options) {
+    require_not_null(in);
+    require_not_null(out);
+    require("no tags", options == NULL || options->tags == NULL);
+    TarBatch b = {xmalloc(BATCH_ENTRIES * sizeof(TarEntry)), 0, options};
+    int errors = 0;
+    int result = 1;
+    while (result > 0) {
+        ptrdiff_t size = 0;
+        b.count = 0;
+        while (b.count < BATCH_ENTRIES && size < BATCH_SIZE) {
+            result = read_entry(in, &b.entries[b.count]);
+            if (result <= 0) {
+                free_entry(&b.entries[b.count]);
+                break;
+            }
+            size += b.entries[b.count].raw.len;
+            b.count++;
+        }
+        parallel_for(b.count, embrace_entry, &b);
+        for (int i = 0; i < b.count; i++) {
+            TarEntry* e = &b.entries[i];
+            if (!e->source) {
+                if (fwrite(e->raw.s, 1, e->raw.len, out) != e->raw.len) result = -2;
+            } else if (e->ok) {
+                if (!write_embraced(out, e)) result = -2;
+            } else {
+                errors++;
+            }
+            free_entry(e);
+        }
+        if (result == -2) break;
+    }
+    free(b.entries);
+    if (result == -1) {
+        fprintf(stderr, "Input is not a valid tar archive.\n");
+        errors++;
+    }
+    // end-of-archive marker, padded to a full record
+    static char zeros[RECORD];
+    long long written = ftell(out);
+    ptrdiff_t n = 2 * BLOCK;
+    if (written >= 0) n += (RECORD - (written + n) % RECORD) % RECORD;
+    if (result == -2 || fwrite(zeros, 1, n, out) != n || fflush(out) != 0) {
+        fprintf(stderr, "Cannot write output.\n");
+        errors++;
+    }
+    return errors;
+}
+
+// Runs a shell command in the test directory.
+static void sh(char* command) {
+    panicf_if(system(command) != 0, "Command failed: %s", command);
+}
+
+// Checks that the embraced file in the output archive matches embrace.
+static void test_embraced(char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), "in/%s.d.c", name);
+    String source = read_file(path);
+    String expected = embrace(path, source);
+    snprintf(path, sizeof(path), "out/%s.c", name);
+    String actual = read_file(path);
+    test_equal_i(actual.len, expected.len);
+    test_equal_i(memcmp(actual.s, expected.s, actual.len), 0);
+    free(source.s);
+    free(expected.s);
+    free(actual.s);
+}
+
+void embrace_tar_test(void) {
+    char cwd[4096];
+    panic_if(getcwd(cwd, sizeof(cwd)) == NULL, "Cannot get current directory.");
+    char dir[] = "/tmp/embrace_tar_XXXXXX";
+    panic_if(mkdtemp(dir) == NULL, "Cannot create directory.");
+    panic_if(chdir(dir) != 0, "Cannot change directory.");
+
+    char long_dir[] = "in/a_directory_name_that_is_long/another_directory_name_that_is_long/"
+        "and_one_more_to_exceed_the_limits_of_the_ustar_header_fields_for_names/"
+        "even_the_prefix_field_of_155_characters";
+    char command[1024];
+    snprintf(command, sizeof(command), "mkdir -p in/sub %s && cd in"
+        " && printf 'int main(void)\\n    if 1 do\\n        return 0\\n' > a.d.c"
+        " && printf 'int x\\n' > sub/b.d.c && printf 'int h;\\n' > h.h && ln -s h.h link.h"
+        " && printf 'void f(void)\\n    return\\n' > %s/long_file_name_in_a_deep_directory.d.c"
+        " && printf 'int f(void)\\n  int x\\n int y\\n' > bad.d.c"
+        " && tar --format=%s -cf ../in.tar *", long_dir, long_dir + 3, "pax");
+    sh(command);
+    for (int format = 0; format < 2; format++) {
+        if (format == 1) sh("cd in && rm ../in.tar && tar --format=gnu -cf ../in.tar *");
+        FILE* in = fopen("in.tar", "r");
+        FILE* out = fopen("out.tar", "w");
+        test_equal_i(embrace_tar(in, out, NULL), 1); // bad.d.c
+        fclose(in);
+        fclose(out);
+        sh("rm -rf out && mkdir out && tar -C out -xf out.tar");
+        test_embraced("a");
+        test_embraced("sub/b");
+        snprintf(command, sizeof(command), "%s/long_file_name_in_a_deep_directory", long_dir + 3);
+        test_embraced(command);
+        sh("cmp in/h.h out/h.h && test -L out/link.h && test ! -e out/bad.c && test ! -e out/a.d.c");
+        // the entries are in the order of the input
+        sh("tar -tf in.tar | grep -v bad.d.c | sed 's/[.]d[.]c$/.c/' > in.txt"
+            " && tar -tf out.tar > out.txt && cmp in.txt out.txt");
+    }
+
+    // not an archive
+    sh("echo 'int x' > in.tar");
+    FILE* in = fopen("in.tar", "r");
+    FILE* out = fopen("out.tar", "w");
+    test_equal_i(embrace_tar(in, out, NULL), 1);
+    fclose(in);
+    fclose(out);
+
+    panic_if(chdir(cwd) != 0, "Cannot change directory.");
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    sh(command);
+}
@@ -0,0 +1,15 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef tar_h_INCLUDED
+#define tar_h_INCLUDED
+
+#include "util.h"
+#include "embrace.h"
+
+int embrace_tar(FILE* in, FILE* out, EmbraceOptions* options);
+void embrace_tar_test(void);
+
+#endif // tar_h_INCLUDED
@@ -3,6 +3,13 @@
 @date: November 28, 2021
 */
 
+#define _GNU_SOURCE // memmem
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "util.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -10,17 +17,17 @@
 
 String make_string(char* s) {
     require_not_null(s);
-    int len = strlen(s);
+    ptrdiff_t len = strlen(s);
     return (String) {s, len, len};
 }
 
-String make_string2(char* s, int len) {
+String make_string2(char* s, ptrdiff_t len) {
     require_not_null(s);
     require("length not negative", len >= 0);
     return (String) {s, len, len};
 }
 
-String make_string3(char* s, int len, int cap) {
+String make_string3(char* s, ptrdiff_t len, ptrdiff_t cap) {
     require_not_null(s);
     require("length not negative", len >= 0);
     require("capacity not negative", cap >= 0);
@@ -28,14 +35,14 @@ String make_string3(char* s, int len, int cap) {
     return (String) {s, len, cap};
 }
 
-String new_string(int cap) {
+String new_string(ptrdiff_t cap) {
     require("capacity not negative", cap >= 0);
     return (String) {xmalloc(cap), 0, cap};
 }
 
 bool append_string(String* str, String t) {
     require_not_null(str);
-    int n = str->len + t.len;
+    ptrdiff_t n = str->len + t.len;
     panic_if(n > str->cap, "append_string overflow");
     if (n > str->cap) return false;
     memcpy(str->s + str->len, t.s, t.len);
@@ -46,8 +53,8 @@ bool append_string(String* str, String t) {
 bool append_cstring(String* str, char* t) {
     require_not_null(str);
     require_not_null(t);
-    int t_len = strlen(t);
-    int n = str->len + t_len;
+    ptrdiff_t t_len = strlen(t);
+    ptrdiff_t n = str->len + t_len;
     panic_if(n > str->cap, "append_cstring overflow");
     if (n > str->cap) return false;
     memcpy(str->s + str->len, t, t_len);
@@ -56,8 +63,8 @@ bool append_cstring(String* str, char* t) {
 }
 
 bool append_char(String* str, char c) {
-    require_not_null(str);
-    panic_if(str->len >= str->cap, "append_char overflow");
+    require_not_null_checked(str);
+    panic_if_checked(str->len >= str->cap, "append_char overflow");
     if (str->len >= str->cap) return false;
     str->s[str->len] = c;
     str->len++;
@@ -86,11 +93,60 @@ void append_test(void) {
 }
 
 void print_string(String str) {
-    printf("%.*s", str.len, str.s);
+    fwrite(str.s, 1, str.len, stdout);
 }
 
 void println_string(String str) {
-    printf("%.*s\n", str.len, str.s);
+    fwrite(str.s, 1, str.len, stdout);
+    putchar('\n');
+}
+
+/*
+Returns the number of spaces (and tabs, if tabs is true) at the beginning of the
+n characters at s. Compares 16 characters at a time, if possible.
+*/
+static ptrdiff_t span_left(const char* s, ptrdiff_t n, bool tabs) {
+    ptrdiff_t i = 0;
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8(tabs ? '\t' : ' ');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), 
+                    _mm_cmpeq_epi8(v, tab)));
+        if (mask != 0xffff) return i + __builtin_ctz(~mask);
+    }
+#endif
+    while (i < n && (s[i] == ' ' || (tabs && s[i] == '\t'))) i++;
+    return i;
+}
+
+/*
+Returns the number of spaces and tabs at the end of the n characters at s.
+Compares 16 characters at a time, if possible.
+*/
+static ptrdiff_t span_right(const char* s, ptrdiff_t n) {
+    ptrdiff_t i = n;
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    for (; i >= 16; i -= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i - 16));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), 
+                    _mm_cmpeq_epi8(v, tab)));
+        // highest character that is not blank
+        if (mask != 0xffff) return n - (i - 16) - (32 - __builtin_clz(~mask & 0xffff));
+    }
+#endif
+    while (i > 0 && (s[i - 1] == ' ' || s[i - 1] == '\t')) i--;
+    return n - i;
+}
+
+/*
+Returns the number of spaces at the beginning of str.
+*/
+ptrdiff_t leading_spaces(String str) {
+    return span_left(str.s, str.len, false);
 }
 
 /*
@@ -99,11 +155,22 @@ content is not modified, but the String is appropriately shifted and the length
 adapted.
 */
 String trim(String str) {
-    int left = 0, right = str.len - 1;
-    for (; left < str.len && (str.s[left] == ' ' || str.s[left] == '\t' ); left++);
-    for (; right >= left && (str.s[right] == ' ' || str.s[right] == '\t' ); right--);
-    if (left > right) return (String){"", 0};
-    return (String){str.s + left, right - left + 1};
+    ptrdiff_t left = span_left(str.s, str.len, true);
+    if (left == str.len) return (String){"", 0};
+    ptrdiff_t right = span_right(str.s + left, str.len - left);
+    return (String){str.s + left, str.len - left - right};
+}
+
+// Returns a string of n copies of c with the given prefix and suffix.
+static String make_long_string(char* prefix, char c, ptrdiff_t n, char* suffix) {
+    ptrdiff_t m = strlen(prefix), k = strlen(suffix);
+    String str = new_string(m + n + k + 1);
+    memcpy(str.s, prefix, m);
+    memset(str.s + m, c, n);
+    memcpy(str.s + m + n, suffix, k);
+    str.len = m + n + k;
+    str.s[str.len] = '\0';
+    return str;
 }
 
 void trim_test(void) {
@@ -119,6 +186,35 @@ void trim_test(void) {
     test_equal_s(trim(make_string("abc")), "abc");
     test_equal_s(trim(make_string("a b c")), "a b c");
     test_equal_s(trim(make_string("   a b c ")), "a b c");
+    test_equal_s(trim(make_string("                a b c                 ")), "a b c");
+    test_equal_s(trim(make_string(" \t               \t               x")), "x");
+    test_equal_s(trim(make_string("x \t               \t               ")), "x");
+
+    // very long lines, all lengths around the block size
+    for (ptrdiff_t n = 0; n < 40; n++) {
+        String str = make_long_string("", ' ', n, "ab");
+        test_equal_s(trim(str), "ab");
+        free(str.s);
+        str = make_long_string("ab", '\t', n, "");
+        test_equal_s(trim(str), "ab");
+        free(str.s);
+        str = make_long_string("", ' ', n, "");
+        test_equal_i(trim(str).len, 0);
+        free(str.s);
+    }
+    String str = make_long_string(" a", 'x', 10 * 1000 * 1000, "b\t");
+    String t = trim(str);
+    test_equal_i(t.s - str.s, 1);
+    test_equal_i(t.len, 10 * 1000 * 1000 + 2);
+    free(str.s);
+    str = make_long_string("a", ' ', 10 * 1000 * 1000, "");
+    test_equal_s(trim(str), "a");
+    test_equal_i(leading_spaces(str), 0);
+    free(str.s);
+    str = make_long_string("", ' ', 10 * 1000 * 1000, "\tx");
+    test_equal_i(leading_spaces(str), 10 * 1000 * 1000);
+    test_equal_s(trim(str), "x");
+    free(str.s);
 }
 
 /*
@@ -126,10 +222,9 @@ Removes spaces and tabs from the beginning of str. The underlying content is not
 modified, but the String is appropriately shifted and the length adapted.
 */
 String trim_left(String str) {
-    int left = 0, right = str.len - 1;
-    for (; left < str.len && (str.s[left] == ' ' || str.s[left] == '\t' ); left++);
-    if (left > right) return (String){"", 0};
-    return (String){str.s + left, right - left + 1};
+    ptrdiff_t left = span_left(str.s, str.len, true);
+    if (left == str.len) return (String){"", 0};
+    return (String){str.s + left, str.len - left};
 }
 
 void trim_left_test(void) {
@@ -145,6 +240,8 @@ void trim_left_test(void) {
     test_equal_s(trim_left(make_string("abc")), "abc");
     test_equal_s(trim_left(make_string("a b c")), "a b c");
     test_equal_s(trim_left(make_string("   a b c ")), "a b c ");
+    test_equal_s(trim_left(make_string("                 a b c ")), "a b c ");
+    test_equal_s(trim_left(make_string("\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t")), "");
 }
 
 /*
@@ -152,10 +249,9 @@ Removes spaces and tabs from the end of str. The underlying content is not
 modified, but the String is appropriately shifted and the length adapted.
 */
 String trim_right(String str) {
-    int left = 0, right = str.len - 1;
-    for (; right >= left && (str.s[right] == ' ' || str.s[right] == '\t' ); right--);
-    if (left > right) return (String){"", 0};
-    return (String){str.s + left, right - left + 1};
+    ptrdiff_t right = span_right(str.s, str.len);
+    if (right == str.len) return (String){"", 0};
+    return (String){str.s, str.len - right};
 }
 
 void trim_right_test(void) {
@@ -171,38 +267,27 @@ void trim_right_test(void) {
     test_equal_s(trim_right(make_string("abc")), "abc");
     test_equal_s(trim_right(make_string("a b c")), "a b c");
     test_equal_s(trim_right(make_string("   a b c ")), "   a b c");
+    test_equal_s(trim_right(make_string("a b c                 ")), "a b c");
+    test_equal_s(trim_right(make_string("\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t")), "");
 }
 
 /*
 Returns true iff str contains part.
 */
 bool contains(String str, String part) {
-    if (str.len < part.len) return false;
-    // must use C strings to use strstr, on stack may overflow the stack
-    char s[str.len + 1];
-    char t[part.len + 1];
-    memcpy(s, str.s, str.len);
-    memcpy(t, part.s, part.len);
-    s[str.len] = '\0';
-    t[part.len] = '\0';
-    return strstr(s, t) != NULL;
+    return index_of(str, part) >= 0;
 }
 
 /*
-Returns the index of part in str or -1 of part does not appear in s.
+Returns the index of part in str or -1 of part does not appear in s. Neither
+string is copied, so str may be arbitrarily long.
 */
-int index_of(String str, String part) {
+ptrdiff_t index_of(String str, String part) {
     if (str.len < part.len) return -1;
-    // must use C strings to use strstr, on stack may overflow the stack
-    char s[str.len + 1];
-    char t[part.len + 1];
-    memcpy(s, str.s, str.len);
-    memcpy(t, part.s, part.len);
-    s[str.len] = '\0';
-    t[part.len] = '\0';
-    char* p = strstr(s, t);
+    if (part.len == 0) return 0;
+    char* p = memmem(str.s, str.len, part.s, part.len);
     if (p == NULL) return -1;
-    return (int)(p - s);
+    return p - str.s;
 }
 
 void index_of_test(void) {
@@ -213,6 +298,19 @@ void index_of_test(void) {
     test_equal_i(index_of(make_string("abcd"), make_string("x")), -1);
     test_equal_i(index_of(make_string("abcd"), make_string("")), 0);
     test_equal_i(index_of(make_string(""), make_string("a")), -1);
+    test_equal_i(index_of(make_string(""), make_string("")), 0);
+    // part must be within the length of str
+    test_equal_i(index_of(make_string2("abcd", 3), make_string("cd")), -1);
+    test_equal_i(contains(make_string("abcd"), make_string("bc")), true);
+    test_equal_i(contains(make_string("abcd"), make_string("bd")), false);
+
+    // a very long line (would overflow the stack if copied there)
+    String str = make_long_string("", 'a', 64 * 1000 * 1000, "end. loop");
+    test_equal_i(index_of(str, make_string("end.")), 64 * 1000 * 1000);
+    test_equal_i(contains(str, make_string("loop")), true);
+    test_equal_i(contains(str, make_string("aab")), false);
+    test_equal_i(index_of(make_string("ab"), str), -1);
+    free(str.s);
 }
 
 StringNode* new_string_node(String str, StringNode* next) {
@@ -222,7 +320,7 @@ StringNode* new_string_node(String str, StringNode* next) {
     return node;
 }
 
-StringArray* new_string_array(int cap) {
+StringArray* new_string_array(ptrdiff_t cap) {
     require("not negative", cap >= 0);
     StringArray* arr = xcalloc(1, sizeof(StringArray) + cap * sizeof(String));
     arr->cap = cap;
@@ -237,25 +335,143 @@ not exist or cannot be read.
 */
 String read_file(char* name) {
     require_not_null(name);
+    String s = {NULL, 0, 0};
+    panicf_if(!read_file_into(name, &s), "Cannot read %s", name);
+    return s;
+}
+
+/**
+Reads the contents of a file into buffer, which is grown if its capacity does
+not suffice. This allows reusing the same buffer for many files. The content is
+terminated with '\0', which is not included in the length.
+@param[in] name file name (including path)
+@param[inout] buffer a string with a malloc'ed char* or NULL
+@return false if the file does not exist or cannot be read
+*/
+bool read_file_into(char* name, /*inout*/String* buffer) {
+    require_not_null(name);
+    require_not_null(buffer);
 
     // Opening in text mode should remove \r and only leave \n.
     // However, it does not do so on macOS.
     FILE *f = fopen(name, "r"); 
-    panicf_if(f == NULL, "Cannot open %s", name);
+    if (f == NULL) return false;
 
     fseek (f, 0, SEEK_END);
     long size = ftell(f);
     rewind(f);
+    if (size < 0) {
+        fclose(f);
+        return false;
+    }
     
-    char *s = xmalloc(size + 1);
+    if (buffer->s == NULL || buffer->cap < size + 1) {
+        char* s = realloc(buffer->s, size + 1);
+        panic_if(s == NULL, "Cannot allocate memory.");
+        buffer->s = s;
+        buffer->cap = size + 1;
+    }
+    char *s = buffer->s;
     long sizeRead = fread(s, 1, size, f);
     // assert: size >= sizeRead (> if file contains \r characters)
     // printf("size = %lu, sizeRead = %lu, feof = %d\n", size, sizeRead, feof(f));
-    panicf_if(sizeRead < size && feof(f) == 0, "Cannot read %s to end.\n", name); 
+    bool ok = sizeRead == size || feof(f) != 0;
     s[sizeRead] = '\0';
+    buffer->len = sizeRead;
     
     fclose(f);
-    return make_string2(s, sizeRead);
+    return ok;
+}
+
+/**
+Writes str to a file. The data is first written to a temporary file next to the
+destination, which is then renamed, so that readers never see a partially
+written file.
+@param[in] name file name (including path)
+@param[in] str the content to write
+@return false if the file cannot be written
+*/
+bool write_file(char* name, String str) {
+    require_not_null(name);
+    int n = strlen(name) + 5;
+    char tmp_name[n];
+    snprintf(tmp_name, n, "%s.tmp", name);
+    FILE *f = fopen(tmp_name, "w");
+    if (f == NULL) return false;
+    size_t written = fwrite(str.s, 1, str.len, f);
+    bool ok = fclose(f) == 0 && written == (size_t)str.len;
+    if (ok) ok = rename(tmp_name, name) == 0;
+    if (!ok) remove(tmp_name);
+    return ok;
+}
+
+/**
+Creates all missing directories on the path to a file, like "mkdir -p" for the
+directory part of name.
+@param[in] name file name (including path)
+@return false if a directory cannot be created
+*/
+bool make_dirs(char* name) {
+    require_not_null(name);
+    int n = strlen(name);
+    char path[n + 1];
+    memcpy(path, name, n + 1);
+    for (char* p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(path, 0777) != 0 && errno != EEXIST) return false;
+        *p = '/';
+    }
+    return true;
+}
+
+/*
+Returns dir/file as a newly allocated string with room for extra more
+characters. Empty and "." components of file are dropped, and ".." removes the
+component before it, so that the result is always in dir, e.g., out/src/foo.c
+for "/src/foo.c", "./src/foo.c", and "../src/foo.c".
+*/
+char* path_in_dir(char* dir, char* file, int extra) {
+    require_not_null(dir);
+    require_not_null(file);
+    require("not negative", extra >= 0);
+    int base = strlen(dir);
+    char* path = xmalloc(base + strlen(file) + extra + 2);
+    memcpy(path, dir, base);
+    int len = base;
+    for (char* p = file; *p != '\0'; ) {
+        int k = strcspn(p, "/");
+        if (k == 2 && p[0] == '.' && p[1] == '.') {
+            while (len > base && path[len - 1] != '/') len--;
+            if (len > base) len--; // the '/' before the removed component
+        } else if (k > 0 && !(k == 1 && p[0] == '.')) {
+            path[len++] = '/';
+            memcpy(path + len, p, k);
+            len += k;
+        }
+        p += p[k] == '/' ? k + 1 : k;
+    }
+    path[len] = '\0';
+    return path;
+}
+
+static void check_path_in_dir(char* dir, char* file, char* expected) {
+    char* path = path_in_dir(dir, file, 0);
+    test_equal_s(make_string(path), expected);
+    free(path);
+}
+
+void path_in_dir_test(void) {
+    check_path_in_dir("out", "foo.c", "out/foo.c");
+    check_path_in_dir("out", "src/foo.c", "out/src/foo.c");
+    check_path_in_dir("out", "/src/foo.c", "out/src/foo.c");
+    check_path_in_dir("out", "./src/./foo.c", "out/src/foo.c");
+    check_path_in_dir("out", "src//foo.c", "out/src/foo.c");
+    check_path_in_dir("out", "../src/foo.c", "out/src/foo.c");
+    check_path_in_dir("out", "../../foo.c", "out/foo.c");
+    check_path_in_dir("out", "src/../../etc/foo.c", "out/etc/foo.c");
+    check_path_in_dir("out", "a/b/../c/foo.c", "out/a/c/foo.c");
+    check_path_in_dir("out/", "..", "out/");
+    check_path_in_dir("a/..", "..foo/.bar.c", "a/../..foo/.bar.c");
 }
 
 /*
@@ -266,10 +482,10 @@ StringArray* split(char* s, char sep) {
     require_not_null(s);
     char* t = s;
     StringNode* lines = NULL;
-    int line_count = 0;
+    ptrdiff_t line_count = 0;
     while (*t) {
         if (*t == sep) {
-            lines = new_string_node(make_string2(s, (int)(t - s)), lines);
+            lines = new_string_node(make_string2(s, t - s), lines);
             s = t + 1;
             line_count++;
         }
@@ -277,12 +493,12 @@ StringArray* split(char* s, char sep) {
     }
     // last line
     if (lines != NULL || (lines == NULL && t > s)) {
-        lines = new_string_node(make_string2(s, (int)(t - s)), lines);
+        lines = new_string_node(make_string2(s, t - s), lines);
         line_count++;
     }
     StringArray* arr = new_string_array(line_count);
     arr->len = line_count;
-    for (int i = line_count - 1; i >= 0; i--) {
+    for (ptrdiff_t i = line_count - 1; i >= 0; i--) {
         assert_not_null(lines);
         arr->a[i] = lines->str;
         StringNode* node = lines;
@@ -332,34 +548,26 @@ string. Line separators may be "\n" or "\r\n".
 */
 StringArray* split_lines(char* s) {
     require_not_null(s);
-    char* t = s;
-    StringNode* lines = NULL;
-    int line_count = 0;
+    // count the lines first, so that the array is allocated once
+    ptrdiff_t line_count = 0;
+    char* p = s; // start of the current line
+    char* t = p + strcspn(p, "\n\r");
     while (*t) {
-        char c = *t;
-        if (c == '\n' || c == '\r') {
-            lines = new_string_node(make_string2(s, (int)(t - s)), lines);
-            if (c == '\r') t++; // skip carriage return, if needed
-            s = t + 1;
-            line_count++;
-        }
-        t++;
-    }
-    // last line
-    if (lines != NULL || (lines == NULL && t > s)) {
-        lines = new_string_node(make_string2(s, (int)(t - s)), lines);
         line_count++;
+        // skip carriage return, if needed
+        p = t + (*t == '\r' && t[1] != '\0' ? 2 : 1);
+        t = p + strcspn(p, "\n\r");
     }
+    // last line
+    if (line_count > 0 || t > p) line_count++;
     StringArray* arr = new_string_array(line_count);
     arr->len = line_count;
-    for (int i = line_count - 1; i >= 0; i--) {
-        assert_not_null(lines);
-        arr->a[i] = lines->str;
-        StringNode* node = lines;
-        lines = lines->next;
-        free(node);
+    p = s;
+    for (ptrdiff_t i = 0; i < line_count; i++) {
+        t = p + strcspn(p, "\n\r");
+        arr->a[i] = make_string2(p, t - p);
+        if (*t) p = t + (*t == '\r' && t[1] != '\0' ? 2 : 1);
     }
-    assert("list empty", lines == NULL);
     return arr;
 }
 
@@ -461,6 +669,10 @@ void base_init(void) {
     }
 }
 
+bool base_tests_passed(void) {
+    return base_check_success_count == base_check_count;
+}
+
 bool base_test_equal_i(const char *file, int line, int a, int e) {
     base_init();
     base_check_count++;
@@ -482,8 +694,99 @@ bool base_test_equal_s(const char *file, int line, String a, char* e) {
         base_check_success_count++;
         return true;
     } else {
-        printf("%s, line %d: Actual value \"%.*s\" differs from expected value \"%s\".\n", file, line, a.len, a.s, e);
+        printf("%s, line %d: Actual value \"%.*s\" differs from expected value \"%s\".\n", file, line, (int)a.len, a.s, e);
         return false;
     }
 }
 
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmarking
+
+#define BENCH_MIN_SECONDS 0.01 // shortest calibration round
+#define BENCH_ROUNDS 5 // measured rounds, the fastest one is reported
+
+double bench_seconds = 0.5;
+
+typedef struct BenchResult BenchResult;
+struct BenchResult {
+    const char* name;
+    long long iterations; // per round
+    double ns_per_op;
+    double bytes_per_op;
+};
+
+static BenchResult* bench_results = NULL;
+static int bench_result_count = 0;
+
+// Returns the time of the monotonic clock in seconds.
+static double bench_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+Bench base_bench_begin(const char* name, double bytes_per_op) {
+    require_not_null(name);
+    Bench b = {name, bytes_per_op, 1, -1, 0, 0};
+    b.start = bench_now();
+    return b;
+}
+
+/*
+Called after each round of b->n iterations. Increases the number of iterations
+until a round takes at least BENCH_MIN_SECONDS, then measures BENCH_ROUNDS
+rounds of about bench_seconds / BENCH_ROUNDS each. Returns false when done.
+*/
+bool base_bench_next(Bench* b) {
+    require_not_null(b);
+    double elapsed = bench_now() - b->start;
+    if (b->round < 0) {
+        if (elapsed < BENCH_MIN_SECONDS) {
+            double factor = elapsed > 0 ? 1.5 * BENCH_MIN_SECONDS / elapsed : 100;
+            if (factor < 2) factor = 2;
+            if (factor > 100) factor = 100;
+            b->n = (long long)(b->n * factor);
+        } else {
+            double n = b->n * (bench_seconds / BENCH_ROUNDS) / elapsed;
+            b->n = n < 1 ? 1 : (long long)n;
+            b->round = 0;
+        }
+    } else {
+        double ns = elapsed * 1e9 / b->n;
+        if (b->round == 0 || ns < b->best) b->best = ns;
+        b->round++;
+        if (b->round == BENCH_ROUNDS) {
+            if (bench_result_count % 16 == 0) {
+                bench_results = realloc(bench_results, 
+                        (bench_result_count + 16) * sizeof(BenchResult));
+                panic_if(bench_results == NULL, "Cannot allocate memory.");
+            }
+            bench_results[bench_result_count++] = 
+                (BenchResult){b->name, b->n, b->best, b->bytes_per_op};
+            return false;
+        }
+    }
+    b->start = bench_now();
+    return true;
+}
+
+void bench_report(FILE* f, bool json) {
+    require_not_null(f);
+    if (json) fprintf(f, "{\"benchmarks\": [");
+    for (int i = 0; i < bench_result_count; i++) {
+        BenchResult* r = &bench_results[i];
+        double bytes_per_second = r->bytes_per_op * 1e9 / r->ns_per_op;
+        if (json) {
+            fprintf(f, "%s\n  {\"name\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.3f, "
+                    "\"bytes_per_second\": %.0f}", i == 0 ? "" : ",", 
+                    r->name, r->iterations, r->ns_per_op, bytes_per_second);
+        } else if (r->bytes_per_op > 0) {
+            fprintf(f, "%-24s %12lld %14.1f ns/op %10.1f MB/s\n", 
+                    r->name, r->iterations, r->ns_per_op, bytes_per_second / 1e6);
+        } else {
+            fprintf(f, "%-24s %12lld %14.1f ns/op\n", r->name, r->iterations, r->ns_per_op);
+        }
+    }
+    if (json) fprintf(f, "\n]}\n");
+}
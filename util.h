@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stddef.h>
 
 /*
 A String points to some part of a C string, i.e., it does not have to end with
@@ -18,14 +19,14 @@ A String points to some part of a C string, i.e., it does not have to end with
 typedef struct String String;
 struct String {
     char* s;
-    int len;
-    int cap;
+    ptrdiff_t len;
+    ptrdiff_t cap;
 };
 
 String make_string(char* s);
-String make_string2(char* s, int len);
-String make_string3(char* s, int len, int cap);
-String new_string(int cap);
+String make_string2(char* s, ptrdiff_t len);
+String make_string3(char* s, ptrdiff_t len, ptrdiff_t cap);
+String new_string(ptrdiff_t cap);
 
 bool append_string(String* str, String t);
 bool append_cstring(String* str, char* t);
@@ -35,6 +36,7 @@ void append_test(void);
 void print_string(String str);
 void println_string(String str);
 
+ptrdiff_t leading_spaces(String str);
 String trim(String str);
 String trim_left(String str);
 String trim_right(String str);
@@ -42,7 +44,7 @@ void trim_test(void);
 void trim_left_test(void);
 void trim_right_test(void);
 bool contains(String str, String part);
-int index_of(String str, String part);
+ptrdiff_t index_of(String str, String part);
 void index_of_test(void);
 
 typedef struct StringNode StringNode;
@@ -55,12 +57,12 @@ StringNode* new_string_node(String str, StringNode* next);
 
 typedef struct StringArray StringArray;
 struct StringArray {
-    int len;
-    int cap;
+    ptrdiff_t len;
+    ptrdiff_t cap;
     String a[]; // variable-sized array
 };
 
-StringArray* new_string_array(int cap);
+StringArray* new_string_array(ptrdiff_t cap);
 
 StringArray* split(char* s, char sep);
 void split_test(void);
@@ -68,6 +70,11 @@ StringArray* split_lines(char* s);
 void split_lines_test(void);
 
 String read_file(char* name);
+bool read_file_into(char* name, /*inout*/String* buffer);
+bool write_file(char* name, String str);
+bool make_dirs(char* name);
+char* path_in_dir(char* dir, char* file, int extra);
+void path_in_dir_test(void);
 
 
 
@@ -275,6 +282,25 @@ if (pointer == NULL) {\
 }
 #endif
 
+/*
+Contracts in inner loops, which would be checked for every byte, are only
+checked in the checked build, which defines CHECKED (make embrace_checked). The
+default build checks the corresponding invariants once per line or per buffer.
+*/
+#ifdef CHECKED
+#define require_checked(description, condition) require(description, condition)
+#define require_not_null_checked(argument) require_not_null(argument)
+#define ensure_checked(description, condition) ensure(description, condition)
+#define assert_checked(description, condition) assert(description, condition)
+#define panic_if_checked(condition, message) panic_if(condition, message)
+#else
+#define require_checked(description, condition)
+#define require_not_null_checked(argument)
+#define ensure_checked(description, condition)
+#define assert_checked(description, condition)
+#define panic_if_checked(condition, message)
+#endif
+
 
 
 #define panic(message) {\
@@ -339,4 +365,59 @@ char* (second argument).
 /** Checks whether the actual value @c a is equal to the expected value @c e. */
 bool base_test_equal_s(const char *file, int line, String a, char* e);
 
+/** Returns true if all of the checks so far have passed. */
+bool base_tests_passed(void);
+
+
+
+/**
+Benchmarks the statement that follows, e.g.,
+    bench("split_lines", text.len) {
+        StringArray* lines = split_lines(text.s);
+        bench_use(lines);
+        free(lines);
+    }
+One execution of the statement is one operation, which processes the given
+number of bytes (0 if not applicable). The number of iterations is calibrated
+automatically, such that a measurement takes about bench_seconds. The result is
+recorded for bench_report.
+*/
+#define bench(name, bytes_per_op) \
+    for (Bench bench_state = base_bench_begin(name, bytes_per_op); \
+            base_bench_next(&bench_state); ) \
+        for (long long bench_i = 0; bench_i < bench_state.n; bench_i++)
+
+/**
+Makes the compiler believe that value is used and that memory has been read, so
+that the computation of value is not optimized away.
+*/
+#define bench_use(value) __asm__ __volatile__("" : : "g"(value) : "memory")
+
+/**
+Makes the compiler believe that memory has been modified, so that loads are not
+hoisted out of the benchmark loop.
+*/
+#define bench_clobber() __asm__ __volatile__("" : : : "memory")
+
+typedef struct Bench Bench;
+struct Bench {
+    const char* name;
+    double bytes_per_op;
+    long long n; // iterations of the current round
+    int round; // calibration rounds are negative
+    double start; // start time of the current round in seconds
+    double best; // fastest round in ns/op
+};
+
+extern double bench_seconds; // time per measurement, default 0.5 s
+
+Bench base_bench_begin(const char* name, double bytes_per_op);
+bool base_bench_next(Bench* b);
+
+/**
+Writes the recorded results to f, as text or as JSON, which is easy to compare
+between commits.
+*/
+void bench_report(FILE* f, bool json);
+
 #endif // util_h_INCLUDED
@@ -0,0 +1,459 @@
+/*
+Watch mode: Keeps the embraced files in an output directory up to date with the
+debraced files in an input directory. Uses inotify to get notified of changes,
+so that only the changed files are embraced again, shortly after they have been
+written. Changes are debounced, i.e., files are embraced once no further events
+arrive for DEBOUNCE_MS milliseconds (but not later than MAX_DELAY_MS after the
+first change). The input and output buffers are reused between runs.
+
+Each directory of the input tree has its own watch. Directories that are
+created (or moved into the tree) while watching get a watch when they appear,
+only the new subtree is scanned. Directories that are moved away or deleted are
+forgotten, a directory that is renamed within the tree is watched under its new
+path.
+
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#define _GNU_SOURCE
+#include "util.h"
+#include "embrace.h"
+#include "watch.h"
+#include "batch.h"
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEBOUNCE_MS 10
+#define MAX_DELAY_MS 100
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_Q_OVERFLOW | \
+        IN_MOVED_FROM | IN_MOVE_SELF | IN_DELETE_SELF)
+
+typedef struct Watcher Watcher;
+struct Watcher {
+    int fd; // inotify file descriptor
+    char* in_dir;
+    char* out_dir;
+    EmbraceOptions options; // format and line directives
+    char** dirs; // directory (relative to in_dir) per watch descriptor
+    int dirs_cap;
+    char** pending; // changed files (relative to in_dir), may contain duplicates
+    int pending_len;
+    int pending_cap;
+    long first_pending_ms; // time of the oldest pending change
+    long last_pending_ms; // time of the newest pending change
+    String input; // buffers reused between runs
+    String output;
+};
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// Joins directory and name with '/'. Returns a newly allocated string.
+static char* join_path(char* dir, char* name) {
+    require_not_null(dir);
+    require_not_null(name);
+    int n = strlen(dir) + strlen(name) + 2;
+    char* path = xmalloc(n);
+    if (*dir == '\0') {
+        snprintf(path, n, "%s", name);
+    } else {
+        snprintf(path, n, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+static bool is_debraced_file(char* name) {
+    int n = strlen(name);
+    return n > 4 && strcmp(name + n - 4, ".d.c") == 0;
+}
+
+// Returns the output path of the given input file (relative to in_dir).
+static char* output_path(Watcher* w, char* rel) {
+    return embraced_path(w->out_dir, rel);
+}
+
+// Checks if the output of the given input file is missing or older than input.
+static bool is_stale(Watcher* w, char* rel) {
+    char* in_path = join_path(w->in_dir, rel);
+    char* out_path = output_path(w, rel);
+    struct stat in_stat, out_stat;
+    bool stale = stat(out_path, &out_stat) != 0 || (stat(in_path, &in_stat) == 0 && 
+            (in_stat.st_mtim.tv_sec > out_stat.st_mtim.tv_sec || 
+            (in_stat.st_mtim.tv_sec == out_stat.st_mtim.tv_sec && 
+             in_stat.st_mtim.tv_nsec > out_stat.st_mtim.tv_nsec)));
+    free(in_path);
+    free(out_path);
+    return stale;
+}
+
+static void add_pending(Watcher* w, char* rel) {
+    if (w->pending_len >= w->pending_cap) {
+        w->pending_cap = w->pending_cap == 0 ? 64 : 2 * w->pending_cap;
+        w->pending = realloc(w->pending, w->pending_cap * sizeof(char*));
+        panic_if(w->pending == NULL, "Cannot allocate memory.");
+    }
+    long now = now_ms();
+    if (w->pending_len == 0) w->first_pending_ms = now;
+    w->last_pending_ms = now;
+    w->pending[w->pending_len++] = rel;
+}
+
+/*
+Adds watches for the directory rel (relative to in_dir) and all its
+subdirectories. Debraced files that are found are scheduled for embracing, if
+only_stale is false, or if their output is missing or out of date.
+*/
+static void add_tree(Watcher* w, char* rel, bool only_stale) {
+    char* path = join_path(w->in_dir, rel);
+    // add the watch before reading the directory, so that no file is missed
+    int wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+    if (wd < 0) {
+        fprintf(stderr, "Cannot watch %s: %s\n", path, strerror(errno));
+        free(path);
+        return;
+    }
+    if (wd >= w->dirs_cap) {
+        int cap = w->dirs_cap == 0 ? 64 : w->dirs_cap;
+        while (cap <= wd) cap *= 2;
+        w->dirs = realloc(w->dirs, cap * sizeof(char*));
+        panic_if(w->dirs == NULL, "Cannot allocate memory.");
+        memset(w->dirs + w->dirs_cap, 0, (cap - w->dirs_cap) * sizeof(char*));
+        w->dirs_cap = cap;
+    }
+    // a directory that has been moved keeps its watch, but not its path
+    free(w->dirs[wd]);
+    w->dirs[wd] = strdup(rel);
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        free(path);
+        return;
+    }
+    struct dirent* e;
+    while ((e = readdir(dir)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        char* child = join_path(rel, e->d_name);
+        bool is_dir = e->d_type == DT_DIR;
+        if (e->d_type == DT_UNKNOWN) {
+            struct stat st;
+            char* child_path = join_path(w->in_dir, child);
+            is_dir = stat(child_path, &st) == 0 && S_ISDIR(st.st_mode);
+            free(child_path);
+        }
+        if (is_dir) {
+            add_tree(w, child, only_stale);
+            free(child);
+        } else if (is_debraced_file(child) && (!only_stale || is_stale(w, child))) {
+            add_pending(w, child);
+        } else {
+            free(child);
+        }
+    }
+    closedir(dir);
+    free(path);
+}
+
+/*
+Removes the watches of the directory rel (relative to in_dir) and all its
+subdirectories, e.g., when it has been moved out of the tree.
+*/
+static void forget_tree(Watcher* w, char* rel) {
+    int n = strlen(rel);
+    for (int wd = 0; wd < w->dirs_cap; wd++) {
+        char* dir = w->dirs[wd];
+        if (dir == NULL || strncmp(dir, rel, n) != 0) continue;
+        if (n > 0 && dir[n] != '\0' && dir[n] != '/') continue;
+        // the IN_IGNORED event that follows finds no directory
+        inotify_rm_watch(w->fd, wd);
+        free(dir);
+        w->dirs[wd] = NULL;
+    }
+}
+
+// Embraces the given file (relative to in_dir) into out_dir.
+static void embrace_file(Watcher* w, char* rel) {
+    char* in_path = join_path(w->in_dir, rel);
+    // the file may have been removed in the meantime
+    if (read_file_into(in_path, &w->input)) {
+        w->output.len = 0;
+        if (embrace_into(in_path, w->input, &w->output, &w->options)) {
+            char* out_path = output_path(w, rel);
+            make_dirs(out_path);
+            if (write_file(out_path, w->output)) {
+                printf("embraced %s\n", in_path);
+            } else {
+                fprintf(stderr, "Cannot write %s: %s\n", out_path, strerror(errno));
+            }
+            free(out_path);
+        }
+    }
+    free(in_path);
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+// Embraces all pending files once.
+static void flush(Watcher* w) {
+    qsort(w->pending, w->pending_len, sizeof(char*), compare_paths);
+    for (int i = 0; i < w->pending_len; i++) {
+        if (i == 0 || strcmp(w->pending[i - 1], w->pending[i]) != 0) {
+            embrace_file(w, w->pending[i]);
+        }
+    }
+    for (int i = 0; i < w->pending_len; i++) {
+        free(w->pending[i]);
+    }
+    w->pending_len = 0;
+    fflush(stdout);
+}
+
+// Handles an inotify event.
+static void handle_event(Watcher* w, struct inotify_event* e) {
+    if (e->mask & IN_Q_OVERFLOW) {
+        // events have been lost, find out of date files the slow way
+        fprintf(stderr, "inotify queue overflow, rescanning %s\n", w->in_dir);
+        add_tree(w, "", true);
+        return;
+    }
+    if (e->wd < 0 || e->wd >= w->dirs_cap || w->dirs[e->wd] == NULL) return;
+    if (e->mask & IN_IGNORED) {
+        free(w->dirs[e->wd]);
+        w->dirs[e->wd] = NULL;
+        return;
+    }
+    if (e->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+        // usually forgotten already by the IN_MOVED_FROM event of its parent
+        char* rel = strdup(w->dirs[e->wd]);
+        forget_tree(w, rel);
+        free(rel);
+        return;
+    }
+    if (e->len == 0) return;
+    char* rel = join_path(w->dirs[e->wd], e->name);
+    if (e->mask & IN_ISDIR) {
+        if (e->mask & (IN_CREATE | IN_MOVED_TO)) {
+            // new subtree, files may already exist in it
+            add_tree(w, rel, false);
+        } else if (e->mask & IN_MOVED_FROM) {
+            // renamed (then IN_MOVED_TO follows) or moved out of the tree
+            forget_tree(w, rel);
+        }
+        free(rel);
+    } else if ((e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_debraced_file(rel)) {
+        add_pending(w, rel);
+    } else {
+        free(rel);
+    }
+}
+
+// Reads all available events. Returns false on error.
+static bool read_events(Watcher* w) {
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(w->fd, buf, sizeof(buf));
+        if (n < 0) return errno == EAGAIN || errno == EINTR;
+        for (char* p = buf; p < buf + n; ) {
+            struct inotify_event* e = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + e->len;
+            handle_event(w, e);
+        }
+    }
+}
+
+/*
+Starts watching in_dir and embraces all files whose output in out_dir is missing
+or out of date. Options may be NULL. Returns false on error.
+*/
+static bool watch_start(/*out*/Watcher* w, char* in_dir, char* out_dir,
+        EmbraceOptions* options) {
+    memset(w, 0, sizeof(Watcher));
+    w->in_dir = in_dir;
+    w->out_dir = out_dir;
+    if (options != NULL) w->options = *options;
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) {
+        fprintf(stderr, "Cannot initialize inotify: %s\n", strerror(errno));
+        return false;
+    }
+    add_tree(w, "", true);
+    flush(w);
+    return true;
+}
+
+/*
+Embraces changed files until the given time (see now_ms), or forever if it is
+negative. Pending files are embraced once no change arrived for DEBOUNCE_MS, or
+MAX_DELAY_MS after the first change. Returns false on error.
+*/
+static bool watch_until(/*inout*/Watcher* w, long until_ms) {
+    struct pollfd pfd = {w->fd, POLLIN, 0};
+    for (;;) {
+        long now = now_ms();
+        if (w->pending_len > 0 && (now - w->last_pending_ms >= DEBOUNCE_MS ||
+                now - w->first_pending_ms >= MAX_DELAY_MS)) {
+            flush(w);
+        }
+        if (until_ms >= 0 && now >= until_ms) return true;
+        long timeout = -1;
+        if (w->pending_len > 0) {
+            long debounce = DEBOUNCE_MS - (now - w->last_pending_ms);
+            long delay = MAX_DELAY_MS - (now - w->first_pending_ms);
+            timeout = debounce < delay ? debounce : delay;
+        }
+        if (until_ms >= 0 && (timeout < 0 || until_ms - now < timeout)) timeout = until_ms - now;
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            return false;
+        }
+        if (n > 0 && !read_events(w)) {
+            fprintf(stderr, "Cannot read inotify events: %s\n", strerror(errno));
+            return false;
+        }
+    }
+}
+
+static void watch_stop(/*inout*/Watcher* w) {
+    close(w->fd);
+    for (int i = 0; i < w->dirs_cap; i++) free(w->dirs[i]);
+    free(w->dirs);
+    for (int i = 0; i < w->pending_len; i++) free(w->pending[i]);
+    free(w->pending);
+    free(w->input.s);
+    free(w->output.s);
+}
+
+/*
+Watches in_dir and embraces each changed .d.c file into the corresponding .c
+file in out_dir. Initially embraces all files whose output is missing or out of
+date. Options may be NULL, they must not have tags or includes. Does not return
+unless an error occurs.
+*/
+int watch(char* in_dir, char* out_dir, EmbraceOptions* options) {
+    require_not_null(in_dir);
+    require_not_null(out_dir);
+    require("no tags or includes",
+            options == NULL || (options->tags == NULL && options->includes == NULL));
+    Watcher w;
+    if (!watch_start(&w, in_dir, out_dir, options)) return 1;
+    watch_until(&w, -1);
+    watch_stop(&w);
+    return 1;
+}
+
+// Runs a shell command in the test directory.
+static void sh(char* command) {
+    panicf_if(system(command) != 0, "Command failed: %s", command);
+}
+
+// Checks if file exists and contains s.
+static bool file_contains(char* file, char* s) {
+    String text = {NULL, 0, 0};
+    bool found = read_file_into(file, &text) && strstr(text.s, s) != NULL;
+    free(text.s);
+    return found;
+}
+
+void watch_test(void) {
+    char cwd[4096];
+    panic_if(getcwd(cwd, sizeof(cwd)) == NULL, "Cannot get current directory.");
+    char dir[] = "/tmp/embrace_watch_XXXXXX";
+    panic_if(mkdtemp(dir) == NULL, "Cannot create directory.");
+    panic_if(chdir(dir) != 0, "Cannot change directory.");
+
+    // initially, files in subdirectories are embraced
+    sh("mkdir -p in/sub && printf 'int a\\n' > in/a.d.c && printf 'int b\\n' > in/sub/b.d.c");
+    Watcher w;
+    test_equal_i(watch_start(&w, "in", "out", NULL), true);
+    test_equal_i(file_contains("out/a.c", "int a;"), true);
+    test_equal_i(file_contains("out/sub/b.c", "int b;"), true);
+
+    // a change is embraced DEBOUNCE_MS after the last event, not before
+    sh("printf 'int a2\\n' > in/sub/b.d.c");
+    watch_until(&w, now_ms() + DEBOUNCE_MS / 2);
+    test_equal_i(w.pending_len, 1);
+    test_equal_i(file_contains("out/sub/b.c", "int a2;"), false);
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    test_equal_i(w.pending_len, 0);
+    test_equal_i(file_contains("out/sub/b.c", "int a2;"), true);
+
+    // a new directory gets a watch, files created in it are embraced
+    sh("mkdir -p in/new/deep && printf 'int c\\n' > in/new/deep/c.d.c");
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    test_equal_i(file_contains("out/new/deep/c.c", "int c;"), true);
+    sh("printf 'int c2\\n' > in/new/deep/c.d.c");
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    test_equal_i(file_contains("out/new/deep/c.c", "int c2;"), true);
+
+    // a renamed directory is watched under its new path
+    sh("mv in/new in/renamed");
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    sh("printf 'int c3\\n' > in/renamed/deep/c.d.c");
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    test_equal_i(file_contains("out/renamed/deep/c.c", "int c3;"), true);
+    test_equal_i(file_contains("out/new/deep/c.c", "int c3;"), false);
+
+    // a directory moved out of the tree is forgotten
+    sh("mv in/renamed away");
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    sh("printf 'int c4\\n' > away/deep/c.d.c");
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    test_equal_i(w.pending_len, 0);
+    test_equal_i(file_contains("out/renamed/deep/c.c", "int c4;"), false);
+    test_equal_i(file_contains("out/deep/c.c", "int c4;"), false);
+
+    // changes that keep coming are embraced MAX_DELAY_MS after the first one
+    long first = now_ms();
+    long delay = -1;
+    for (int i = 0; i < 3 * MAX_DELAY_MS / (DEBOUNCE_MS / 2) && delay < 0; i++) {
+        write_file("in/a.d.c", make_string("int d\n"));
+        watch_until(&w, now_ms() + DEBOUNCE_MS / 2);
+        if (file_contains("out/a.c", "int d;")) delay = now_ms() - first;
+    }
+    test_equal_i(delay >= 0, true);
+    test_equal_i(delay <= MAX_DELAY_MS + DEBOUNCE_MS, true);
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+
+    // after lost events, stale files are found by a rescan
+    sh("printf 'int e\\n' > in/sub/e.d.c");
+    char buf[64 * 1024];
+    usleep(20 * 1000);
+    while (read(w.fd, buf, sizeof(buf)) > 0) {} // drop the events
+    struct inotify_event overflow = {.wd = -1, .mask = IN_Q_OVERFLOW};
+    handle_event(&w, &overflow);
+    test_equal_i(w.pending_len, 1);
+    watch_until(&w, now_ms() + DEBOUNCE_MS + 50);
+    test_equal_i(file_contains("out/sub/e.c", "int e;"), true);
+
+    watch_stop(&w);
+    panic_if(chdir(cwd) != 0, "Cannot change directory.");
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    sh(command);
+}
+
+#else
+
+int watch(char* in_dir, char* out_dir, EmbraceOptions* options) {
+    fprintf(stderr, "Watch mode is only supported on Linux.\n");
+    return 1;
+}
+
+void watch_test(void) {}
+
+#endif
@@ -0,0 +1,14 @@
+/*
+@author: Michael Rohs
+@date: October 18, 2026
+*/
+
+#ifndef watch_h_INCLUDED
+#define watch_h_INCLUDED
+
+#include "embrace.h"
+
+int watch(char* in_dir, char* out_dir, EmbraceOptions* options);
+void watch_test(void);
+
+#endif // watch_h_INCLUDED